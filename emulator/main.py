@@ -3,11 +3,44 @@
 # SPDX-FileCopyrightText: Copyright 2024 Jookia
 
 import asyncio
+import bisect
+import math
 import os
+import re
+import signal
+import struct
 import sys
+import time
 import json
 
 
+# Real seconds per second of device time, so tests can get through keepalive
+# cycles quickly. ACE_TIME_SCALE=0.01 makes the 3 second keepalive take 30
+# milliseconds. The tests read the same variable.
+TIME_SCALE = float(os.getenv("ACE_TIME_SCALE", "1"))
+KEEPALIVE_TIMEOUT = 3 * TIME_SCALE
+RECONNECT_DELAY = 2 * TIME_SCALE
+
+# Optional model of the ACE's shared input and output buffer, see PROTOCOL.md.
+# ACE_BUFFER_SIZE bounds it in bytes, ACE_DRAIN_RATE is how many bytes per
+# second of device time the ACE works through and ACE_HANG_LENGTH is the
+# longest payload length it takes before freezing until it's power cycled
+# with SIGHUP. Zero turns each of them off, which is the default.
+BUFFER_SIZE = int(os.getenv("ACE_BUFFER_SIZE", "0"))
+DRAIN_RATE = float(os.getenv("ACE_DRAIN_RATE", "0"))
+HANG_LENGTH = int(os.getenv("ACE_HANG_LENGTH", "0"))
+
+# How many independent ACEs to present. The first is KobraACESimulator, the
+# rest are KobraACESimulator1, KobraACESimulator2 and so on. Every
+# ACE_REPORT_INTERVAL seconds the frame rate of each busy one is printed.
+INSTANCES = int(os.getenv("ACE_INSTANCES", "1"))
+REPORT_INTERVAL = float(os.getenv("ACE_REPORT_INTERVAL", "0"))
+
+# Frame store to answer requests from instead of a constant status, see
+# tests/framestore.h. Give its name without the .index or .frames.
+TRACE = os.getenv("ACE_TRACE")
+
+
 def realpathFD(fd):
     dir = "/proc/self/fd/"
     file = str(fd)
@@ -15,12 +48,99 @@ def realpathFD(fd):
     return os.path.realpath(path)
 
 
+# Tracks how full the buffer is as time passes. Input reaches the parser once
+# the ACE drains it and output waits in the buffer until it's drained too.
+# Any input arriving while output waits overwrites that output, losing it, and
+# input that doesn't fit is dropped.
+class DeviceBuffer:
+    def __init__(self, loop, size, rate):
+        self.loop = loop
+        self.size = size
+        self.rate = rate / TIME_SCALE
+        self.level = 0.0
+        self.time = loop.time()
+        self.input_ready = 0.0
+        self.output = 0
+        self.clobbered = False
+
+        self.received = 0
+        self.dropped = 0
+        self.sent = 0
+        self.lost = 0
+
+    def _drain(self):
+        now = self.loop.time()
+        if self.rate:
+            self.level = max(0.0, self.level - (now - self.time) * self.rate)
+        else:
+            self.level = 0.0
+        self.time = now
+
+    # Returns the part of data that fit in the buffer
+    def admit(self, data):
+        self._drain()
+        if self.output and not self.clobbered:
+            self.clobbered = True
+            self.level = max(0.0, self.level - self.output)
+        if self.size:
+            space = max(0, self.size - math.ceil(self.level))
+            accepted = data[:space]
+        else:
+            accepted = data
+        self.level += len(accepted)
+        self.received += len(accepted)
+        self.dropped += len(data) - len(accepted)
+        if self.rate:
+            self.input_ready = self.time + self.level / self.rate
+        return accepted
+
+    # Waits until everything admitted so far has been drained
+    async def wait_input(self):
+        delay = self.input_ready - self.loop.time()
+        if delay > 0:
+            await asyncio.sleep(delay)
+
+    # Waits for output to get through the buffer, returns whether it did
+    async def send(self, length):
+        self._drain()
+        while self.size and self.level and self.level + length > self.size:
+            await asyncio.sleep((self.level + length - self.size) / self.rate)
+            self._drain()
+        self.level += length
+        self.output = length
+        self.clobbered = False
+        try:
+            if self.rate:
+                await asyncio.sleep(self.level / self.rate)
+        finally:
+            self.output = 0
+        if self.clobbered:
+            self.lost += 1
+            return False
+        self.sent += 1
+        return True
+
+    def enabled(self):
+        return self.size or self.rate
+
+    def report(self):
+        return "%i bytes in, %i dropped, %i responses out, %i lost" % (
+            self.received,
+            self.dropped,
+            self.sent,
+            self.lost,
+        )
+
+
 class SimPTY:
-    def __init__(self, loop):
+    def __init__(self, loop, name, buffer):
         self.loop = loop
+        self.name = name
+        self.buffer = buffer
         self._destroyPTYPath()
         self._createPTY()
         self._createPTYPath()
+        self._startReading()
 
     def cleanup(self):
         self._destroyPTYPath()
@@ -33,7 +153,7 @@ class SimPTY:
 
     def _ptyPath(self):
         dir = os.getenv("XDG_RUNTIME_DIR")
-        file = "KobraACESimulator"
+        file = self.name
         path = runtime_path = dir + "/" + file
         return path
 
@@ -55,22 +175,54 @@ class SimPTY:
         os.close(self.controlFD)
         os.close(self.consumeFD)
 
+    def _startReading(self):
+        os.set_blocking(self.controlFD, False)
+        self.readBuffer = bytearray()
+        self.readError = None
+        self.readable = asyncio.Event()
+        self.loop.add_reader(self.controlFD, self._onReadable)
+
+    # Reads whatever is there as soon as it's there, so data piles up in
+    # readBuffer while the simulator is busy instead of 64 bytes at a time
+    def _onReadable(self):
+        try:
+            data = os.read(self.controlFD, 65536)
+            self.readBuffer.extend(self.buffer.admit(data))
+        except BlockingIOError:
+            return
+        except OSError as e:
+            self.readError = e
+            self.loop.remove_reader(self.controlFD)
+        self.readable.set()
+
     async def read(self):
-        readable = asyncio.Event()
-        onReadable = lambda: readable.set()
-        self.loop.add_reader(self.controlFD, onReadable)
-        await readable.wait()
-        self.loop.remove_reader(self.controlFD)
-        data = os.read(self.controlFD, 64)
+        while not self.readBuffer and self.readError is None:
+            self.readable.clear()
+            await self.readable.wait()
+        if self.readError is not None:
+            raise self.readError
+        data = bytes(self.readBuffer)
+        self.readBuffer.clear()
+        await self.buffer.wait_input()
         return data
 
     async def write(self, data):
-        writable = asyncio.Event()
-        onWritable = lambda: writable.set()
-        self.loop.add_writer(self.controlFD, onWritable)
-        await writable.wait()
-        self.loop.remove_writer(self.controlFD)
-        os.write(self.controlFD, data)
+        if not await self.buffer.send(len(data)):
+            return
+        data = memoryview(data)
+        while data:
+            try:
+                written = os.write(self.controlFD, data)
+                data = data[written:]
+                continue
+            except BlockingIOError:
+                pass
+            writable = asyncio.Event()
+            self.loop.add_writer(self.controlFD, writable.set)
+            try:
+                await writable.wait()
+            finally:
+                self.loop.remove_writer(self.controlFD)
 
 
 class Frame:
@@ -82,69 +234,91 @@ class Frame:
 class Parser:
     def __init__(self):
         self.buffer = bytearray()
-        self.field = bytearray()
         self.state = "none"
 
         self.payload_length = 0
-        self.payload = bytearray()
+        self.payload = b""
         self.payload_crc = 0
 
     def add_buffer(self, bytes):
         self.buffer.extend(bytes)
 
-    def parse_byte(self):
-        byte = self.buffer.pop(0)
+    # Parses from pos, returning the new position, a frame if one finished
+    # and whether more data is needed to go further
+    def parse_from(self, view, pos):
+        end = len(view)
         if self.state == "none":
-            if byte == 0xFF:
-                self.state = "maybe_header"
+            start = self.buffer.find(b"\xFF", pos)
+            if start == -1:
+                return (end, None, True)
+            # An 0xFF that doesn't start a header swallows the byte after it,
+            # even another 0xFF, so only an odd run of them counts
+            run_end = start + 1
+            while run_end < end and view[run_end] == 0xFF:
+                run_end += 1
+            odd = (run_end - start) % 2 == 1
+            if run_end == end:
+                if odd:
+                    self.state = "maybe_header"
+                return (end, None, True)
+            if odd and view[run_end] == 0xAA:
+                self.state = "length"
+            return (run_end + 1, None, False)
         elif self.state == "maybe_header":
-            if byte == 0xAA:
+            if end - pos < 1:
+                return (pos, None, True)
+            if view[pos] == 0xAA:
                 self.state = "length"
-                self.field = bytearray()
-                self.payload_length = 0
-                self.payload = bytearray()
-                self.payload_crc = 0
             else:
                 self.state = "none"
+            return (pos + 1, None, False)
         elif self.state == "length":
-            self.field.append(byte)
-            if len(self.field) == 2:
-                length = int.from_bytes(self.field, byteorder="little")
-                self.payload_length = length
-                if self.payload_length == 0:
-                    self.state = "crc"
-                    self.field = bytearray()
-                else:
-                    self.state = "payload"
+            if end - pos < 2:
+                return (pos, None, True)
+            length = int.from_bytes(view[pos : pos + 2], byteorder="little")
+            self.payload_length = length
+            if HANG_LENGTH and length > HANG_LENGTH:
+                self.state = "hung"
+            else:
+                self.state = "payload"
+            return (pos + 2, None, False)
         elif self.state == "payload":
-            self.payload.append(byte)
-            if len(self.payload) == self.payload_length:
-                self.state = "crc"
-                self.field = bytearray()
+            if end - pos < self.payload_length:
+                return (pos, None, True)
+            self.payload = bytes(view[pos : pos + self.payload_length])
+            self.state = "crc"
+            return (pos + self.payload_length, None, False)
         elif self.state == "crc":
-            self.field.append(byte)
-            if len(self.field) == 2:
-                crc = int.from_bytes(self.field, byteorder="little")
-                self.payload_crc = crc
-                self.state = "trailer"
+            if end - pos < 2:
+                return (pos, None, True)
+            crc = int.from_bytes(view[pos : pos + 2], byteorder="little")
+            self.payload_crc = crc
+            self.state = "trailer"
+            return (pos + 2, None, False)
         elif self.state == "trailer":
-            if byte == 0xFE:
-                self.state = "none"
-                frame = Frame(self.payload, self.payload_crc)
-                return frame
-            else:
-                # Deliberately ignore extra bytes
-                pass
+            # Deliberately ignore extra bytes
+            trailer = self.buffer.find(b"\xFE", pos)
+            if trailer == -1:
+                return (end, None, True)
+            self.state = "none"
+            frame = Frame(self.payload, self.payload_crc)
+            return (trailer + 1, frame, False)
+        elif self.state == "hung":
+            # Nothing gets the ACE out of this but a power cycle
+            return (end, None, True)
         else:
             raise RuntimeError("Unknown parser state?")
-        return None
 
     def parse(self):
         frames = []
-        while self.buffer != b"":
-            frame = self.parse_byte()
-            if frame is not None:
-                frames.append(frame)
+        pos = 0
+        with memoryview(self.buffer) as view:
+            more = False
+            while not more:
+                (pos, frame, more) = self.parse_from(view, pos)
+                if frame is not None:
+                    frames.append(frame)
+        del self.buffer[:pos]
         return frames
 
 
@@ -152,29 +326,165 @@ async def run_watchdog(watchdog_event):
     try:
         while True:
             wait = watchdog_event.wait()
-            await asyncio.wait_for(wait, timeout=3)
+            await asyncio.wait_for(wait, timeout=KEEPALIVE_TIMEOUT)
             watchdog_event.clear()
     except asyncio.TimeoutError:
         return 0
 
 
-# Calculates CRC-16/MCRF4XX on a bytearray
-def calc_crc(data):
-    crc = 0xFFFF
-
-    for i in range(0, len(data)):
-        byte = data[i]
-        crc = crc ^ byte
+def make_crc_table():
+    table = []
+    for byte in range(0, 256):
+        crc = byte
         for i in range(0, 8):
             if crc & 1:
                 crc = (crc >> 1) ^ 0x8408
             else:
                 crc = crc >> 1
+        table.append(crc)
+    return table
+
+
+CRC_TABLE = make_crc_table()
 
+
+# Calculates CRC-16/MCRF4XX on a bytearray, pass crc to continue a previous one
+def calc_crc(data, crc=0xFFFF):
+    table = CRC_TABLE
+    for byte in data:
+        crc = (crc >> 8) ^ table[(crc ^ byte) & 0xFF]
     return crc
 
 
-def process_frame(frame):
+# What running the CRC over that many bytes does to each nibble of the CRC
+# before them. There's no final XOR so it only depends on the length, and the
+# tables are kept for every length seen.
+CRC_SHIFTS = {}
+
+
+def crc_shift_table(length):
+    shifts = CRC_SHIFTS.get(length)
+    if shifts is not None:
+        return shifts
+    zeros = bytes(length)
+    bits = [calc_crc(zeros, 1 << bit) for bit in range(0, 16)]
+    shifts = []
+    for nibble in range(0, 4):
+        values = []
+        for value in range(0, 16):
+            crc = 0
+            for bit in range(0, 4):
+                if value & (1 << bit):
+                    crc ^= bits[nibble * 4 + bit]
+            values.append(crc)
+        shifts.append(values)
+    CRC_SHIFTS[length] = shifts
+    return shifts
+
+
+# Response with everything but the id encoded and checksummed up front. The
+# CRC of the part after the id is applied with tables of what it does to each
+# nibble of the CRC before it, so a response costs a CRC of the id alone.
+class ResponseTemplate:
+    ID_MARKER = "\0id\0"
+
+    def __init__(self, prefix, suffix):
+        self.prefix = prefix
+        self.suffix = suffix
+        self.prefix_crc = calc_crc(prefix)
+        self.suffix_crc = calc_crc(suffix, 0)
+        self.suffix_shift = crc_shift_table(len(suffix))
+
+    def frame(self, id):
+        id_text = json.dumps(id).encode("utf-8")
+        crc = calc_crc(id_text, self.prefix_crc)
+        shift = self.suffix_shift
+        crc = (
+            shift[0][crc & 0xF]
+            ^ shift[1][(crc >> 4) & 0xF]
+            ^ shift[2][(crc >> 8) & 0xF]
+            ^ shift[3][crc >> 12]
+            ^ self.suffix_crc
+        )
+        length = len(self.prefix) + len(id_text) + len(self.suffix)
+        return b"".join(
+            (
+                b"\xFF\xAA",
+                int.to_bytes(length, length=2, byteorder="little"),
+                self.prefix,
+                id_text,
+                self.suffix,
+                int.to_bytes(crc, length=2, byteorder="little"),
+                b"\xFE",
+            )
+        )
+
+
+# Template for a response given as a dict, its id is replaced
+def response_template(response):
+    response = dict(response)
+    response["id"] = ResponseTemplate.ID_MARKER
+    text = json.dumps(response).encode("utf-8")
+    marker = json.dumps(ResponseTemplate.ID_MARKER).encode("utf-8")
+    (prefix, suffix) = text.split(marker)
+    return ResponseTemplate(prefix, suffix)
+
+
+STATUS = json.loads(
+    '{"id":100,"result":{"status":"ready","dryer_status":{"status":"stop","target_temp":0,"duration":0,"remain_time":0},"temp":24,"enable_rfid":1,"fan_speed":7000,"feed_assist_count":0,"cont_assist_time":0.0,"slots":[{"index":0,"status":"ready","sku":"","type":"","color":[0,0,0],"rfid":1},{"index":1,"status":"ready","sku":"","type":"","color":[0,0,0],"rfid":1},{"index":2,"status":"ready","sku":"","type":"","color":[0,0,0],"rfid":1},{"index":3,"status":"ready","sku":"","type":"","color":[0,0,0],"rfid":1}]},"code":0,"msg":"success"}'
+)
+STATUS_RESPONSE = response_template(STATUS)
+SUCCESS_RESPONSE = response_template(
+    {"id": 100, "result": {}, "code": 0, "msg": "success"}
+)
+
+# What the ACE is busy doing during each motion method, and the methods that
+# stop one early
+MOTION_ACTIONS = {"feed_filament": "feeding", "unwind_filament": "unwinding"}
+MOTION_STOPS = {
+    "stop_feed_filament": "feeding",
+    "stop_unwind_filament": "unwinding",
+}
+
+
+# The status with the ACE busy, the action goes straight after the status
+def busy_response(action):
+    result = {"status": "busy", "action": action}
+    for key, value in STATUS["result"].items():
+        result.setdefault(key, value)
+    return response_template(dict(STATUS, result=result))
+
+
+BUSY_RESPONSES = {action: busy_response(action) for action in MOTION_ACTIONS.values()}
+
+
+# A move started by a motion method. It takes length / speed seconds of device
+# time and get_status says the ACE is busy until it's done.
+class Motion:
+    def __init__(self):
+        self.action = None
+        self.end = 0
+
+    def start(self, action, params):
+        try:
+            seconds = float(params["length"]) / float(params["speed"])
+        except (KeyError, TypeError, ValueError, ZeroDivisionError):
+            seconds = 0
+        self.action = action
+        self.end = time.monotonic() + max(seconds, 0) * TIME_SCALE
+
+    def stop(self, action):
+        if self.action == action:
+            self.action = None
+
+    def current(self):
+        if self.action is not None and time.monotonic() >= self.end:
+            self.action = None
+        return self.action
+
+
+# Returns the frame to respond with and how long to take about it, or None
+def process_frame(frame, ace):
     crc = calc_crc(frame.payload)
     if crc != frame.crc:
         return None
@@ -183,11 +493,22 @@ def process_frame(frame):
         payload = json.loads(frame.payload)
     except ValueError:
         return None
-    result = json.loads(
-        '{"id":100,"result":{"status":"ready","dryer_status":{"status":"stop","target_temp":0,"duration":0,"remain_time":0},"temp":24,"enable_rfid":1,"fan_speed":7000,"feed_assist_count":0,"cont_assist_time":0.0,"slots":[{"index":0,"status":"ready","sku":"","type":"","color":[0,0,0],"rfid":1},{"index":1,"status":"ready","sku":"","type":"","color":[0,0,0],"rfid":1},{"index":2,"status":"ready","sku":"","type":"","color":[0,0,0],"rfid":1},{"index":3,"status":"ready","sku":"","type":"","color":[0,0,0],"rfid":1}]},"code":0,"msg":"success"}'
-    )
-    result["id"] = payload["id"]
-    return json.dumps(result).encode("utf-8")
+    if ace.trace is not None:
+        response = ace.trace.respond(payload)
+        if response is not None:
+            return response
+    id = payload["id"]
+    method = payload.get("method")
+    if method in MOTION_ACTIONS:
+        ace.motion.start(MOTION_ACTIONS[method], payload.get("params"))
+        return (SUCCESS_RESPONSE.frame(id), 0)
+    if method in MOTION_STOPS:
+        ace.motion.stop(MOTION_STOPS[method])
+        return (SUCCESS_RESPONSE.frame(id), 0)
+    action = ace.motion.current()
+    if action is not None:
+        return (BUSY_RESPONSES[action].frame(id), 0)
+    return (STATUS_RESPONSE.frame(id), 0)
 
 
 def create_frame(data):
@@ -203,47 +524,235 @@ def create_frame(data):
     return frame
 
 
-async def run_sim(watchdog_event, parser):
-    loop = asyncio.get_running_loop()
-    sim = SimPTY(loop)
+FRAMESTORE_HEADER = struct.Struct("=8sIIII")
+FRAMESTORE_RECORD = struct.Struct("=QqqIiiHBB")
+FRAMESTORE_MAGIC = b"ACEFRM1\0"
+FRAMESTORE_VERSION = 2
+FRAMESTORE_BYTE_ORDER = 0x01020304
+FRAMESTORE_READ = 0
+FRAMESTORE_WRITE = 1
+FRAMESTORE_CRC_OK = 1 << 0
+FRAMESTORE_OVERSIZED = 1 << 1
+
+REPLY_ID = re.compile(rb'"id"\s*:\s*(-?[0-9]+)')
+
+
+# A reply from a capture, kept as recorded apart from its id
+class RecordedReply(ResponseTemplate):
+    def __init__(self, payload, id_start, id_end, delay):
+        super().__init__(payload[:id_start], payload[id_end:])
+        self.delay = delay
+
+
+# Every reply in a frame store that answers a request in it, in the order
+# they were recorded, with what method they answer and how long they took
+class Recording:
+    def __init__(self, name):
+        with open(name + ".index", "rb") as file:
+            index = file.read()
+        with open(name + ".frames", "rb") as file:
+            frames = file.read()
+        header = FRAMESTORE_HEADER.unpack_from(index)
+        expected = (
+            FRAMESTORE_MAGIC,
+            FRAMESTORE_VERSION,
+            FRAMESTORE_BYTE_ORDER,
+            FRAMESTORE_RECORD.size,
+        )
+        if header[0:4] != expected:
+            raise ValueError("%s isn't a frame store" % (name))
+        self.methods = []
+        self.replies = []
+        requests = {}
+        records = FRAMESTORE_RECORD.iter_unpack(
+            memoryview(index)[FRAMESTORE_HEADER.size :]
+        )
+        for record in records:
+            (offset, _, time_ns, size, id, _, _, direction, flags) = record
+            if not (flags & FRAMESTORE_CRC_OK) or (flags & FRAMESTORE_OVERSIZED):
+                continue
+            payload = frames[offset : offset + size]
+            if direction == FRAMESTORE_WRITE:
+                try:
+                    request = json.loads(payload)
+                    requests[request["id"]] = (request["method"], time_ns)
+                except (ValueError, KeyError, TypeError):
+                    pass
+                continue
+            if id not in requests:
+                continue
+            (method, request_ns) = requests.pop(id)
+            match = REPLY_ID.search(payload)
+            if match is None or int(match[1]) != id:
+                continue
+            delay = 0
+            if request_ns >= 0 and time_ns >= request_ns:
+                delay = (time_ns - request_ns) / 1e9
+            reply = RecordedReply(payload, match.start(1), match.end(1), delay)
+            self.methods.append(method)
+            self.replies.append(reply)
+        self.positions = {}
+        for position, method in enumerate(self.methods):
+            self.positions.setdefault(method, []).append(position)
+
+
+# Plays a recording back as requests come in. Each request gets the next
+# recorded reply to its method, moving through the recording so state changes
+# come in the order they happened, and starting over at the end. Methods the
+# recording never saw get the constant status.
+class TraceResponder:
+    def __init__(self, recording):
+        self.recording = recording
+        self.cursor = 0
+
+    def respond(self, request):
+        positions = self.recording.positions.get(request.get("method"))
+        if not positions:
+            return None
+        i = bisect.bisect_left(positions, self.cursor)
+        if i == len(positions):
+            i = 0
+        position = positions[i]
+        self.cursor = position + 1
+        reply = self.recording.replies[position]
+        return (reply.frame(request["id"]), reply.delay * TIME_SCALE)
+
+
+# One simulated ACE, with everything it keeps across connections
+class Simulator:
+    def __init__(self, loop, index, recording):
+        self.loop = loop
+        self.recording = recording
+        self.name = "KobraACESimulator"
+        if index:
+            self.name += str(index)
+        self.reset_event = asyncio.Event()
+        self.frames = 0
+        self.responses = 0
+        self._powerOn()
+
+    def _powerOn(self):
+        self.parser = Parser()
+        self.buffer = DeviceBuffer(self.loop, BUFFER_SIZE, DRAIN_RATE)
+        self.motion = Motion()
+        self.trace = None
+        if self.recording is not None:
+            self.trace = TraceResponder(self.recording)
+
+    async def run(self):
+        last_report = None
+        while True:
+            await run_cycle(self)
+            if self.buffer.enabled() or HANG_LENGTH:
+                last_report = report(self, last_report)
+            if self.reset_event.is_set():
+                # Power cycle, forgetting any partial frame or hang
+                self.reset_event.clear()
+                self._powerOn()
+            await asyncio.sleep(RECONNECT_DELAY)
+
+
+async def run_sim(watchdog_event, ace):
+    sim = SimPTY(ace.loop, ace.name, ace.buffer)
+    parser = ace.parser
     try:
         while True:
             data = await sim.read()
             parser.add_buffer(data)
             frames = parser.parse()
+            ace.frames += len(frames)
             for f in frames:
                 # TODO: Is the watchdog pinged multiple times on real hardware?
                 # TODO: Is the watchdog pinged before or after frame processing?
                 # TODO: Is the watchdog pinged before or after writing?
                 watchdog_event.set()
-                out = process_frame(f)
-                if out is not None:
-                    frame = create_frame(out)
+                response = process_frame(f, ace)
+                if response is not None:
+                    (frame, delay) = response
+                    if delay:
+                        await asyncio.sleep(delay)
                     await sim.write(frame)
+                    ace.responses += 1
     finally:
         sim.cleanup()
     return 0
 
 
-async def run_cycle(parser):
+async def run_cycle(ace):
     watchdog_event = asyncio.Event()
-    sim_task = asyncio.create_task(run_sim(watchdog_event, parser))
+    sim_task = asyncio.create_task(run_sim(watchdog_event, ace))
     watchdog_task = asyncio.create_task(run_watchdog(watchdog_event))
-    all_tasks = [sim_task, watchdog_task]
+    reset_task = asyncio.create_task(ace.reset_event.wait())
+    all_tasks = [sim_task, watchdog_task, reset_task]
     (done, pending) = await asyncio.wait(all_tasks, return_when=asyncio.FIRST_COMPLETED)
     sim_task.cancel()
     watchdog_task.cancel()
+    reset_task.cancel()
     if sim_task.done() and sim_task.exception():
         raise sim_task.exception()
 
 
+def report(ace, last):
+    line = ace.buffer.report()
+    if ace.parser.state == "hung":
+        line += ", hung"
+    if line != last:
+        print("%s: %s" % (ace.name, line), file=sys.stderr, flush=True)
+    return line
+
+
+async def run_rates(aces):
+    counts = [(0, 0)] * len(aces)
+    start = time.monotonic()
+    while True:
+        await asyncio.sleep(REPORT_INTERVAL)
+        now = time.monotonic()
+        elapsed = now - start
+        start = now
+        total = 0
+        for i, ace in enumerate(aces):
+            (frames, responses) = counts[i]
+            counts[i] = (ace.frames, ace.responses)
+            if ace.frames == frames:
+                continue
+            total += ace.frames - frames
+            print(
+                "%s: %.0f frames/s in, %.0f out"
+                % (
+                    ace.name,
+                    (ace.frames - frames) / elapsed,
+                    (ace.responses - responses) / elapsed,
+                ),
+                file=sys.stderr,
+            )
+        if total:
+            print("Total: %.0f frames/s in" % (total / elapsed), file=sys.stderr)
+        sys.stderr.flush()
+
+
+def reset_all(aces):
+    for ace in aces:
+        ace.reset_event.set()
+
+
 async def main():
-    parser = Parser()
+    loop = asyncio.get_running_loop()
+    recording = None
+    if TRACE:
+        recording = Recording(TRACE)
+        print(
+            "Loaded %i replies to %i methods from %s"
+            % (len(recording.replies), len(recording.positions), TRACE),
+            file=sys.stderr,
+        )
+    aces = [Simulator(loop, i, recording) for i in range(0, INSTANCES)]
+    loop.add_signal_handler(signal.SIGHUP, reset_all, aces)
+    tasks = [ace.run() for ace in aces]
+    if REPORT_INTERVAL:
+        tasks.append(run_rates(aces))
     err = 0
     try:
-        while True:
-            await run_cycle(parser)
-            await asyncio.sleep(2)
+        await asyncio.gather(*tasks)
     except (asyncio.CancelledError, KeyboardInterrupt):
         err = 1
     return err
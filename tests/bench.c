@@ -0,0 +1,952 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "decoder.h"
+#include "encoder.h"
+#include "jsonindex.h"
+#include "methods.h"
+#include "mjson.h"
+#include "pool.h"
+#include "query.h"
+#include "schema.h"
+#include "status.h"
+#include "strace.h"
+#include "telemetry.h"
+#include "template.h"
+
+// Benchmarks JSON lookups on payloads pulled out of strace logs:
+//
+//   ./bench ../raw_data/*.strace
+
+struct payload {
+	char *buf;
+	size_t len;
+};
+
+struct payloads {
+	struct payload *list;
+	size_t count;
+	size_t capacity;
+	size_t bytes;
+};
+
+static const char *bench_paths[] = {
+	"$.id",
+	"$.result.status",
+	"$.result.temp",
+	"$.result.dryer_status.remain_time",
+	"$.result.slots[3].rfid",
+	"$.result.missing",
+};
+
+#define BENCH_PATH_COUNT (sizeof(bench_paths) / sizeof(*bench_paths))
+#define BENCH_MIN_NS 200000000LL
+
+static int64_t bench_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void payloads_add(struct payloads *payloads,
+	const unsigned char *buf, size_t len) {
+	if (payloads->count == payloads->capacity) {
+		payloads->capacity = payloads->capacity ? payloads->capacity * 2
+							: 1024;
+		payloads->list = realloc(payloads->list,
+			payloads->capacity * sizeof(*payloads->list));
+		if (payloads->list == NULL) {
+			abort();
+		}
+	}
+	char *copy = malloc(len + 1);
+	if (copy == NULL) {
+		abort();
+	}
+	memcpy(copy, buf, len);
+	copy[len] = '\0';
+	payloads->list[payloads->count].buf = copy;
+	payloads->list[payloads->count].len = len;
+	payloads->count += 1;
+	payloads->bytes += len;
+}
+
+static void feed_call(struct decoder *dec, struct payloads *payloads,
+	const unsigned char *data, size_t len) {
+	while (len > 0) {
+		size_t fed = decoder_feed(dec, data, len);
+		data += fed;
+		len -= fed;
+		struct decoderFrame frame;
+		enum decoderResult res;
+		while ((res = decoder_next(dec, &frame)) != DECODER_MORE) {
+			if (res == DECODER_FRAME) {
+				payloads_add(payloads, frame.payload,
+					frame.payload_len);
+			}
+		}
+	}
+}
+
+static void read_strace(const char *path, struct payloads *payloads) {
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		perror(path);
+		exit(1);
+	}
+	// One decoder per direction as reads and writes interleave
+	static struct decoder decoders[2];
+	decoder_init(&decoders[STRACE_READ]);
+	decoder_init(&decoders[STRACE_WRITE]);
+	static struct straceReader reader;
+	strace_reader_init(&reader);
+	char *line = NULL;
+	size_t line_cap = 0;
+	ssize_t line_len;
+	while ((line_len = getline(&line, &line_cap, file)) != -1) {
+		struct straceCall call;
+		if (!strace_reader_line(&reader, line, line_len, &call) ||
+			call.fd <= 2 || call.result <= 0) {
+			continue;
+		}
+		feed_call(&decoders[call.direction], payloads, call.data,
+			call.data_len);
+	}
+	strace_reader_free(&reader);
+	free(line);
+	fclose(file);
+}
+
+static void bench_mjson(struct payloads *payloads) {
+	size_t rounds = 0;
+	int64_t start = bench_now_ns();
+	int64_t elapsed;
+	do {
+		for (size_t i = 0; i < payloads->count; ++i) {
+			struct payload *pl = &payloads->list[i];
+			for (size_t j = 0; j < BENCH_PATH_COUNT; ++j) {
+				const char *value;
+				int value_len;
+				mjson_find(pl->buf, pl->len, bench_paths[j],
+					&value, &value_len);
+			}
+		}
+		rounds += 1;
+		elapsed = bench_now_ns() - start;
+	} while (elapsed < BENCH_MIN_NS);
+	fprintf(stdout, "mjson: %zu paths in %.0f ns per payload\n",
+		BENCH_PATH_COUNT,
+		(double)elapsed / (rounds * payloads->count));
+}
+
+static struct jsonIndex bench_idx;
+static unsigned char bench_buf[ENCODER_MAX_FRAME];
+
+static void bench_engine(
+	struct payloads *payloads, const struct jsonindexEngine *engine) {
+	size_t rounds = 0;
+	int64_t start = bench_now_ns();
+	int64_t elapsed;
+	do {
+		for (size_t i = 0; i < payloads->count; ++i) {
+			struct payload *pl = &payloads->list[i];
+			jsonindex_build_with(
+				&bench_idx, pl->buf, pl->len, engine);
+		}
+		rounds += 1;
+		elapsed = bench_now_ns() - start;
+	} while (elapsed < BENCH_MIN_NS);
+	double build_ns = (double)elapsed / (rounds * payloads->count);
+	double mb_per_s = (double)payloads->bytes * rounds * 1000 / elapsed;
+	rounds = 0;
+	start = bench_now_ns();
+	do {
+		for (size_t i = 0; i < payloads->count; ++i) {
+			struct payload *pl = &payloads->list[i];
+			jsonindex_build_with(
+				&bench_idx, pl->buf, pl->len, engine);
+			for (size_t j = 0; j < BENCH_PATH_COUNT; ++j) {
+				const char *value;
+				int value_len;
+				jsonindex_find(&bench_idx, bench_paths[j],
+					&value, &value_len);
+			}
+		}
+		rounds += 1;
+		elapsed = bench_now_ns() - start;
+	} while (elapsed < BENCH_MIN_NS);
+	fprintf(stdout,
+		"jsonindex %s: build %.0f ns (%.0f MB/s), "
+		"build and %zu paths in %.0f ns per payload\n",
+		engine->name, build_ns, mb_per_s, BENCH_PATH_COUNT,
+		(double)elapsed / (rounds * payloads->count));
+}
+
+// One pass for all the paths with the selected engine, checked against
+// separate lookups. Returns the number of mismatches.
+static size_t bench_query(struct payloads *payloads) {
+	struct query q;
+	struct queryValue values[BENCH_PATH_COUNT];
+	struct queryResult results[BENCH_PATH_COUNT];
+	query_init(&q);
+	for (size_t j = 0; j < BENCH_PATH_COUNT; ++j) {
+		int path = query_add(&q, bench_paths[j]);
+		if (path == -1) {
+			abort();
+		}
+		results[path].values = &values[j];
+		results[path].capacity = 1;
+	}
+	size_t mismatches = 0;
+	for (size_t i = 0; i < payloads->count; ++i) {
+		struct payload *pl = &payloads->list[i];
+		query_extract(&q, &bench_idx, pl->buf, pl->len, results);
+		for (size_t j = 0; j < BENCH_PATH_COUNT; ++j) {
+			const char *want = NULL;
+			int want_len = 0;
+			int want_type = mjson_find(pl->buf, pl->len,
+				bench_paths[j], &want, &want_len);
+			bool found = (results[j].count != 0);
+			if (found != (want_type != MJSON_TOK_INVALID) ||
+				(found && (values[j].type != want_type ||
+				values[j].value != want ||
+				values[j].value_len != want_len))) {
+				mismatches += 1;
+			}
+		}
+	}
+	if (mismatches != 0) {
+		fprintf(stdout, "query: %zu mismatches\n", mismatches);
+		return mismatches;
+	}
+	size_t rounds = 0;
+	int64_t start = bench_now_ns();
+	int64_t elapsed;
+	do {
+		for (size_t i = 0; i < payloads->count; ++i) {
+			struct payload *pl = &payloads->list[i];
+			query_extract(&q, &bench_idx, pl->buf, pl->len,
+				results);
+		}
+		rounds += 1;
+		elapsed = bench_now_ns() - start;
+	} while (elapsed < BENCH_MIN_NS);
+	fprintf(stdout, "query: build and %zu paths in %.0f ns per payload\n",
+		BENCH_PATH_COUNT,
+		(double)elapsed / (rounds * payloads->count));
+	return 0;
+}
+
+// Every engine has to agree with mjson or the numbers mean nothing
+static size_t check_engine(
+	struct payloads *payloads, const struct jsonindexEngine *engine) {
+	size_t mismatches = 0;
+	for (size_t i = 0; i < payloads->count; ++i) {
+		struct payload *pl = &payloads->list[i];
+		bool built = jsonindex_build_with(
+			&bench_idx, pl->buf, pl->len, engine);
+		for (size_t j = 0; j < BENCH_PATH_COUNT; ++j) {
+			const char *want = NULL;
+			const char *got = NULL;
+			int want_len = 0;
+			int got_len = 0;
+			int want_type = mjson_find(pl->buf, pl->len,
+				bench_paths[j], &want, &want_len);
+			int got_type = MJSON_TOK_INVALID;
+			if (built) {
+				got_type = jsonindex_find(&bench_idx,
+					bench_paths[j], &got, &got_len);
+			}
+			if (want_type != got_type || (want_type !=
+				MJSON_TOK_INVALID && (want != got ||
+				want_len != got_len))) {
+				mismatches += 1;
+			}
+		}
+	}
+	return mismatches;
+}
+
+static size_t check_strings(const char *want, const char *got) {
+	return strcmp(want, got) != 0;
+}
+
+// Returns the number of fields that differ between two statuses
+static size_t check_status(
+	const struct statusState *want, const struct statusState *got) {
+	size_t mismatches = check_strings(want->status, got->status) +
+		check_strings(want->action, got->action) +
+		check_strings(want->dryer.status, got->dryer.status) +
+		(want->dryer.target_temp != got->dryer.target_temp) +
+		(want->dryer.duration != got->dryer.duration) +
+		(want->dryer.remain_time != got->dryer.remain_time) +
+		(want->temp != got->temp) +
+		(want->enable_rfid != got->enable_rfid) +
+		(want->fan_speed != got->fan_speed) +
+		(want->feed_assist_count != got->feed_assist_count) +
+		(want->cont_assist_time != got->cont_assist_time) +
+		(want->slot_count != got->slot_count);
+	for (int j = 0; j < STATUS_MAX_SLOTS; ++j) {
+		const struct statusSlot *ws = &want->slots[j];
+		const struct statusSlot *gs = &got->slots[j];
+		mismatches += (ws->index != gs->index) +
+			check_strings(ws->status, gs->status) +
+			check_strings(ws->sku, gs->sku) +
+			check_strings(ws->brand, gs->brand) +
+			check_strings(ws->type, gs->type) +
+			(ws->color[0] != gs->color[0]) +
+			(ws->color[1] != gs->color[1]) +
+			(ws->color[2] != gs->color[2]) +
+			(ws->rfid != gs->rfid);
+	}
+	return mismatches;
+}
+
+// Escapes the logs don't have, and a key the schema doesn't know
+static const char *const bench_status_extras[] = {
+	"{\"id\":1,\"code\":0,\"result\":{\"status\":\"re\\u0061dy\","
+	"\"action\":\"\\u0066eeding\",\"dryer_status\":{\"status\":"
+	"\"st\\u006Fp\"},\"slots\":[{\"index\":0,\"status\":"
+	"\"\\u00e9mpty\",\"sku\":\"AB\\u4e2d\",\"brand\":\"a\\nb\","
+	"\"type\":\"\\\"PLA\\\"\"}]}}",
+	"{\"id\":2,\"code\":0,\"result\":{\"status\":\"ready\","
+	"\"firmware\":\"\\u4e2d\",\"slots\":[{\"index\":0,"
+	"\"status\":\"ready\"}]}}",
+};
+
+#define BENCH_STATUS_EXTRAS \
+	(sizeof(bench_status_extras) / sizeof(*bench_status_extras))
+
+// The schema decoder checked field by field against the mjson path it
+// replaced, then both timed. Returns the number of fields that differ.
+static size_t bench_status(struct payloads *payloads) {
+	static struct statusState want;
+	static struct statusState got;
+	struct schemaReply reply;
+	size_t statuses = 0;
+	size_t mismatches = 0;
+	for (size_t i = 0; i < BENCH_STATUS_EXTRAS; ++i) {
+		const char *extra = bench_status_extras[i];
+		if (!status_parse(extra, strlen(extra), &want) ||
+			!schema_parse_status(
+				extra, strlen(extra), &got, &reply)) {
+			mismatches += 1;
+			continue;
+		}
+		mismatches += check_status(&want, &got);
+	}
+	for (size_t i = 0; i < payloads->count; ++i) {
+		struct payload *pl = &payloads->list[i];
+		if (!status_parse(pl->buf, pl->len, &want) ||
+			want.slot_count == 0) {
+			continue;
+		}
+		statuses += 1;
+		if (!schema_parse_status(pl->buf, pl->len, &got, &reply)) {
+			mismatches += 1;
+			continue;
+		}
+		mismatches += check_status(&want, &got);
+	}
+	if (mismatches != 0) {
+		fprintf(stdout, "schema status: %zu mismatches\n", mismatches);
+		return mismatches;
+	}
+	int64_t elapsed[2];
+	for (int parser = 0; parser < 2; ++parser) {
+		size_t rounds = 0;
+		int64_t start = bench_now_ns();
+		do {
+			for (size_t i = 0; i < payloads->count; ++i) {
+				struct payload *pl = &payloads->list[i];
+				if (parser == 0) {
+					schema_parse_status(pl->buf, pl->len,
+						&got, &reply);
+				} else {
+					status_parse(pl->buf, pl->len, &want);
+				}
+			}
+			rounds += 1;
+			elapsed[parser] = bench_now_ns() - start;
+		} while (elapsed[parser] < BENCH_MIN_NS);
+		elapsed[parser] /= rounds;
+	}
+	fprintf(stdout,
+		"schema status: %zu replies match mjson, %.0f ns against "
+		"%.0f ns per payload\n",
+		statuses, (double)elapsed[0] / payloads->count,
+		(double)elapsed[1] / payloads->count);
+	return 0;
+}
+
+// Runs the status replies through the cache as if they were polled in order,
+// checking the cached state against a full parse of each reply, then times
+// the cache against parsing every reply. Returns the number of mismatches.
+static size_t bench_status_cache(struct payloads *payloads) {
+	static struct statusCache cache;
+	static struct statusState want;
+	struct schemaReply reply;
+	struct statusDiff diff;
+	struct payload *replies = malloc(payloads->count * sizeof(*replies));
+	if (replies == NULL) {
+		abort();
+	}
+	size_t count = 0;
+	size_t mismatches = 0;
+	status_cache_init(&cache);
+	for (size_t i = 0; i < payloads->count; ++i) {
+		struct payload *pl = &payloads->list[i];
+		if (!schema_parse_status(pl->buf, pl->len, &want, &reply) ||
+			want.slot_count == 0) {
+			continue;
+		}
+		replies[count++] = *pl;
+		if (status_cache_update(&cache, pl->buf, pl->len, &diff) ==
+			STATUS_INVALID) {
+			mismatches += 1;
+			continue;
+		}
+		mismatches += check_status(&want, &cache.state);
+	}
+	// A key the schema skips could be something it misses, so mjson
+	// parses the reply instead
+	for (size_t i = 0; i < BENCH_STATUS_EXTRAS; ++i) {
+		const char *extra = bench_status_extras[i];
+		unsigned long fallbacks = cache.stats.fallbacks;
+		schema_parse_status(extra, strlen(extra), &want, &reply);
+		bool unknown = (reply.unknown_keys != 0);
+		status_parse(extra, strlen(extra), &want);
+		status_cache_update(&cache, extra, strlen(extra), &diff);
+		mismatches += check_status(&want, &cache.state);
+		mismatches += (cache.stats.fallbacks != fallbacks + unknown);
+	}
+	if (mismatches != 0) {
+		fprintf(stdout, "status cache: %zu mismatches\n", mismatches);
+		free(replies);
+		return mismatches;
+	}
+	struct statusCacheStats stats = cache.stats;
+	int64_t elapsed[2];
+	for (int cached = 0; cached < 2; ++cached) {
+		size_t rounds = 0;
+		int64_t start = bench_now_ns();
+		do {
+			status_cache_init(&cache);
+			for (size_t i = 0; i < count; ++i) {
+				struct payload *pl = &replies[i];
+				if (cached) {
+					status_cache_update(&cache, pl->buf,
+						pl->len, &diff);
+				} else {
+					schema_parse_status(pl->buf, pl->len,
+						&want, &reply);
+				}
+			}
+			rounds += 1;
+			elapsed[cached] = bench_now_ns() - start;
+		} while (elapsed[cached] < BENCH_MIN_NS);
+		elapsed[cached] /= rounds;
+	}
+	fprintf(stdout,
+		"status cache: %lu parses of %lu replies, %lu fallbacks, "
+		"%lu changed\n",
+		stats.parses, stats.updates, stats.fallbacks, stats.changed);
+	fprintf(stdout,
+		"status cache: %.0f ns per reply against %.0f ns parsing "
+		"every one\n",
+		(double)elapsed[1] / count, (double)elapsed[0] / count);
+	free(replies);
+	return 0;
+}
+
+// Checks a view holds len bytes from buf followed by a NUL
+static size_t check_view(
+	const struct poolView *view, const char *buf, size_t len) {
+	return (view->len != len || memcmp(view->data, buf, len) != 0);
+}
+
+static size_t check_pool_idle(const struct pool *pool) {
+	size_t mismatches = 0;
+	for (int i = 0; i < POOL_CLASS_COUNT; ++i) {
+		mismatches += (pool->stats.classes[i].in_use != 0);
+	}
+	return mismatches;
+}
+
+// Copies every payload in to the pool, shares and slices it, then drops the
+// views out of order. Arenas are filled past one block and released. Returns
+// the number of mismatches.
+static size_t bench_pool(struct payloads *payloads) {
+	static struct pool pool;
+	if (!pool_init(&pool)) {
+		abort();
+	}
+	size_t mismatches = 0;
+	for (size_t i = 0; i < payloads->count; ++i) {
+		struct payload *pl = &payloads->list[i];
+		struct poolView view;
+		if (pl->len >= POOL_MAX_ALLOC) {
+			continue;
+		}
+		if (!pool_copy(&pool, pl->buf, pl->len, &view)) {
+			mismatches += 1;
+			continue;
+		}
+		struct poolView shared = pool_view_share(&view);
+		struct poolView slice =
+			pool_view_slice(&view, pl->len / 4, pl->len / 2);
+		struct poolView outside = pool_view_slice(&view, 1, pl->len);
+		// The block has to outlive the view it was copied in to
+		pool_view_release(&view);
+		pool_view_release(&view);
+		mismatches += !pool_view_empty(&outside);
+		mismatches += check_view(&shared, pl->buf, pl->len);
+		mismatches += (shared.data[pl->len] != '\0');
+		mismatches += check_view(
+			&slice, pl->buf + pl->len / 4, pl->len / 2);
+		pool_view_release(&shared);
+		mismatches += (check_pool_idle(&pool) == 0);
+		pool_view_release(&slice);
+		mismatches += check_pool_idle(&pool);
+	}
+	// Running the smallest class dry borrows from the next one up
+	size_t count = pool.stats.classes[0].blocks + 1;
+	struct poolBlock **blocks = malloc(count * sizeof(*blocks));
+	if (blocks == NULL) {
+		abort();
+	}
+	for (size_t i = 0; i < count; ++i) {
+		blocks[i] = pool_alloc(&pool, 1);
+		mismatches += (blocks[i] == NULL);
+	}
+	mismatches += (pool.stats.classes[0].borrowed != 1);
+	mismatches += (pool.stats.classes[1].in_use != 1);
+	for (size_t i = 0; i < count; ++i) {
+		if (blocks[i] != NULL) {
+			pool_unref(blocks[i]);
+		}
+	}
+	free(blocks);
+	struct poolArena arena;
+	pool_arena_init(&arena, &pool);
+	size_t allocated = 0;
+	while (allocated <= POOL_MAX_ALLOC * 2) {
+		unsigned char *ptr = pool_arena_alloc(&arena, 100);
+		if (ptr == NULL || (uintptr_t)ptr % POOL_ALIGN != 0) {
+			mismatches += 1;
+			break;
+		}
+		memset(ptr, 0xAA, 100);
+		allocated += 100;
+	}
+	mismatches += (pool_arena_alloc(&arena, POOL_MAX_ALLOC + 1) != NULL);
+	mismatches += (arena.blocks != 3);
+	mismatches += (pool.stats.arenas != 1);
+	mismatches += (pool.stats.arena_high_water != 3);
+	mismatches +=
+		(pool.stats.classes[POOL_CLASS_COUNT - 1].in_use != 3);
+	pool_arena_release(&arena);
+	mismatches += (arena.blocks != 0);
+	mismatches += check_pool_idle(&pool);
+	if (mismatches != 0) {
+		fprintf(stdout, "pool: %zu mismatches\n", mismatches);
+		pool_close(&pool);
+		return mismatches;
+	}
+	for (int i = 0; i < POOL_CLASS_COUNT; ++i) {
+		struct poolClassStats *stats = &pool.stats.classes[i];
+		fprintf(stdout,
+			"pool: %zu byte class, %lu allocs, %lu borrowed, "
+			"%zu of %zu high water\n",
+			stats->size, stats->allocs, stats->borrowed,
+			stats->high_water, stats->blocks);
+	}
+	int64_t elapsed[2];
+	size_t copies = 0;
+	for (int pooled = 0; pooled < 2; ++pooled) {
+		size_t rounds = 0;
+		int64_t start = bench_now_ns();
+		copies = 0;
+		do {
+			for (size_t i = 0; i < payloads->count; ++i) {
+				struct payload *pl = &payloads->list[i];
+				if (pl->len >= POOL_MAX_ALLOC) {
+					continue;
+				}
+				if (pooled) {
+					struct poolView view;
+					pool_copy(&pool, pl->buf, pl->len,
+						&view);
+					pool_view_release(&view);
+				} else {
+					char *buf = malloc(pl->len + 1);
+					memcpy(buf, pl->buf, pl->len);
+					buf[pl->len] = '\0';
+					free(buf);
+				}
+				copies += 1;
+			}
+			rounds += 1;
+			elapsed[pooled] = bench_now_ns() - start;
+		} while (elapsed[pooled] < BENCH_MIN_NS);
+		elapsed[pooled] /= rounds;
+		copies /= rounds;
+	}
+	fprintf(stdout,
+		"pool: %.0f ns per payload copy against %.0f ns with malloc\n",
+		(double)elapsed[1] / copies, (double)elapsed[0] / copies);
+	pool_close(&pool);
+	return 0;
+}
+
+// The CRC of get_status with this id lands FF AA in the trailer
+#define BENCH_COLLIDING_ID 7376
+
+// Checks a padded frame is free of collisions and decodes back to a request
+// with the same id and method
+static size_t check_padded(
+	const unsigned char *frame, size_t frame_len, int want_id) {
+	static struct decoder dec;
+	struct decoderFrame decoded;
+	if (frame_len == 0 || encoder_collides(frame, frame_len)) {
+		return 1;
+	}
+	decoder_init(&dec);
+	decoder_feed(&dec, frame, frame_len);
+	if (decoder_next(&dec, &decoded) != DECODER_FRAME) {
+		return 1;
+	}
+	const char *payload = (const char *)decoded.payload;
+	int len = decoded.payload_len;
+	double id = 0;
+	char method[32] = "";
+	mjson_get_number(payload, len, "$.id", &id);
+	mjson_get_string(payload, len, "$.method", method, sizeof(method));
+	return (id != want_id || strcmp(method, "get_status") != 0);
+}
+
+// Encodes a request known to collide every way there is to build one
+static size_t check_collision(const struct requestTemplate *request) {
+	static struct encoder enc;
+	size_t mismatches = 0;
+	encoder_init(&enc);
+	encoder_begin(&enc);
+	mjson_printf(encoder_print, &enc, "{%Q:%d,%Q:%Q}", "id",
+		BENCH_COLLIDING_ID, "method", "get_status");
+	size_t unpadded_len = enc.payload_len + ENCODER_OVERHEAD;
+	size_t frame_len = encoder_finish(&enc);
+	mismatches += (frame_len <= unpadded_len);
+	mismatches += check_padded(enc.buf, frame_len, BENCH_COLLIDING_ID);
+	mismatches += (enc.stats.rewrites != 1 || enc.stats.collisions != 0);
+	mismatches += (template_render(request, BENCH_COLLIDING_ID,
+			       bench_buf) != 0);
+	struct method_get_status req = {BENCH_COLLIDING_ID};
+	encoder_init(&enc);
+	frame_len = method_encode_get_status(&enc, &req);
+	mismatches += check_padded(enc.buf, frame_len, BENCH_COLLIDING_ID);
+	mismatches += (enc.stats.rewrites != 1);
+	if (mismatches != 0) {
+		fprintf(stdout, "encoder: %zu collision mismatches\n",
+			mismatches);
+	}
+	return mismatches;
+}
+
+// Building get_status requests with the encoder against a template
+static size_t bench_requests(void) {
+	static struct encoder enc;
+	static struct requestTemplate request;
+	if (!template_init(&request, "get_status", NULL)) {
+		abort();
+	}
+	size_t mismatches = check_collision(&request);
+	if (mismatches != 0) {
+		return mismatches;
+	}
+	encoder_init(&enc);
+	int id = 0;
+	int64_t start = bench_now_ns();
+	int64_t elapsed;
+	do {
+		for (int i = 0; i < 1000; ++i, ++id) {
+			encoder_begin(&enc);
+			mjson_printf(encoder_print, &enc, "{%Q:%d,%Q:%Q}",
+				"id", id, "method", "get_status");
+			encoder_finish(&enc);
+		}
+		elapsed = bench_now_ns() - start;
+	} while (elapsed < BENCH_MIN_NS);
+	fprintf(stdout, "encoder: %.0f ns per request\n",
+		(double)elapsed / id);
+	fprintf(stdout,
+		"encoder: %lu frames, %lu padded in %lu attempts, "
+		"%lu given up on\n",
+		enc.stats.frames, enc.stats.rewrites,
+		enc.stats.rewrite_attempts, enc.stats.collisions);
+	size_t fallbacks = 0;
+	for (int i = 0; i < 100000; ++i) {
+		encoder_begin(&enc);
+		mjson_printf(encoder_print, &enc, "{%Q:%d,%Q:%Q}", "id", i,
+			"method", "get_status");
+		size_t want_len = encoder_finish(&enc);
+		size_t got_len = template_render(&request, i, bench_buf);
+		if (got_len == 0) {
+			// Only frames that needed padding fall back
+			fallbacks += 1;
+			mismatches += check_padded(enc.buf, want_len, i);
+		} else if (got_len != want_len ||
+			memcmp(bench_buf, enc.buf, got_len) != 0) {
+			mismatches += 1;
+		}
+	}
+	if (mismatches != 0) {
+		fprintf(stdout, "template: %zu mismatches\n", mismatches);
+		return mismatches;
+	}
+	id = 0;
+	start = bench_now_ns();
+	do {
+		for (int i = 0; i < 1000; ++i, ++id) {
+			template_render(&request, id, bench_buf);
+		}
+		elapsed = bench_now_ns() - start;
+	} while (elapsed < BENCH_MIN_NS);
+	fprintf(stdout, "template: %.0f ns per request, "
+		"%zu of 100000 fall back to the encoder\n",
+		(double)elapsed / id, fallbacks);
+	return 0;
+}
+
+// Each typed encoder against mjson_printf with the same params built as text
+#define NEW_METHOD(name, result_type, schema)                          \
+	{                                                              \
+		struct method_##name req = {.id = id};                 \
+		char params[256] = "";                                 \
+		size_t params_len = 0;                                 \
+		size_t (*encode)(struct encoder *,                     \
+			const struct method_##name *) =                \
+			method_encode_##name;                          \
+		const char *method = #name;
+#define PARAM(key)                                                     \
+	req.key = -(int)params_len - 1;                                \
+	params_len += snprintf(params + params_len,                    \
+		sizeof(params) - params_len, "%s\"" #key "\":%d",      \
+		params_len ? "," : "{", req.key);
+#define END_METHOD()                                                   \
+	size_t got_len = encode(&got, &req);                           \
+	encoder_begin(&want);                                          \
+	if (params_len == 0) {                                         \
+		mjson_printf(encoder_print, &want, "{%Q:%d,%Q:%Q}",    \
+			"id", id, "method", method);                   \
+	} else {                                                       \
+		strcat(params, "}");                                   \
+		mjson_printf(encoder_print, &want,                     \
+			"{%Q:%d,%Q:%Q,%Q:%s}", "id", id, "method",     \
+			method, "params", params);                     \
+	}                                                              \
+	size_t want_len = encoder_finish(&want);                       \
+	mismatches += (got_len != want_len ||                          \
+		memcmp(got.buf, want.buf, got_len) != 0);              \
+	}
+
+static size_t check_methods(int id) {
+	static struct encoder got;
+	static struct encoder want;
+	size_t mismatches = 0;
+#include "methods.inc"
+	return mismatches;
+}
+
+#undef NEW_METHOD
+#undef PARAM
+#undef END_METHOD
+
+static size_t bench_methods(void) {
+	size_t mismatches = 0;
+	for (int id = -1000; id < 100000; ++id) {
+		mismatches += check_methods(id);
+	}
+	if (mismatches != 0) {
+		fprintf(stdout, "methods: %zu mismatches\n", mismatches);
+		return mismatches;
+	}
+	static struct encoder enc;
+	int id = 0;
+	int64_t start = bench_now_ns();
+	int64_t elapsed;
+	do {
+		for (int i = 0; i < 1000; ++i, ++id) {
+			encoder_begin(&enc);
+			mjson_printf(encoder_print, &enc,
+				"{%Q:%d,%Q:%Q,%Q:{%Q:%d,%Q:%d,%Q:%d}}", "id",
+				id, "method", "feed_filament", "params",
+				"index", 1, "length", 200, "speed", 25);
+			encoder_finish(&enc);
+		}
+		elapsed = bench_now_ns() - start;
+	} while (elapsed < BENCH_MIN_NS);
+	fprintf(stdout, "encoder: %.0f ns per feed_filament request\n",
+		(double)elapsed / id);
+	struct method_feed_filament req = {0, 1, 200, 25};
+	start = bench_now_ns();
+	do {
+		for (int i = 0; i < 1000; ++i, ++req.id) {
+			method_encode_feed_filament(&enc, &req);
+		}
+		elapsed = bench_now_ns() - start;
+	} while (elapsed < BENCH_MIN_NS);
+	fprintf(stdout, "methods: %.0f ns per feed_filament request\n",
+		(double)elapsed / req.id);
+	return 0;
+}
+
+// Logs the status replies as if they came a second apart, then reads the
+// value in effect at each one back out of the mapped log. Returns the number
+// of mismatches, counting a log that can't be made as one.
+static size_t bench_telemetry(struct payloads *payloads) {
+	static struct telemetryWriter w;
+	static struct statusState state;
+	struct schemaReply reply;
+	char path[] = "/tmp/benchXXXXXX";
+	int fd = mkstemp(path);
+	if (fd == -1) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	if (!telemetry_open(&w, path)) {
+		fprintf(stdout, "telemetry: unable to open %s\n", path);
+		unlink(path);
+		return 1;
+	}
+	size_t statuses = 0;
+	size_t json_bytes = 0;
+	int64_t elapsed = 0;
+	for (size_t i = 0; i < payloads->count; ++i) {
+		struct payload *pl = &payloads->list[i];
+		if (!schema_parse_status(pl->buf, pl->len, &state, &reply) ||
+			state.slot_count == 0) {
+			continue;
+		}
+		int64_t start = bench_now_ns();
+		telemetry_append(&w, statuses * 1000000LL, &state);
+		elapsed += bench_now_ns() - start;
+		statuses += 1;
+		json_bytes += pl->len;
+	}
+	telemetry_close(&w);
+	struct telemetryReader r;
+	if (!telemetry_map(&r, path)) {
+		fprintf(stdout, "telemetry: unable to map %s\n", path);
+		unlink(path);
+		return 1;
+	}
+	unlink(path);
+	size_t mismatches = 0;
+	statuses = 0;
+	for (size_t i = 0; i < payloads->count; ++i) {
+		struct payload *pl = &payloads->list[i];
+		if (!schema_parse_status(pl->buf, pl->len, &state, &reply) ||
+			state.slot_count == 0) {
+			continue;
+		}
+		struct telemetryRow row;
+		size_t n = telemetry_find(&r, statuses * 1000000LL + 1);
+		statuses += 1;
+		if (n == 0) {
+			mismatches += 1;
+			continue;
+		}
+		telemetry_row(&r, n - 1, &row);
+		mismatches += (row.temp != state.temp ||
+			row.dryer_remain != state.dryer.remain_time ||
+			row.fan_speed != state.fan_speed ||
+			strcmp(telemetry_word(row.status), state.status) ||
+			strcmp(telemetry_word(row.action), state.action) ||
+			row.slot_rfid[3] != state.slots[3].rfid);
+	}
+	if (mismatches != 0) {
+		fprintf(stdout, "telemetry: %zu mismatches\n", mismatches);
+		telemetry_unmap(&r);
+		return mismatches;
+	}
+	size_t finds = 0;
+	int64_t find_start = bench_now_ns();
+	int64_t find_elapsed;
+	do {
+		for (size_t i = 0; i < statuses; ++i, ++finds) {
+			telemetry_find(&r, i * 1000000LL);
+		}
+		find_elapsed = bench_now_ns() - find_start;
+	} while (find_elapsed < BENCH_MIN_NS);
+	fprintf(stdout,
+		"telemetry: %zu statuses, %zu bytes of JSON in %zu rows "
+		"and %zu bytes\n",
+		statuses, json_bytes, r.row_count, r.map_len);
+	fprintf(stdout,
+		"telemetry: %.0f ns per append, %.0f ns per time lookup\n",
+		(double)elapsed / statuses, (double)find_elapsed / finds);
+	telemetry_unmap(&r);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s STRACE_FILE...\n", argv[0]);
+		return 1;
+	}
+	methods_init();
+	struct payloads payloads = {0};
+	for (int i = 1; i < argc; ++i) {
+		read_strace(argv[i], &payloads);
+	}
+	if (payloads.count == 0) {
+		fprintf(stderr, "No frames found\n");
+		return 1;
+	}
+	fprintf(stdout, "-- JSON INDEX BENCHMARKS --\n");
+	fprintf(stdout, "%zu payloads, %zu bytes\n", payloads.count,
+		payloads.bytes);
+	fprintf(stdout, "Selected engine: %s\n", jsonindex_select());
+	const struct jsonindexEngine *engines;
+	size_t engine_count = jsonindex_engines(&engines);
+	int status = 0;
+	bench_mjson(&payloads);
+	for (size_t i = 0; i < engine_count; ++i) {
+		if (!engines[i].supported()) {
+			fprintf(stdout, "jsonindex %s: unsupported\n",
+				engines[i].name);
+			continue;
+		}
+		size_t mismatches = check_engine(&payloads, &engines[i]);
+		if (mismatches != 0) {
+			fprintf(stdout, "jsonindex %s: %zu mismatches\n",
+				engines[i].name, mismatches);
+			status = 1;
+			continue;
+		}
+		bench_engine(&payloads, &engines[i]);
+	}
+	status |= (bench_query(&payloads) != 0);
+	status |= (bench_status(&payloads) != 0);
+	status |= (bench_status_cache(&payloads) != 0);
+	status |= (bench_pool(&payloads) != 0);
+	fprintf(stdout, "-- REQUEST BENCHMARKS --\n");
+	status |= (bench_requests() != 0);
+	status |= (bench_methods() != 0);
+	fprintf(stdout, "-- TELEMETRY BENCHMARKS --\n");
+	status |= (bench_telemetry(&payloads) != 0);
+	for (size_t i = 0; i < payloads.count; ++i) {
+		free(payloads.list[i].buf);
+	}
+	free(payloads.list);
+	return status;
+}
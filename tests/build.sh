@@ -3,4 +3,8 @@ if test ! -e main.c; then
 	echo "Run this script from the tests directory"
 	exit 1
 fi
-gcc -g -Wall -Werror -Wextra -pedantic -std=c11 main.c mjson.c -o main
+gcc -g -Wall -Werror -Wextra -pedantic -std=c11 main.c crc.c decoder.c encoder.c idtable.c jsonindex.c methods.c pipeline.c pool.c poller.c query.c schema.c session.c status.c template.c transport.c mjson.c -o main
+gcc -g -O2 -Wall -Werror -Wextra -pedantic -std=c11 bench.c crc.c decoder.c encoder.c idtable.c jsonindex.c methods.c pipeline.c pool.c query.c schema.c status.c strace.c telemetry.c template.c transport.c mjson.c -o bench
+gcc -g -O2 -Wall -Werror -Wextra -pedantic -std=c11 ingest.c crc.c decoder.c framestore.c jsonindex.c query.c strace.c mjson.c -o ingest
+gcc -g -O2 -Wall -Werror -Wextra -pedantic -std=c11 -pthread survey.c crc.c decoder.c framescan.c framestore.c jsonindex.c query.c mjson.c -o survey
+gcc -g -O2 -Wall -Werror -Wextra -pedantic -std=c11 proxy.c crc.c decoder.c framestore.c jsonindex.c query.c mjson.c -o proxy
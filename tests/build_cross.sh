@@ -10,5 +10,13 @@ if test ! -e armv7l-linux-musleabihf-cross; then
 fi
 CC=armv7l-linux-musleabihf-cross/bin/armv7l-linux-musleabihf-gcc
 STRIP=armv7l-linux-musleabihf-cross/bin/armv7l-linux-musleabihf-strip
-$CC -g -Wall -Werror -Wextra -pedantic -std=c11 -static main.c mjson.c -o main_armv7
+$CC -g -mfpu=neon -Wall -Werror -Wextra -pedantic -std=c11 -static main.c crc.c decoder.c encoder.c idtable.c jsonindex.c methods.c pipeline.c pool.c poller.c query.c schema.c session.c status.c template.c transport.c mjson.c -o main_armv7
 $STRIP main_armv7
+$CC -g -O2 -mfpu=neon -Wall -Werror -Wextra -pedantic -std=c11 -static bench.c crc.c decoder.c encoder.c idtable.c jsonindex.c methods.c pipeline.c pool.c query.c schema.c status.c strace.c telemetry.c template.c transport.c mjson.c -o bench_armv7
+$STRIP bench_armv7
+$CC -g -O2 -mfpu=neon -Wall -Werror -Wextra -pedantic -std=c11 -static ingest.c crc.c decoder.c framestore.c jsonindex.c query.c strace.c mjson.c -o ingest_armv7
+$STRIP ingest_armv7
+$CC -g -O2 -mfpu=neon -Wall -Werror -Wextra -pedantic -std=c11 -static -pthread survey.c crc.c decoder.c framescan.c framestore.c jsonindex.c query.c mjson.c -o survey_armv7
+$STRIP survey_armv7
+$CC -g -O2 -mfpu=neon -Wall -Werror -Wextra -pedantic -std=c11 -static proxy.c crc.c decoder.c framestore.c jsonindex.c query.c mjson.c -o proxy_armv7
+$STRIP proxy_armv7
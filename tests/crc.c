@@ -0,0 +1,352 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <string.h>
+#include <time.h>
+
+#include "crc.h"
+
+#define CRC_POLY_REFLECTED 0x8408
+#define CRC_POLY_NORMAL 0x11021
+#define CRC_SLICES 8
+
+// Table k holds the effect of a byte followed by k zero bytes
+static uint16_t crc_table[CRC_SLICES][256];
+static int crc_tables_ready = 0;
+
+static void crc_build_tables(void) {
+	if (crc_tables_ready) {
+		return;
+	}
+	for (int byte = 0; byte < 256; ++byte) {
+		unsigned char data = byte;
+		crc_table[0][byte] = crc_update_bitwise(0, &data, 1);
+	}
+	for (int slice = 1; slice < CRC_SLICES; ++slice) {
+		for (int byte = 0; byte < 256; ++byte) {
+			uint16_t prev = crc_table[slice - 1][byte];
+			uint16_t next = crc_table[0][prev & 0xFF];
+			crc_table[slice][byte] = (prev >> 8) ^ next;
+		}
+	}
+	crc_tables_ready = 1;
+}
+
+uint16_t crc_update_bitwise(
+	uint16_t crc, const unsigned char *data_buf, size_t data_len) {
+	for (size_t i = 0; i < data_len; ++i) {
+		unsigned char byte = data_buf[i];
+		crc ^= byte;
+		for (int j = 0; j < 8; ++j) {
+			if (crc & 1) {
+				crc = (crc >> 1) ^ CRC_POLY_REFLECTED;
+			} else {
+				crc = (crc >> 1);
+			}
+		}
+	}
+	return crc;
+}
+
+static uint16_t crc_update_table(
+	uint16_t crc, const unsigned char *data_buf, size_t data_len) {
+	const uint16_t *table = crc_table[0];
+	for (size_t i = 0; i < data_len; ++i) {
+		crc = (crc >> 8) ^ table[(crc ^ data_buf[i]) & 0xFF];
+	}
+	return crc;
+}
+
+static uint16_t crc_update_slice4(
+	uint16_t crc, const unsigned char *data_buf, size_t data_len) {
+	const unsigned char *p = data_buf;
+	while (data_len >= 4) {
+		unsigned int x = crc ^ (p[0] | (p[1] << 8));
+		crc = crc_table[3][x & 0xFF] ^ crc_table[2][x >> 8] ^
+			crc_table[1][p[2]] ^ crc_table[0][p[3]];
+		p += 4;
+		data_len -= 4;
+	}
+	return crc_update_table(crc, p, data_len);
+}
+
+static uint16_t crc_update_slice8(
+	uint16_t crc, const unsigned char *data_buf, size_t data_len) {
+	const unsigned char *p = data_buf;
+	while (data_len >= 8) {
+		unsigned int x = crc ^ (p[0] | (p[1] << 8));
+		crc = crc_table[7][x & 0xFF] ^ crc_table[6][x >> 8] ^
+			crc_table[5][p[2]] ^ crc_table[4][p[3]] ^
+			crc_table[3][p[4]] ^ crc_table[2][p[5]] ^
+			crc_table[1][p[6]] ^ crc_table[0][p[7]];
+		p += 8;
+		data_len -= 8;
+	}
+	return crc_update_table(crc, p, data_len);
+}
+
+static int crc_always_supported(void) {
+	return 1;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <wmmintrin.h>
+
+// The carry-less multiply engine works on polynomials in the same reflected
+// bit order as the data, so multiplying two 64-bit values gives a 127-bit
+// product that's one bit short of lining up with a 128-bit register. The
+// folding constants are x^(n - 1) mod P to make up for that.
+static uint64_t crc_clmul_k1; // x^191 mod P, folds the low half
+static uint64_t crc_clmul_k2; // x^127 mod P, folds the high half
+static uint64_t crc_clmul_mu; // floor(x^80 / P) without the x^64 term
+
+static uint64_t crc_reflect64(uint64_t value) {
+	uint64_t out = 0;
+	for (int i = 0; i < 64; ++i) {
+		out = (out << 1) | ((value >> i) & 1);
+	}
+	return out;
+}
+
+static uint64_t crc_xpow_mod(int power) {
+	uint32_t rem = 1;
+	for (int i = 0; i < power; ++i) {
+		rem <<= 1;
+		if (rem & 0x10000) {
+			rem ^= CRC_POLY_NORMAL;
+		}
+	}
+	return rem;
+}
+
+static uint64_t crc_x80_div(void) {
+	// Long division of x^80, the quotient's x^64 term falls off the end
+	uint32_t rem = 0;
+	uint64_t quotient = 0;
+	for (int i = 80; i >= 0; --i) {
+		rem = (rem << 1) | (i == 80);
+		quotient <<= 1;
+		if (rem & 0x10000) {
+			rem ^= CRC_POLY_NORMAL;
+			quotient |= 1;
+		}
+	}
+	return quotient;
+}
+
+static int crc_clmul_supported(void) {
+	if (!__builtin_cpu_supports("pclmul")) {
+		return 0;
+	}
+	crc_clmul_k1 = crc_reflect64(crc_xpow_mod(191));
+	crc_clmul_k2 = crc_reflect64(crc_xpow_mod(127));
+	crc_clmul_mu = crc_reflect64(crc_x80_div());
+	return 1;
+}
+
+// Barrett reduction of 8 bytes of data with the CRC folded in
+__attribute__((target("pclmul"))) static uint16_t crc_clmul_reduce(
+	uint16_t crc, uint64_t data) {
+	data ^= crc;
+	__m128i d = _mm_cvtsi64_si128((long long)data);
+	__m128i mu = _mm_cvtsi64_si128((long long)crc_clmul_mu);
+	__m128i prod = _mm_clmulepi64_si128(d, mu, 0x00);
+	uint64_t quotient = (uint64_t)_mm_cvtsi128_si64(prod);
+	quotient = ((quotient >> 47) ^ (data >> 48)) & 0xFFFF;
+	__m128i q = _mm_cvtsi64_si128((long long)quotient);
+	__m128i poly = _mm_cvtsi64_si128(CRC_POLY_REFLECTED);
+	prod = _mm_clmulepi64_si128(q, poly, 0x00);
+	uint64_t rem = (uint64_t)_mm_cvtsi128_si64(prod);
+	return (rem >> 15) & 0xFFFF;
+}
+
+__attribute__((target("pclmul"))) static uint16_t crc_update_clmul(
+	uint16_t crc, const unsigned char *data_buf, size_t data_len) {
+	const unsigned char *p = data_buf;
+	if (data_len >= 32) {
+		__m128i x = _mm_loadu_si128((const __m128i *)p);
+		x = _mm_xor_si128(x, _mm_cvtsi32_si128(crc));
+		__m128i k = _mm_set_epi64x(
+			(long long)crc_clmul_k2, (long long)crc_clmul_k1);
+		p += 16;
+		data_len -= 16;
+		while (data_len >= 16) {
+			__m128i next = _mm_loadu_si128((const __m128i *)p);
+			__m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+			__m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+			x = _mm_xor_si128(_mm_xor_si128(lo, hi), next);
+			p += 16;
+			data_len -= 16;
+		}
+		uint64_t x_lo = (uint64_t)_mm_cvtsi128_si64(x);
+		uint64_t x_hi =
+			(uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(x, x));
+		crc = crc_clmul_reduce(0, x_lo);
+		crc = crc_clmul_reduce(crc, x_hi);
+	}
+	while (data_len >= 8) {
+		uint64_t data;
+		memcpy(&data, p, sizeof(data));
+		crc = crc_clmul_reduce(crc, data);
+		p += 8;
+		data_len -= 8;
+	}
+	return crc_update_table(crc, p, data_len);
+}
+#endif
+
+static const struct crcEngine crc_engine_list[] = {
+	{"bitwise", crc_update_bitwise, crc_always_supported},
+	{"table", crc_update_table, crc_always_supported},
+	{"slice4", crc_update_slice4, crc_always_supported},
+	{"slice8", crc_update_slice8, crc_always_supported},
+#if defined(__x86_64__) && defined(__GNUC__)
+	{"clmul", crc_update_clmul, crc_clmul_supported},
+#endif
+};
+
+#define CRC_ENGINE_COUNT (sizeof(crc_engine_list) / sizeof(*crc_engine_list))
+
+static const struct crcEngine *crc_selected = NULL;
+
+size_t crc_engines(const struct crcEngine **engines) {
+	crc_build_tables();
+	*engines = crc_engine_list;
+	return CRC_ENGINE_COUNT;
+}
+
+static void crc_fill_random(unsigned char *buf, size_t len) {
+	uint32_t state = 0x12345678;
+	for (size_t i = 0; i < len; ++i) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		buf[i] = state & 0xFF;
+	}
+}
+
+static const size_t crc_check_lengths[] = {
+	100,
+	255,
+	256,
+	531, // get_status response
+	1017, // Largest safe payload
+};
+
+int crc_check_engine(const struct crcEngine *engine) {
+	crc_build_tables();
+	if (!engine->supported()) {
+		return 0;
+	}
+
+	// Standard check value for CRC-16/MCRF4XX
+	const unsigned char check[] = "123456789";
+	if (engine->update(CRC_INIT, check, 9) != 0x6F91) {
+		return 0;
+	}
+
+	// Compare against the reference at every alignment, both in one go
+	// and split in two to check the incremental path
+	static unsigned char buf[1024 + 8];
+	crc_fill_random(buf, sizeof(buf));
+	for (size_t offset = 0; offset < 8; ++offset) {
+		for (size_t len = 0; len < 80; ++len) {
+			const unsigned char *data = buf + offset;
+			uint16_t want = crc_update_bitwise(CRC_INIT, data, len);
+			uint16_t got = engine->update(CRC_INIT, data, len);
+			size_t half = len / 2;
+			uint16_t split = engine->update(CRC_INIT, data, half);
+			split = engine->update(split, data + half, len - half);
+			if (want != got || want != split) {
+				return 0;
+			}
+		}
+		size_t lengths = sizeof(crc_check_lengths) / sizeof(size_t);
+		for (size_t i = 0; i < lengths; ++i) {
+			size_t len = crc_check_lengths[i];
+			const unsigned char *data = buf + offset;
+			uint16_t want = crc_update_bitwise(0x1234, data, len);
+			uint16_t got = engine->update(0x1234, data, len);
+			if (want != got) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+static long crc_time_engine(const struct crcEngine *engine) {
+	static unsigned char buf[531];
+	crc_fill_random(buf, sizeof(buf));
+	long best = -1;
+	volatile uint16_t sink = 0;
+	for (int round = 0; round < 16; ++round) {
+		struct timespec start;
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int i = 0; i < 16; ++i) {
+			sink = engine->update(sink, buf, sizeof(buf));
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		long ns = (end.tv_sec - start.tv_sec) * 1000000000L +
+			(end.tv_nsec - start.tv_nsec);
+		if (best == -1 || ns < best) {
+			best = ns;
+		}
+	}
+	return best;
+}
+
+const char *crc_select(void) {
+	if (crc_selected != NULL) {
+		return crc_selected->name;
+	}
+	crc_build_tables();
+	const struct crcEngine *fastest = &crc_engine_list[0];
+	long fastest_ns = -1;
+	for (size_t i = 0; i < CRC_ENGINE_COUNT; ++i) {
+		const struct crcEngine *engine = &crc_engine_list[i];
+		if (!crc_check_engine(engine)) {
+			continue;
+		}
+		long ns = crc_time_engine(engine);
+		if (fastest_ns == -1 || ns < fastest_ns) {
+			fastest = engine;
+			fastest_ns = ns;
+		}
+	}
+	crc_selected = fastest;
+	return crc_selected->name;
+}
+
+uint16_t crc_update(
+	uint16_t crc, const unsigned char *data_buf, size_t data_len) {
+	if (crc_selected == NULL) {
+		crc_select();
+	}
+	return crc_selected->update(crc, data_buf, data_len);
+}
+
+uint16_t crc_calc(const unsigned char *data_buf, size_t data_len) {
+	return crc_finish(crc_update(crc_init(), data_buf, data_len));
+}
+
+void crc_shift_init(struct crcShift *shift, size_t len) {
+	static const unsigned char zeros[256];
+	for (int nibble = 0; nibble < 4; ++nibble) {
+		for (int value = 0; value < 16; ++value) {
+			uint16_t state = value << (nibble * 4);
+			size_t left = len;
+			while (left > 0) {
+				size_t chunk = (left < sizeof(zeros))
+						       ? left
+						       : sizeof(zeros);
+				state = crc_update(state, zeros, chunk);
+				left -= chunk;
+			}
+			shift->nibbles[nibble][value] = state;
+		}
+	}
+}
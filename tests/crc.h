@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#ifndef CRC_H
+#define CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-16/MCRF4XX: Reflected polynomial 0x8408, initial value 0xFFFF and no
+// final XOR. Data can be fed in pieces as it arrives:
+//
+//   uint16_t crc = crc_init();
+//   crc = crc_update(crc, first_buf, first_len);
+//   crc = crc_update(crc, second_buf, second_len);
+//   uint16_t checksum = crc_finish(crc);
+
+#define CRC_INIT 0xFFFF
+
+typedef uint16_t (*crc_update_fn)(
+	uint16_t crc, const unsigned char *data_buf, size_t data_len);
+
+struct crcEngine {
+	const char *name;
+	crc_update_fn update;
+	int (*supported)(void);
+};
+
+static inline uint16_t crc_init(void) {
+	return CRC_INIT;
+}
+
+static inline uint16_t crc_finish(uint16_t crc) {
+	return crc;
+}
+
+// Feeds data in to the selected engine, selecting one if needed
+uint16_t crc_update(uint16_t crc, const unsigned char *data_buf,
+	size_t data_len);
+
+// Calculates the CRC of a whole buffer
+uint16_t crc_calc(const unsigned char *data_buf, size_t data_len);
+
+// Bit by bit reference implementation, slow but obviously correct
+uint16_t crc_update_bitwise(
+	uint16_t crc, const unsigned char *data_buf, size_t data_len);
+
+// Checks every engine the CPU supports against the bitwise reference and
+// picks the fastest. Returns the name of the selected engine. This is called
+// automatically on first use but can be called early to keep the cost out of
+// timing-sensitive code.
+const char *crc_select(void);
+
+// Skips the CRC over constant data. The CRC is linear, so feeding len bytes
+// to any state gives the same as shifting the state by len zero bytes then
+// XORing in the data's CRC from zero. A shift is kept as four tables indexed
+// by a nibble of the state each.
+struct crcShift {
+	uint16_t nibbles[4][16];
+};
+
+void crc_shift_init(struct crcShift *shift, size_t len);
+
+static inline uint16_t crc_shift(const struct crcShift *shift, uint16_t crc) {
+	return shift->nibbles[0][crc & 0xF] ^
+	       shift->nibbles[1][(crc >> 4) & 0xF] ^
+	       shift->nibbles[2][(crc >> 8) & 0xF] ^
+	       shift->nibbles[3][crc >> 12];
+}
+
+// Lists the available engines, returns the number of them
+size_t crc_engines(const struct crcEngine **engines);
+
+// Checks an engine against the bitwise reference, returns 1 if it matches
+int crc_check_engine(const struct crcEngine *engine);
+
+#endif
@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#define _DEFAULT_SOURCE
+
+#include <string.h>
+#include <unistd.h>
+
+#include "crc.h"
+#include "decoder.h"
+
+void decoder_init(struct decoder *dec) {
+	memset(&dec->stats, 0, sizeof(dec->stats));
+	decoder_reset(dec);
+}
+
+void decoder_reset(struct decoder *dec) {
+	dec->parse_pos = 0;
+	dec->write_pos = 0;
+	dec->frame_pos = 0;
+	dec->state = DECODER_NONE;
+	dec->field_len = 0;
+	dec->payload_len = 0;
+	dec->payload_left = 0;
+}
+
+static bool decoder_keeps_payload(struct decoder *dec) {
+	bool has_payload = (dec->state == DECODER_PAYLOAD ||
+		dec->state == DECODER_CRC || dec->state == DECODER_TRAILER);
+	bool oversized = (dec->payload_len > DECODER_MAX_PAYLOAD);
+	return has_payload && !oversized;
+}
+
+static void decoder_compact(struct decoder *dec) {
+	size_t keep_pos = dec->parse_pos;
+	if (decoder_keeps_payload(dec)) {
+		keep_pos = dec->frame_pos;
+	}
+	if (keep_pos == 0) {
+		return;
+	}
+	size_t keep_len = dec->write_pos - keep_pos;
+	memmove(dec->buf, dec->buf + keep_pos, keep_len);
+	dec->parse_pos -= keep_pos;
+	dec->write_pos -= keep_pos;
+	if (decoder_keeps_payload(dec)) {
+		dec->frame_pos -= keep_pos;
+	}
+}
+
+unsigned char *decoder_space(struct decoder *dec, size_t *space_len) {
+	// Nothing buffered is free to move, otherwise only move if needed
+	bool empty = (dec->parse_pos == dec->write_pos);
+	if (empty && !decoder_keeps_payload(dec)) {
+		dec->parse_pos = 0;
+		dec->write_pos = 0;
+	} else if (sizeof(dec->buf) - dec->write_pos < DECODER_MIN_SPACE) {
+		decoder_compact(dec);
+	}
+	*space_len = sizeof(dec->buf) - dec->write_pos;
+	return dec->buf + dec->write_pos;
+}
+
+void decoder_commit(struct decoder *dec, size_t len) {
+	dec->write_pos += len;
+}
+
+size_t decoder_feed(struct decoder *dec, const unsigned char *buf, size_t len) {
+	size_t space_len;
+	unsigned char *space = decoder_space(dec, &space_len);
+	size_t copy_len = (len < space_len) ? len : space_len;
+	memcpy(space, buf, copy_len);
+	decoder_commit(dec, copy_len);
+	return copy_len;
+}
+
+ssize_t decoder_read(struct decoder *dec, int fd) {
+	size_t space_len;
+	unsigned char *space = decoder_space(dec, &space_len);
+	ssize_t count = read(fd, space, space_len);
+	if (count > 0) {
+		decoder_commit(dec, count);
+	}
+	dec->stats.reads += 1;
+	return count;
+}
+
+static void decoder_start_payload(struct decoder *dec) {
+	dec->payload_len = dec->field[0] | (dec->field[1] << 8);
+	dec->payload_left = dec->payload_len;
+	dec->payload_crc = crc_init();
+	dec->frame_pos = dec->parse_pos;
+	dec->field_len = 0;
+	if (dec->payload_len == 0) {
+		dec->state = DECODER_CRC;
+	} else {
+		dec->state = DECODER_PAYLOAD;
+	}
+}
+
+static enum decoderResult decoder_finish_frame(
+	struct decoder *dec, struct decoderFrame *frame) {
+	dec->state = DECODER_NONE;
+	if (dec->payload_len > DECODER_MAX_PAYLOAD) {
+		frame->payload = NULL;
+		frame->payload_len = dec->payload_len;
+		frame->crc = dec->frame_crc;
+		dec->stats.oversized += 1;
+		return DECODER_OVERSIZED;
+	}
+	frame->payload = dec->buf + dec->frame_pos;
+	frame->payload_len = dec->payload_len;
+	frame->crc = dec->frame_crc;
+	// The CRC has been read already, so its first byte can hold the NUL
+	frame->payload[frame->payload_len] = 0;
+	if (crc_finish(dec->payload_crc) != dec->frame_crc) {
+		dec->stats.bad_crcs += 1;
+		return DECODER_BAD_CRC;
+	}
+	dec->stats.frames += 1;
+	return DECODER_FRAME;
+}
+
+enum decoderResult decoder_next(
+	struct decoder *dec, struct decoderFrame *frame) {
+	while (dec->parse_pos < dec->write_pos) {
+		unsigned char *pos = dec->buf + dec->parse_pos;
+		size_t left = dec->write_pos - dec->parse_pos;
+		switch (dec->state) {
+		case DECODER_NONE: {
+			unsigned char *found = memchr(pos, 0xFF, left);
+			if (found == NULL) {
+				dec->stats.skipped_bytes += left;
+				dec->parse_pos = dec->write_pos;
+				break;
+			}
+			dec->stats.skipped_bytes += found - pos;
+			dec->parse_pos += (found - pos) + 1;
+			dec->state = DECODER_MAYBE_HEADER;
+			break;
+		}
+		case DECODER_MAYBE_HEADER:
+			dec->parse_pos += 1;
+			if (*pos == 0xAA) {
+				dec->state = DECODER_LENGTH;
+				dec->field_len = 0;
+			} else {
+				dec->stats.skipped_bytes += 2;
+				dec->state = DECODER_NONE;
+			}
+			break;
+		case DECODER_LENGTH:
+			dec->parse_pos += 1;
+			dec->field[dec->field_len++] = *pos;
+			if (dec->field_len == 2) {
+				decoder_start_payload(dec);
+			}
+			break;
+		case DECODER_PAYLOAD: {
+			size_t take = left;
+			if (take > dec->payload_left) {
+				take = dec->payload_left;
+			}
+			if (dec->payload_len <= DECODER_MAX_PAYLOAD) {
+				dec->payload_crc =
+					crc_update(dec->payload_crc, pos, take);
+			}
+			dec->parse_pos += take;
+			dec->payload_left -= take;
+			if (dec->payload_left == 0) {
+				dec->state = DECODER_CRC;
+				dec->field_len = 0;
+			}
+			break;
+		}
+		case DECODER_CRC:
+			dec->parse_pos += 1;
+			dec->field[dec->field_len++] = *pos;
+			if (dec->field_len == 2) {
+				dec->frame_crc =
+					dec->field[0] | (dec->field[1] << 8);
+				dec->state = DECODER_TRAILER;
+			}
+			break;
+		case DECODER_TRAILER: {
+			unsigned char *found = memchr(pos, 0xFE, left);
+			if (found == NULL) {
+				// Drop ignored bytes so they do not pile up
+				dec->stats.skipped_bytes += left;
+				dec->write_pos = dec->parse_pos;
+				break;
+			}
+			dec->stats.skipped_bytes += found - pos;
+			dec->parse_pos += (found - pos) + 1;
+			return decoder_finish_frame(dec, frame);
+		}
+		}
+	}
+	return DECODER_MORE;
+}
@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Streaming frame decoder, follows the same rules as the emulator's parser:
+//
+// - Bytes before 0xFF are ignored
+// - 0xFF must be directly followed by 0xAA, otherwise the header is dropped
+//   and the next 0xFF starts a new search
+// - The length is read and that many payload bytes are taken as-is, so
+//   0xFF 0xAA in a payload doesn't restart the frame
+// - The two CRC bytes are read, then any bytes up to 0xFE are ignored
+//
+// Data is read straight in to the decoder's buffer and payloads are handed
+// back as views in to it, so nothing is copied. Bytes are kept in a line
+// rather than wrapping around so a payload is always contiguous; when the
+// free space at the end runs low the frame in progress is moved back to the
+// start of the buffer.
+
+#define DECODER_BUFFER_SIZE 4096
+#define DECODER_MAX_PAYLOAD 2048
+#define DECODER_MIN_SPACE 1024
+
+enum decoderState {
+	DECODER_NONE,
+	DECODER_MAYBE_HEADER,
+	DECODER_LENGTH,
+	DECODER_PAYLOAD,
+	DECODER_CRC,
+	DECODER_TRAILER,
+};
+
+enum decoderResult {
+	DECODER_MORE, // Need more data
+	DECODER_FRAME, // Valid frame
+	DECODER_BAD_CRC, // Complete frame with the wrong CRC
+	DECODER_OVERSIZED, // Complete frame too big to buffer, payload dropped
+};
+
+struct decoderFrame {
+	// Points in to the decoder's buffer, valid until the decoder is given
+	// more data. The payload is NUL terminated in place of the CRC.
+	unsigned char *payload;
+	size_t payload_len;
+	uint16_t crc;
+};
+
+struct decoderStats {
+	unsigned long frames;
+	unsigned long bad_crcs;
+	unsigned long oversized;
+	unsigned long skipped_bytes;
+	unsigned long reads;
+};
+
+struct decoder {
+	unsigned char buf[DECODER_BUFFER_SIZE];
+	size_t parse_pos;
+	size_t write_pos;
+	size_t frame_pos;
+	enum decoderState state;
+	unsigned char field[2];
+	size_t field_len;
+	size_t payload_len;
+	size_t payload_left;
+	uint16_t payload_crc;
+	uint16_t frame_crc;
+	struct decoderStats stats;
+};
+
+void decoder_init(struct decoder *dec);
+
+// Drops buffered data and any frame in progress, keeps the stats
+void decoder_reset(struct decoder *dec);
+
+// Returns contiguous free space to read in to, then commit what was read
+unsigned char *decoder_space(struct decoder *dec, size_t *space_len);
+void decoder_commit(struct decoder *dec, size_t len);
+
+// Copies data in, returns how much fit. Parse frames out and feed again if
+// not everything was taken.
+size_t decoder_feed(struct decoder *dec, const unsigned char *buf, size_t len);
+
+// Does a single read in to the decoder, returns the result of read(2)
+ssize_t decoder_read(struct decoder *dec, int fd);
+
+// Parses the next frame out of buffered data
+enum decoderResult decoder_next(
+	struct decoder *dec, struct decoderFrame *frame);
+
+#endif
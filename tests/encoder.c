@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#define _DEFAULT_SOURCE
+
+#include <string.h>
+
+#include "crc.h"
+#include "encoder.h"
+
+// Whitespace to try before the last byte of a colliding payload, in order
+static const char *const encoder_padding[ENCODER_MAX_REWRITES] = {
+	" ", "\t", "\n", "\r",
+	"  ", " \t", " \n", " \r",
+	"\t ", "\t\t", "\t\n", "\t\r",
+	"\n ", "\n\t", "\n\n", "\n\r",
+	"\r ", "\r\t", "\r\n", "\r\r",
+};
+
+void encoder_init(struct encoder *enc) {
+	memset(&enc->stats, 0, sizeof(enc->stats));
+	encoder_begin(enc);
+}
+
+void encoder_begin(struct encoder *enc) {
+	enc->payload_len = 0;
+	enc->crc_len = 0;
+	enc->crc = crc_init();
+	enc->overflow = false;
+}
+
+static void encoder_catch_up_crc_to(struct encoder *enc, size_t len) {
+	unsigned char *payload = encoder_payload(enc);
+	size_t pending = len - enc->crc_len;
+	enc->crc = crc_update(enc->crc, payload + enc->crc_len, pending);
+	enc->crc_len = len;
+}
+
+bool encoder_append(struct encoder *enc, const void *buf, size_t len) {
+	if (enc->overflow || len > ENCODER_MAX_PAYLOAD - enc->payload_len) {
+		enc->overflow = true;
+		return false;
+	}
+	memcpy(encoder_payload(enc) + enc->payload_len, buf, len);
+	enc->payload_len += len;
+	// The last byte is left out in case it has to be moved for padding
+	if (enc->payload_len - enc->crc_len > ENCODER_CRC_CHUNK) {
+		encoder_catch_up_crc_to(enc, enc->payload_len - 1);
+	}
+	return true;
+}
+
+int encoder_print(const char *buf, int len, void *fn_data) {
+	struct encoder *enc = fn_data;
+	if (!encoder_append(enc, buf, len)) {
+		return 0;
+	}
+	return len;
+}
+
+size_t encoder_int(unsigned char *buf, int value) {
+	// Digits come out backwards so they're written from the end
+	char digits[ENCODER_INT_LEN];
+	char *start = digits + sizeof(digits);
+	unsigned int left = value;
+	if (value < 0) {
+		left = -left;
+	}
+	do {
+		*--start = '0' + left % 10;
+		left /= 10;
+	} while (left != 0);
+	if (value < 0) {
+		*--start = '-';
+	}
+	size_t len = digits + sizeof(digits) - start;
+	memcpy(buf, start, len);
+	return len;
+}
+
+void encoder_header(unsigned char *header, size_t payload_len) {
+	header[0] = 0xFF;
+	header[1] = 0xAA;
+	header[2] = (payload_len & 0xFF);
+	header[3] = ((payload_len >> 8) & 0xFF);
+}
+
+void encoder_trailer(unsigned char *trailer, uint16_t crc) {
+	trailer[0] = (crc & 0xFF);
+	trailer[1] = ((crc >> 8) & 0xFF);
+	trailer[2] = 0xFE;
+}
+
+bool encoder_collides(const unsigned char *frame, size_t frame_len) {
+	const unsigned char *pos = frame + 1;
+	const unsigned char *end = frame + frame_len;
+	while ((pos = memchr(pos, 0xFF, end - pos)) != NULL) {
+		if (pos + 1 < end && pos[1] == 0xAA) {
+			return true;
+		}
+		pos += 1;
+	}
+	return false;
+}
+
+static size_t encoder_write_frame(struct encoder *enc, uint16_t crc) {
+	unsigned char *trailer = encoder_payload(enc) + enc->payload_len;
+	encoder_header(enc->buf, enc->payload_len);
+	encoder_trailer(trailer, crc_finish(crc));
+	return enc->payload_len + ENCODER_OVERHEAD;
+}
+
+// Tries padding before the last byte, only the padding and the last byte go
+// through the CRC again each time
+static size_t encoder_rewrite(struct encoder *enc) {
+	unsigned char *payload = encoder_payload(enc);
+	size_t prefix_len = enc->payload_len - 1;
+	unsigned char last = payload[prefix_len];
+	for (size_t i = 0; i < ENCODER_MAX_REWRITES; ++i) {
+		size_t pad_len = strlen(encoder_padding[i]);
+		if (prefix_len + pad_len + 1 > ENCODER_MAX_PAYLOAD) {
+			break;
+		}
+		enc->stats.rewrite_attempts += 1;
+		memcpy(payload + prefix_len, encoder_padding[i], pad_len);
+		payload[prefix_len + pad_len] = last;
+		enc->payload_len = prefix_len + pad_len + 1;
+		uint16_t crc = crc_update(
+			enc->crc, payload + prefix_len, pad_len + 1);
+		size_t frame_len = encoder_write_frame(enc, crc);
+		if (!encoder_collides(enc->buf, frame_len)) {
+			return frame_len;
+		}
+	}
+	return 0;
+}
+
+size_t encoder_finish(struct encoder *enc) {
+	if (enc->overflow) {
+		return 0;
+	}
+	enc->stats.frames += 1;
+	if (enc->payload_len == 0) {
+		return encoder_write_frame(enc, enc->crc);
+	}
+	// Keep the CRC up to the last byte in case it has to be rewritten
+	const unsigned char *payload = encoder_payload(enc);
+	size_t prefix_len = enc->payload_len - 1;
+	encoder_catch_up_crc_to(enc, prefix_len);
+	uint16_t crc = crc_update(enc->crc, payload + prefix_len, 1);
+	size_t frame_len = encoder_write_frame(enc, crc);
+	if (!encoder_collides(enc->buf, frame_len)) {
+		return frame_len;
+	}
+	// Padding can't help with FF AA in the payload itself
+	if (!encoder_collides(payload - 1, enc->payload_len + 1)) {
+		enc->stats.rewrites += 1;
+		frame_len = encoder_rewrite(enc);
+		if (frame_len != 0) {
+			return frame_len;
+		}
+	}
+	enc->stats.collisions += 1;
+	return 0;
+}
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Frame builder: JSON is printed straight in to a buffer with space left for
+// the header, the CRC is worked out as the payload is printed, and the
+// finished frame is sent with one write. Use it with mjson's printer:
+//
+//   struct encoder enc;
+//   encoder_init(&enc);
+//   encoder_begin(&enc);
+//   mjson_printf(encoder_print, &enc, "{%Q:%d}", "id", 1);
+//   size_t frame_len = encoder_finish(&enc);
+//   write(tty, enc.buf, frame_len);
+//
+// A frame must not have FF AA anywhere but its header: if the real header
+// gets corrupted the ACE may take that for a header and hang reading a bogus
+// length. JSON can't contain 0xFF so in practice only the CRC can collide.
+// When it does, whitespace is slipped in before the payload's last byte until
+// the CRC changes to something safe, trying at most ENCODER_MAX_REWRITES
+// variations.
+
+#define ENCODER_HEADER_LEN 4
+#define ENCODER_TRAILER_LEN 3
+#define ENCODER_OVERHEAD (ENCODER_HEADER_LEN + ENCODER_TRAILER_LEN)
+#define ENCODER_MAX_FRAME 1024
+#define ENCODER_MAX_PAYLOAD (ENCODER_MAX_FRAME - ENCODER_OVERHEAD)
+
+// The CRC catches up every this many bytes so it runs while the payload is
+// still in cache, without costing a call per printed character
+#define ENCODER_CRC_CHUNK 64
+
+#define ENCODER_MAX_REWRITES 20
+
+// Longest an int gets printed, -2147483648
+#define ENCODER_INT_LEN 11
+
+struct encoderStats {
+	unsigned long frames;
+	// Frames that needed rewriting and the variations tried for them
+	unsigned long rewrites;
+	unsigned long rewrite_attempts;
+	// Frames given up on, either out of variations or FF AA in the payload
+	unsigned long collisions;
+};
+
+struct encoder {
+	unsigned char buf[ENCODER_MAX_FRAME];
+	size_t payload_len;
+	size_t crc_len;
+	uint16_t crc;
+	bool overflow;
+	struct encoderStats stats;
+};
+
+// Clears the stats, which carry on across frames
+void encoder_init(struct encoder *enc);
+void encoder_begin(struct encoder *enc);
+
+// mjson_print_fn_t that appends to an encoder
+int encoder_print(const char *buf, int len, void *fn_data);
+
+// Appends bytes as-is
+bool encoder_append(struct encoder *enc, const void *buf, size_t len);
+
+// Writes the header and trailer, rewriting the payload if needed. Returns the
+// frame length or 0 if the payload didn't fit or the frame can't be made
+// free of collisions.
+size_t encoder_finish(struct encoder *enc);
+
+static inline unsigned char *encoder_payload(struct encoder *enc) {
+	return enc->buf + ENCODER_HEADER_LEN;
+}
+
+// Prints an int in decimal at buf, which needs ENCODER_INT_LEN bytes free.
+// Returns how many it took.
+size_t encoder_int(unsigned char *buf, int value);
+
+// True if FF AA shows up in a frame anywhere but the start
+bool encoder_collides(const unsigned char *frame, size_t frame_len);
+
+// Header and trailer for a payload kept elsewhere
+void encoder_header(unsigned char *header, size_t payload_len);
+void encoder_trailer(unsigned char *trailer, uint16_t crc);
+
+#endif
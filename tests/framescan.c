@@ -0,0 +1,263 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "framescan.h"
+
+void framescan_init(struct framescan *scan) {
+	memset(scan, 0, sizeof(*scan));
+	atomic_init(&scan->next_unit, 0);
+}
+
+bool framescan_add(struct framescan *scan, const char *name) {
+	if (scan->store_count == FRAMESCAN_MAX_STORES) {
+		return false;
+	}
+	struct framestoreReader *store = &scan->stores[scan->store_count];
+	if (!framestore_map(store, name)) {
+		return false;
+	}
+	size_t units = (store->count + FRAMESCAN_UNIT_RECORDS - 1) /
+		       FRAMESCAN_UNIT_RECORDS;
+	struct framescanUnit *grown = realloc(scan->units,
+		(scan->unit_count + units) * sizeof(*scan->units));
+	if (grown == NULL && scan->unit_count + units != 0) {
+		framestore_unmap(store);
+		return false;
+	}
+	scan->units = grown;
+	for (size_t i = 0; i < units; ++i) {
+		struct framescanUnit *unit = &scan->units[scan->unit_count++];
+		unit->store = scan->store_count;
+		unit->first = i * FRAMESCAN_UNIT_RECORDS;
+		unit->count = store->count - unit->first;
+		if (unit->count > FRAMESCAN_UNIT_RECORDS) {
+			unit->count = FRAMESCAN_UNIT_RECORDS;
+		}
+	}
+	scan->store_count += 1;
+	return true;
+}
+
+void framescan_free(struct framescan *scan) {
+	for (size_t i = 0; i < scan->store_count; ++i) {
+		framestore_unmap(&scan->stores[i]);
+	}
+	free(scan->units);
+	framescan_init(scan);
+}
+
+bool framescan_match(const struct framescanFilter *filter,
+	const struct framestoreRecord *rec) {
+	uint32_t method = 1u << framescan_slot(rec->method);
+	uint32_t direction = 1u << rec->direction;
+	return (filter->methods == 0 || (filter->methods & method)) &&
+	       (filter->directions == 0 || (filter->directions & direction)) &&
+	       (rec->flags & filter->flags_set) == filter->flags_set &&
+	       (rec->flags & filter->flags_clear) == 0;
+}
+
+void framescan_table_init(struct framescanTable *table) {
+	memset(table, 0, sizeof(*table));
+	table->first_ns = -1;
+	table->last_ns = -1;
+	for (int i = 0; i < FRAMESCAN_METHODS; ++i) {
+		for (int j = 0; j < 2; ++j) {
+			table->cells[i][j].min_size = UINT32_MAX;
+		}
+	}
+	for (int i = 0; i < 2; ++i) {
+		table->ids[i].first = FRAMESTORE_NO_ID;
+		table->ids[i].last = FRAMESTORE_NO_ID;
+	}
+}
+
+static unsigned int framescan_bucket(uint32_t size) {
+	unsigned int bucket = 0;
+	while (bucket < FRAMESCAN_SIZE_BUCKETS - 1 && size >= (32u << bucket)) {
+		bucket += 1;
+	}
+	return bucket;
+}
+
+// Counts the step from one id to the next
+static void framescan_step(struct framescanIDs *ids, int32_t next) {
+	if (ids->last == FRAMESTORE_NO_ID) {
+		if (ids->first == FRAMESTORE_NO_ID) {
+			ids->first = next;
+		}
+	} else if ((int64_t)next > (int64_t)ids->last + 1) {
+		ids->gaps += 1;
+		ids->missing += (int64_t)next - ids->last - 1;
+	} else if (next <= ids->last) {
+		ids->backwards += 1;
+	}
+	ids->last = next;
+}
+
+// Ids start over with a capture, whether or not the record matches
+static void framescan_capture_start(
+	struct framescanTable *table, const struct framestoreRecord *rec) {
+	int direction = rec->direction != FRAMESTORE_READ;
+	struct framescanIDs *ids = &table->ids[direction];
+	if (ids->first == FRAMESTORE_NO_ID) {
+		ids->restarted = true;
+	}
+	ids->last = FRAMESTORE_NO_ID;
+}
+
+static void framescan_add_record(
+	struct framescanTable *table, const struct framestoreRecord *rec) {
+	int direction = rec->direction != FRAMESTORE_READ;
+	struct framescanCell *cell =
+		&table->cells[framescan_slot(rec->method)][direction];
+	table->matched += 1;
+	cell->frames += 1;
+	cell->bytes += rec->size;
+	cell->bad_crcs += !(rec->flags & FRAMESTORE_CRC_OK);
+	cell->oversized += !!(rec->flags & FRAMESTORE_OVERSIZED);
+	if (rec->size < cell->min_size) {
+		cell->min_size = rec->size;
+	}
+	if (rec->size > cell->max_size) {
+		cell->max_size = rec->size;
+	}
+	cell->sizes[framescan_bucket(rec->size)] += 1;
+	if (rec->time_ns >= 0) {
+		if (table->first_ns < 0) {
+			table->first_ns = rec->time_ns;
+		}
+		table->last_ns = rec->time_ns;
+	}
+	if (rec->id != FRAMESTORE_NO_ID) {
+		framescan_step(&table->ids[direction], rec->id);
+	}
+}
+
+static void framescan_unit(struct framescan *scan, struct framescanUnit *unit) {
+	const struct framestoreRecord *rec =
+		scan->stores[unit->store].records + unit->first;
+	const struct framestoreRecord *end = rec + unit->count;
+	framescan_table_init(&unit->table);
+	unit->table.scanned = unit->count;
+	for (; rec != end; ++rec) {
+		if (rec->flags & FRAMESTORE_CAPTURE_START) {
+			framescan_capture_start(&unit->table, rec);
+		}
+		if (framescan_match(scan->filter, rec)) {
+			framescan_add_record(&unit->table, rec);
+		}
+	}
+}
+
+static void *framescan_worker(void *data) {
+	struct framescan *scan = data;
+	size_t next;
+	while ((next = atomic_fetch_add(&scan->next_unit, 1)) <
+		scan->unit_count) {
+		framescan_unit(scan, &scan->units[next]);
+	}
+	return NULL;
+}
+
+static void framescan_merge_ids(
+	struct framescanIDs *into, const struct framescanIDs *from) {
+	if (from->restarted) {
+		into->restarted = into->restarted ||
+				  into->first == FRAMESTORE_NO_ID;
+		into->last = FRAMESTORE_NO_ID;
+	}
+	if (from->first == FRAMESTORE_NO_ID) {
+		return;
+	}
+	if (into->first == FRAMESTORE_NO_ID) {
+		into->first = from->first;
+	}
+	// The first id of from wasn't compared with anything yet
+	if (into->last != FRAMESTORE_NO_ID) {
+		framescan_step(into, from->first);
+	}
+	into->gaps += from->gaps;
+	into->missing += from->missing;
+	into->backwards += from->backwards;
+	into->last = from->last;
+}
+
+void framescan_table_merge(
+	struct framescanTable *into, const struct framescanTable *from) {
+	into->scanned += from->scanned;
+	into->matched += from->matched;
+	if (into->first_ns < 0) {
+		into->first_ns = from->first_ns;
+	}
+	if (from->last_ns >= 0) {
+		into->last_ns = from->last_ns;
+	}
+	for (int i = 0; i < FRAMESCAN_METHODS; ++i) {
+		for (int j = 0; j < 2; ++j) {
+			struct framescanCell *a = &into->cells[i][j];
+			const struct framescanCell *b = &from->cells[i][j];
+			a->frames += b->frames;
+			a->bytes += b->bytes;
+			a->bad_crcs += b->bad_crcs;
+			a->oversized += b->oversized;
+			if (b->min_size < a->min_size) {
+				a->min_size = b->min_size;
+			}
+			if (b->max_size > a->max_size) {
+				a->max_size = b->max_size;
+			}
+			for (int k = 0; k < FRAMESCAN_SIZE_BUCKETS; ++k) {
+				a->sizes[k] += b->sizes[k];
+			}
+		}
+	}
+	for (int i = 0; i < 2; ++i) {
+		framescan_merge_ids(&into->ids[i], &from->ids[i]);
+	}
+}
+
+bool framescan_run(struct framescan *scan,
+	const struct framescanFilter *filter, int threads,
+	struct framescanTable *table) {
+	pthread_t workers[FRAMESCAN_MAX_THREADS];
+	scan->filter = filter;
+	atomic_store(&scan->next_unit, 0);
+	if (threads > FRAMESCAN_MAX_THREADS) {
+		threads = FRAMESCAN_MAX_THREADS;
+	}
+	if ((size_t)threads > scan->unit_count) {
+		threads = scan->unit_count;
+	}
+	bool ok = true;
+	int started = 0;
+	// The calling thread is one of the workers
+	while (started < threads - 1) {
+		if (pthread_create(&workers[started], NULL, framescan_worker,
+			    scan) != 0) {
+			ok = false;
+			break;
+		}
+		started += 1;
+	}
+	framescan_worker(scan);
+	for (int i = 0; i < started; ++i) {
+		pthread_join(workers[i], NULL);
+	}
+	framescan_table_init(table);
+	for (size_t i = 0; i < scan->unit_count; ++i) {
+		const struct framescanUnit *unit = &scan->units[i];
+		// Ids only carry on between units of the same store
+		if (i > 0 && unit->store != scan->units[i - 1].store) {
+			table->ids[0].last = FRAMESTORE_NO_ID;
+			table->ids[1].last = FRAMESTORE_NO_ID;
+		}
+		framescan_table_merge(table, &unit->table);
+	}
+	return ok;
+}
@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#ifndef FRAMESCAN_H
+#define FRAMESCAN_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "framestore.h"
+
+// Scans many frame stores at once and adds up what's in them. The stores'
+// indexes are mapped and cut in to units of FRAMESCAN_UNIT_RECORDS records
+// which worker threads take in turn, so the work spreads over every core
+// however the records are split between stores. Each unit is added up on its
+// own and the units are merged in order at the end.
+//
+// Filters only look at records, so a scan never touches a payload.
+
+#define FRAMESCAN_MAX_STORES 256
+#define FRAMESCAN_MAX_THREADS 64
+#define FRAMESCAN_UNIT_RECORDS 16384
+// Method codes at or above the last slot share it with unknown methods
+#define FRAMESCAN_METHODS 32
+#define FRAMESCAN_UNKNOWN_SLOT (FRAMESCAN_METHODS - 1)
+// Bucket n counts sizes under 32 << n, the last bucket everything bigger
+#define FRAMESCAN_SIZE_BUCKETS 12
+
+struct framescanFilter {
+	// Bit per method slot and per framestoreDirection, 0 for any
+	uint32_t methods;
+	uint32_t directions;
+	// Flags that have to be set, and flags that have to be clear
+	uint8_t flags_set;
+	uint8_t flags_clear;
+};
+
+struct framescanCell {
+	unsigned long frames;
+	unsigned long bytes;
+	unsigned long bad_crcs;
+	unsigned long oversized;
+	uint32_t min_size;
+	uint32_t max_size;
+	unsigned long sizes[FRAMESCAN_SIZE_BUCKETS];
+};
+
+// Ids going up by more than one on a direction of a store, which means frames
+// went missing, and ids going back, which means reordering or a restart. Ids
+// aren't compared across the start of a capture.
+struct framescanIDs {
+	int32_t first;
+	int32_t last;
+	// Set if a capture started before the first id
+	bool restarted;
+	unsigned long gaps;
+	unsigned long missing;
+	unsigned long backwards;
+};
+
+struct framescanTable {
+	unsigned long scanned;
+	unsigned long matched;
+	int64_t first_ns;
+	int64_t last_ns;
+	struct framescanCell cells[FRAMESCAN_METHODS][2];
+	struct framescanIDs ids[2];
+};
+
+struct framescanUnit {
+	size_t store;
+	size_t first;
+	size_t count;
+	struct framescanTable table;
+};
+
+struct framescan {
+	struct framestoreReader stores[FRAMESCAN_MAX_STORES];
+	size_t store_count;
+	struct framescanUnit *units;
+	size_t unit_count;
+	// Set up by framescan_run for the workers
+	const struct framescanFilter *filter;
+	atomic_size_t next_unit;
+};
+
+void framescan_init(struct framescan *scan);
+// Maps a store and adds its units, returns false if it can't be mapped
+bool framescan_add(struct framescan *scan, const char *name);
+void framescan_free(struct framescan *scan);
+
+// Method slot of a record's method code
+static inline unsigned int framescan_slot(uint16_t method) {
+	return method < FRAMESCAN_UNKNOWN_SLOT ? method
+					       : FRAMESCAN_UNKNOWN_SLOT;
+}
+
+bool framescan_match(const struct framescanFilter *filter,
+	const struct framestoreRecord *rec);
+
+// Scans every store with up to threads threads and merges what matched in to
+// table. Returns false if threads couldn't be started, after scanning on the
+// calling thread instead.
+bool framescan_run(struct framescan *scan,
+	const struct framescanFilter *filter, int threads,
+	struct framescanTable *table);
+
+void framescan_table_init(struct framescanTable *table);
+// Adds a table that comes after into one that comes before
+void framescan_table_merge(
+	struct framescanTable *into, const struct framescanTable *from);
+
+#endif
@@ -0,0 +1,419 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#define _DEFAULT_SOURCE
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "framestore.h"
+#include "mjson.h"
+
+#define FRAMESTORE_BYTE_ORDER 0x01020304
+#define FRAMESTORE_BUFFER_SIZE (64 * 1024)
+
+#define NEW_METHOD(name, result_type, schema) #name,
+#define PARAM(key)
+#define END_METHOD()
+
+static const char *const framestore_methods[] = {
+#include "methods.inc"
+};
+
+#undef NEW_METHOD
+#undef PARAM
+#undef END_METHOD
+
+#define FRAMESTORE_METHOD_COUNT \
+	(sizeof(framestore_methods) / sizeof(*framestore_methods))
+
+const char *framestore_method_name(uint16_t method) {
+	if (method >= FRAMESTORE_METHOD_COUNT) {
+		return NULL;
+	}
+	return framestore_methods[method];
+}
+
+uint16_t framestore_method_code(const char *name, size_t name_len) {
+	for (size_t i = 0; i < FRAMESTORE_METHOD_COUNT; ++i) {
+		const char *method = framestore_methods[i];
+		if (strlen(method) == name_len &&
+			memcmp(method, name, name_len) == 0) {
+			return i;
+		}
+	}
+	return FRAMESTORE_METHOD_UNKNOWN;
+}
+
+static void framestore_make_header(
+	struct framestoreHeader *header, uint32_t record_size) {
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, FRAMESTORE_MAGIC, sizeof(FRAMESTORE_MAGIC));
+	header->version = FRAMESTORE_VERSION;
+	header->byte_order = FRAMESTORE_BYTE_ORDER;
+	header->record_size = record_size;
+}
+
+static bool framestore_header_ok(
+	const struct framestoreHeader *header, uint32_t record_size) {
+	struct framestoreHeader want;
+	framestore_make_header(&want, record_size);
+	return memcmp(header, &want, sizeof(want)) == 0;
+}
+
+static bool framestore_path(char *path, const char *name, const char *ext) {
+	int len = snprintf(path, FRAMESTORE_PATH_LEN, "%s%s", name, ext);
+	return len > 0 && len < FRAMESTORE_PATH_LEN;
+}
+
+// Opens a file with a header then records, writing the header if it's new
+// or checking it and counting the records if not
+static FILE *framestore_open_records(const char *name, const char *ext,
+	const char *mode, uint32_t record_size, uint64_t *count) {
+	char path[FRAMESTORE_PATH_LEN];
+	if (!framestore_path(path, name, ext)) {
+		return NULL;
+	}
+	FILE *file = fopen(path, mode);
+	if (file == NULL) {
+		return NULL;
+	}
+	setvbuf(file, NULL, _IOFBF, FRAMESTORE_BUFFER_SIZE);
+	struct framestoreHeader header;
+	bool ok = fseek(file, 0, SEEK_END) == 0;
+	long len = ftell(file);
+	if (ok && len == 0) {
+		framestore_make_header(&header, record_size);
+		ok = fwrite(&header, sizeof(header), 1, file) == 1;
+		*count = 0;
+	} else if (ok) {
+		rewind(file);
+		ok = fread(&header, sizeof(header), 1, file) == 1 &&
+		     framestore_header_ok(&header, record_size);
+		*count = (len - sizeof(header)) / record_size;
+		// Drop a record torn in half so new ones line up
+		long whole = sizeof(header) + *count * record_size;
+		if (ok && len != whole) {
+			ok = ftruncate(fileno(file), whole) == 0;
+		}
+		ok = ok && fseek(file, 0, SEEK_END) == 0;
+	}
+	if (!ok) {
+		fclose(file);
+		return NULL;
+	}
+	return file;
+}
+
+// Drops records at the end that point past the frames file, which new
+// payloads would otherwise be written over
+static bool framestore_trim(struct framestoreWriter *w) {
+	struct framestoreRecord record;
+	uint64_t count = w->records;
+	while (count > 0) {
+		long pos = sizeof(struct framestoreHeader) +
+			   (count - 1) * sizeof(record);
+		if (fseek(w->index, pos, SEEK_SET) != 0 ||
+			fread(&record, sizeof(record), 1, w->index) != 1) {
+			return false;
+		}
+		uint64_t end = record.offset;
+		if (!(record.flags & FRAMESTORE_OVERSIZED)) {
+			end += record.size + 1;
+		}
+		if (end <= w->offset) {
+			break;
+		}
+		count -= 1;
+	}
+	if (count != w->records) {
+		long len = sizeof(struct framestoreHeader) +
+			   count * sizeof(record);
+		if (ftruncate(fileno(w->index), len) != 0) {
+			return false;
+		}
+		w->records = count;
+	}
+	return fseek(w->index, 0, SEEK_END) == 0;
+}
+
+bool framestore_open(
+	struct framestoreWriter *w, const char *name, bool append) {
+	char path[FRAMESTORE_PATH_LEN];
+	memset(w, 0, sizeof(*w));
+	framestore_new_capture(w);
+	query_init(&w->q);
+	w->id_path = query_add(&w->q, "$.id");
+	w->method_path = query_add(&w->q, "$.method");
+	const char *mode = append ? "ab+" : "wb+";
+	if (framestore_path(path, name, ".frames")) {
+		w->frames = fopen(path, mode);
+	}
+	if (w->frames != NULL) {
+		setvbuf(w->frames, NULL, _IOFBF, FRAMESTORE_BUFFER_SIZE);
+	}
+	w->index = framestore_open_records(name, ".index", mode,
+		sizeof(struct framestoreRecord), &w->records);
+	if (w->frames == NULL || w->index == NULL ||
+		fseek(w->frames, 0, SEEK_END) != 0) {
+		framestore_close(w);
+		return false;
+	}
+	w->offset = ftell(w->frames);
+	if (append && !framestore_trim(w)) {
+		framestore_close(w);
+		return false;
+	}
+	return true;
+}
+
+bool framestore_log_chunks(
+	struct framestoreWriter *w, const char *name, bool append) {
+	uint64_t count;
+	w->chunks = framestore_open_records(name, ".chunks",
+		append ? "ab+" : "wb+",
+		sizeof(struct framestoreChunk), &count);
+	return w->chunks != NULL;
+}
+
+bool framestore_flush(struct framestoreWriter *w) {
+	// Payloads go first so a record never points past the frames file
+	bool ok = fflush(w->frames) == 0;
+	if (ok && w->pending_count != 0) {
+		ok = fwrite(w->pending, sizeof(*w->pending), w->pending_count,
+			     w->index) == w->pending_count;
+		w->pending_count = 0;
+	}
+	ok = fflush(w->index) == 0 && ok;
+	if (w->chunks != NULL) {
+		ok = fflush(w->chunks) == 0 && ok;
+	}
+	return ok;
+}
+
+bool framestore_close(struct framestoreWriter *w) {
+	bool ok = true;
+	if (w->frames != NULL && w->index != NULL) {
+		ok = framestore_flush(w);
+	}
+	FILE **files[] = {&w->frames, &w->index, &w->chunks};
+	for (size_t i = 0; i < sizeof(files) / sizeof(*files); ++i) {
+		if (*files[i] != NULL) {
+			ok = (fclose(*files[i]) == 0) && ok;
+			*files[i] = NULL;
+		}
+	}
+	return ok;
+}
+
+// Works out the id and method, and for replies the method of the request
+static void framestore_describe(struct framestoreWriter *w,
+	struct framestoreRecord *record, const void *payload) {
+	struct queryValue values[2];
+	struct queryResult results[2];
+	results[w->id_path] = (struct queryResult){&values[0], 1, 0};
+	results[w->method_path] = (struct queryResult){&values[1], 1, 0};
+	record->id = FRAMESTORE_NO_ID;
+	record->method = FRAMESTORE_METHOD_UNKNOWN;
+	if (payload == NULL || !query_extract(&w->q, &w->idx, payload,
+				       record->size, results)) {
+		return;
+	}
+	double id;
+	if (query_number(&results[w->id_path], &id) && id > INT32_MIN &&
+		id <= INT32_MAX) {
+		record->id = id;
+	}
+	const struct queryResult *method = &results[w->method_path];
+	int slot = (uint32_t)record->id % FRAMESTORE_ID_SLOTS;
+	if (method->count != 0 && values[1].type == MJSON_TOK_STRING) {
+		record->method = framestore_method_code(
+			values[1].value + 1, values[1].value_len - 2);
+		if (record->id != FRAMESTORE_NO_ID) {
+			w->request_ids[slot] = record->id;
+			w->request_methods[slot] = record->method;
+		}
+	} else if (record->id != FRAMESTORE_NO_ID &&
+		   w->request_ids[slot] == record->id) {
+		record->method = w->request_methods[slot];
+		record->flags |= FRAMESTORE_REPLY;
+		w->stats.replies_matched += 1;
+	}
+}
+
+void framestore_new_capture(struct framestoreWriter *w) {
+	for (int i = 0; i < FRAMESTORE_ID_SLOTS; ++i) {
+		w->request_ids[i] = FRAMESTORE_NO_ID;
+	}
+	w->capture_start = (1u << FRAMESTORE_READ) | (1u << FRAMESTORE_WRITE);
+}
+
+bool framestore_append(struct framestoreWriter *w,
+	struct framestoreRecord *record, const void *payload) {
+	record->offset = w->offset;
+	unsigned int direction = 1u << record->direction;
+	if (w->capture_start & direction) {
+		record->flags |= FRAMESTORE_CAPTURE_START;
+		w->capture_start &= ~direction;
+	}
+	framestore_describe(w, record, payload);
+	if (payload != NULL) {
+		// Payloads end with a NUL so they can be used as strings
+		if (fwrite(payload, 1, record->size, w->frames) !=
+				record->size ||
+			fputc('\0', w->frames) == EOF) {
+			return false;
+		}
+		w->offset += record->size + 1;
+	}
+	w->stats.frames += 1;
+	w->records += 1;
+	w->stats.bad_crcs += !(record->flags & FRAMESTORE_CRC_OK);
+	w->stats.oversized += !!(record->flags & FRAMESTORE_OVERSIZED);
+	w->pending[w->pending_count++] = *record;
+	if (w->pending_count == FRAMESTORE_PENDING) {
+		return framestore_flush(w);
+	}
+	return true;
+}
+
+void framestore_stream_init(struct framestoreStream *stream,
+	enum framestoreDirection direction, int fd) {
+	decoder_init(&stream->dec);
+	stream->direction = direction;
+	stream->fd = fd;
+	stream->start_ns = -1;
+}
+
+bool framestore_feed(struct framestoreWriter *w,
+	struct framestoreStream *stream, const unsigned char *data,
+	size_t data_len, int64_t time_ns) {
+	bool ok = true;
+	unsigned long skipped = stream->dec.stats.skipped_bytes;
+	if (w->chunks != NULL) {
+		struct framestoreChunk chunk;
+		memset(&chunk, 0, sizeof(chunk));
+		chunk.time_ns = time_ns;
+		chunk.frame = w->records;
+		chunk.len = data_len;
+		chunk.fd = stream->fd;
+		chunk.direction = stream->direction;
+		ok = fwrite(&chunk, sizeof(chunk), 1, w->chunks) == 1;
+	}
+	while (data_len > 0) {
+		size_t fed = decoder_feed(&stream->dec, data, data_len);
+		data += fed;
+		data_len -= fed;
+		struct decoderFrame frame;
+		enum decoderResult res;
+		while ((res = decoder_next(&stream->dec, &frame)) !=
+			DECODER_MORE) {
+			struct framestoreRecord record;
+			memset(&record, 0, sizeof(record));
+			record.start_ns = stream->start_ns;
+			if (record.start_ns < 0) {
+				record.start_ns = time_ns;
+			}
+			stream->start_ns = -1;
+			record.time_ns = time_ns;
+			record.size = frame.payload_len;
+			record.fd = stream->fd;
+			record.direction = stream->direction;
+			const unsigned char *payload = frame.payload;
+			if (res == DECODER_FRAME) {
+				record.flags |= FRAMESTORE_CRC_OK;
+			} else if (res == DECODER_OVERSIZED) {
+				record.flags |= FRAMESTORE_OVERSIZED;
+				payload = NULL;
+			}
+			ok = framestore_append(w, &record, payload) && ok;
+		}
+		// What's left is the start of the next frame
+		if (stream->dec.state != DECODER_NONE &&
+			stream->start_ns < 0) {
+			stream->start_ns = time_ns;
+		}
+	}
+	w->stats.skipped_bytes += stream->dec.stats.skipped_bytes - skipped;
+	return ok;
+}
+
+static void *framestore_map_file(const char *path, size_t *len) {
+	*len = 0;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return NULL;
+	}
+	struct stat st;
+	void *map = NULL;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			map = NULL;
+		} else {
+			*len = st.st_size;
+		}
+	}
+	close(fd);
+	return map;
+}
+
+bool framestore_map(struct framestoreReader *r, const char *name) {
+	char path[FRAMESTORE_PATH_LEN];
+	memset(r, 0, sizeof(*r));
+	if (!framestore_path(path, name, ".index")) {
+		return false;
+	}
+	r->index_map = framestore_map_file(path, &r->index_len);
+	const struct framestoreHeader *header = r->index_map;
+	if (header == NULL || r->index_len < sizeof(*header) ||
+		!framestore_header_ok(
+			header, sizeof(struct framestoreRecord))) {
+		framestore_unmap(r);
+		return false;
+	}
+	r->records = (const struct framestoreRecord *)(header + 1);
+	r->count = (r->index_len - sizeof(*header)) /
+		   sizeof(struct framestoreRecord);
+	// No frames file is fine if nothing had a payload
+	if (framestore_path(path, name, ".frames")) {
+		r->frames_map = framestore_map_file(path, &r->frames_len);
+	}
+	if (framestore_path(path, name, ".chunks")) {
+		r->chunks_map = framestore_map_file(path, &r->chunks_len);
+	}
+	header = r->chunks_map;
+	if (header != NULL && r->chunks_len >= sizeof(*header) &&
+		framestore_header_ok(header, sizeof(struct framestoreChunk))) {
+		r->chunks = (const struct framestoreChunk *)(header + 1);
+		r->chunk_count = (r->chunks_len - sizeof(*header)) /
+				 sizeof(struct framestoreChunk);
+	}
+	return true;
+}
+
+void framestore_unmap(struct framestoreReader *r) {
+	if (r->index_map != NULL) {
+		munmap(r->index_map, r->index_len);
+	}
+	if (r->frames_map != NULL) {
+		munmap(r->frames_map, r->frames_len);
+	}
+	if (r->chunks_map != NULL) {
+		munmap(r->chunks_map, r->chunks_len);
+	}
+	memset(r, 0, sizeof(*r));
+}
+
+const char *framestore_payload(
+	const struct framestoreReader *r, const struct framestoreRecord *rec) {
+	if ((rec->flags & FRAMESTORE_OVERSIZED) ||
+		rec->offset > r->frames_len ||
+		r->frames_len - rec->offset < (uint64_t)rec->size + 1) {
+		return NULL;
+	}
+	return (const char *)r->frames_map + rec->offset;
+}
@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#ifndef FRAMESTORE_H
+#define FRAMESTORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "decoder.h"
+#include "jsonindex.h"
+#include "query.h"
+
+// Decoded frames from a capture, kept as two files: NAME.frames holds the
+// payloads back to back and NAME.index holds a header then a fixed size
+// record per frame. Both are only ever appended to, and records are held back
+// until the payloads they point at have been flushed, so an interrupted
+// writer leaves at worst payloads with no records. Appending to a store
+// trims any torn or dangling records left by a writer that got cut off
+// anyway. Readers map both files and get at any frame by number without
+// parsing anything.
+//
+// Each record says which way the frame went, its id and method if it has
+// them, and whether its CRC was right. Replies take their method from the
+// request with the same id. A store can hold several captures or
+// connections one after another, and ids start over with each.
+//
+// A live capture can also keep NAME.chunks, a record of every read with its
+// time, for seeing how frames were split up on the way.
+
+#define FRAMESTORE_MAGIC "ACEFRM1"
+#define FRAMESTORE_VERSION 2
+#define FRAMESTORE_PATH_LEN 4096
+// Methods not in methods.inc
+#define FRAMESTORE_METHOD_UNKNOWN 0xFFFF
+// Frames with no id
+#define FRAMESTORE_NO_ID INT32_MIN
+// Replies remember their request's method by the id's low bits
+#define FRAMESTORE_ID_SLOTS 1024
+// Records held back until their payloads are flushed
+#define FRAMESTORE_PENDING 1024
+
+enum framestoreDirection {
+	// From the ACE
+	FRAMESTORE_READ,
+	// To the ACE
+	FRAMESTORE_WRITE,
+};
+
+enum framestoreFlag {
+	FRAMESTORE_CRC_OK = (1 << 0),
+	// Too big to decode, the payload isn't stored
+	FRAMESTORE_OVERSIZED = (1 << 1),
+	FRAMESTORE_REPLY = (1 << 2),
+	// First frame each way of a new capture, ids start over from here
+	FRAMESTORE_CAPTURE_START = (1 << 3),
+};
+
+struct framestoreHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t record_size;
+	uint32_t reserved;
+};
+
+struct framestoreRecord {
+	// Where the payload starts in the frames file
+	uint64_t offset;
+	// Capture times of the first and last bytes in nanoseconds, or -1 if
+	// not known
+	int64_t start_ns;
+	int64_t time_ns;
+	uint32_t size;
+	int32_t id;
+	int32_t fd;
+	uint16_t method;
+	uint8_t direction;
+	uint8_t flags;
+};
+
+struct framestoreChunk {
+	int64_t time_ns;
+	// Number of the next frame recorded after this chunk
+	uint64_t frame;
+	uint32_t len;
+	int32_t fd;
+	uint8_t direction;
+	uint8_t reserved[7];
+};
+
+struct framestoreStats {
+	unsigned long frames;
+	unsigned long bad_crcs;
+	unsigned long oversized;
+	unsigned long replies_matched;
+	unsigned long skipped_bytes;
+};
+
+struct framestoreWriter {
+	FILE *frames;
+	FILE *index;
+	FILE *chunks;
+	uint64_t offset;
+	uint64_t records;
+	struct framestoreRecord pending[FRAMESTORE_PENDING];
+	size_t pending_count;
+	// Method of the last request sent with an id, by the id's low bits
+	int32_t request_ids[FRAMESTORE_ID_SLOTS];
+	uint16_t request_methods[FRAMESTORE_ID_SLOTS];
+	// Bit per framestoreDirection still to flag FRAMESTORE_CAPTURE_START
+	unsigned int capture_start;
+	struct query q;
+	int id_path;
+	int method_path;
+	struct jsonIndex idx;
+	struct framestoreStats stats;
+};
+
+// One way of one fd, reassembling frames from the bytes that went past
+struct framestoreStream {
+	struct decoder dec;
+	enum framestoreDirection direction;
+	int fd;
+	// When the frame being decoded started, or -1
+	int64_t start_ns;
+};
+
+struct framestoreReader {
+	void *index_map;
+	size_t index_len;
+	void *frames_map;
+	size_t frames_len;
+	const struct framestoreRecord *records;
+	size_t count;
+	// Empty without a chunks file
+	void *chunks_map;
+	size_t chunks_len;
+	const struct framestoreChunk *chunks;
+	size_t chunk_count;
+};
+
+// Creates a store, or appends to one if append is set. Returns false if the
+// files can't be opened or aren't a store this code can read.
+bool framestore_open(
+	struct framestoreWriter *w, const char *name, bool append);
+// Starts keeping NAME.chunks as well
+bool framestore_log_chunks(
+	struct framestoreWriter *w, const char *name, bool append);
+// Writes out anything buffered so readers can see it
+bool framestore_flush(struct framestoreWriter *w);
+// Returns false if anything failed to write
+bool framestore_close(struct framestoreWriter *w);
+
+// Starts a new capture. Requests from before it are forgotten, and the next
+// frame each way is flagged FRAMESTORE_CAPTURE_START. Streams carry on until
+// they're initialised again. Opening a store starts a capture.
+void framestore_new_capture(struct framestoreWriter *w);
+
+// Adds a payload of record->size bytes, or none if it's NULL, filling in
+// the record's offset, id, method and reply flag
+bool framestore_append(struct framestoreWriter *w,
+	struct framestoreRecord *record, const void *payload);
+
+void framestore_stream_init(struct framestoreStream *stream,
+	enum framestoreDirection direction, int fd);
+
+// Feeds bytes seen on a stream at time_ns, appending every frame they
+// finish
+bool framestore_feed(struct framestoreWriter *w,
+	struct framestoreStream *stream, const unsigned char *data,
+	size_t data_len, int64_t time_ns);
+
+bool framestore_map(struct framestoreReader *r, const char *name);
+void framestore_unmap(struct framestoreReader *r);
+
+// Payload of a record, NULL for oversized frames or if the frames file is
+// shorter than the index says
+const char *framestore_payload(
+	const struct framestoreReader *r, const struct framestoreRecord *rec);
+
+// Name of a method code, or NULL if it's unknown
+const char *framestore_method_name(uint16_t method);
+uint16_t framestore_method_code(const char *name, size_t name_len);
+
+#endif
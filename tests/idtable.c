@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#include <string.h>
+
+#include "idtable.h"
+
+_Static_assert((IDTABLE_SIZE & (IDTABLE_SIZE - 1)) == 0,
+	"IDTABLE_SIZE must be a power of two");
+
+static size_t idtable_home(int id) {
+	// Fibonacci hashing spreads sequential and negative ids alike
+	uint32_t hash = (uint32_t)id * 0x9E3779B1u;
+	return (hash >> 16) & (IDTABLE_SIZE - 1);
+}
+
+void idtable_init(struct idtable *table) {
+	memset(table->entries, 0, sizeof(table->entries));
+	table->count = 0;
+}
+
+struct idtableEntry *idtable_find(struct idtable *table, int id) {
+	size_t pos = idtable_home(id);
+	while (table->entries[pos].used) {
+		if (table->entries[pos].id == id) {
+			return &table->entries[pos];
+		}
+		pos = (pos + 1) & (IDTABLE_SIZE - 1);
+	}
+	return NULL;
+}
+
+struct idtableEntry *idtable_insert(struct idtable *table, int id, int value) {
+	if (table->count == IDTABLE_MAX_COUNT) {
+		return NULL;
+	}
+	size_t pos = idtable_home(id);
+	while (table->entries[pos].used) {
+		if (table->entries[pos].id == id) {
+			return NULL;
+		}
+		pos = (pos + 1) & (IDTABLE_SIZE - 1);
+	}
+	struct idtableEntry *entry = &table->entries[pos];
+	entry->id = id;
+	entry->value = value;
+	entry->expires_us = 0;
+	entry->used = true;
+	table->count += 1;
+	return entry;
+}
+
+void idtable_remove(struct idtable *table, struct idtableEntry *entry) {
+	size_t hole = entry - table->entries;
+	size_t pos = hole;
+	// Pull back later entries in the run that would be cut off by the hole
+	for (;;) {
+		pos = (pos + 1) & (IDTABLE_SIZE - 1);
+		struct idtableEntry *next = &table->entries[pos];
+		if (!next->used) {
+			break;
+		}
+		size_t home = idtable_home(next->id);
+		size_t home_dist = (pos - home) & (IDTABLE_SIZE - 1);
+		size_t hole_dist = (pos - hole) & (IDTABLE_SIZE - 1);
+		if (home_dist >= hole_dist) {
+			table->entries[hole] = *next;
+			hole = pos;
+		}
+	}
+	table->entries[hole].used = false;
+	table->count -= 1;
+}
@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#ifndef IDTABLE_H
+#define IDTABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Open addressing hash table from request ids to small integers, with linear
+// probing and backward shift deletion so there are no tombstones. Any int is
+// a valid id, including zero and negative ids.
+
+#define IDTABLE_SIZE 64
+#define IDTABLE_MAX_COUNT (IDTABLE_SIZE * 3 / 4)
+
+struct idtableEntry {
+	int id;
+	int value;
+	int64_t expires_us;
+	bool used;
+};
+
+struct idtable {
+	struct idtableEntry entries[IDTABLE_SIZE];
+	size_t count;
+};
+
+void idtable_init(struct idtable *table);
+
+// Returns the entry for id or NULL if there isn't one
+struct idtableEntry *idtable_find(struct idtable *table, int id);
+
+// Adds an entry for id. Returns NULL if id is already there or the table is
+// full.
+struct idtableEntry *idtable_insert(struct idtable *table, int id, int value);
+
+// Removes an entry returned by idtable_find or idtable_insert, which moves
+// other entries around
+void idtable_remove(struct idtable *table, struct idtableEntry *entry);
+
+#endif
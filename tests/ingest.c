@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "framestore.h"
+#include "strace.h"
+
+// Streams strace logs in to a frame store, a line at a time so logs of any
+// size can be piped through:
+//
+//   ./ingest STORE ../raw_data/*.strace
+//   strace -f -e trace=read,write -s 65535 -o /dev/stdout CMD |
+//     ./ingest STORE -
+//
+// With -a frames are added to an existing store. Each log is its own
+// capture: frames and calls cut off at the end of one aren't finished by the
+// next.
+
+#define INGEST_MAX_STREAMS 32
+
+struct ingest {
+	struct framestoreWriter store;
+	struct straceReader reader;
+	struct framestoreStream *streams[INGEST_MAX_STREAMS];
+	size_t stream_count;
+	unsigned long dropped_calls;
+};
+
+static struct framestoreStream *ingest_stream(
+	struct ingest *in, enum framestoreDirection direction, int fd) {
+	for (size_t i = 0; i < in->stream_count; ++i) {
+		struct framestoreStream *stream = in->streams[i];
+		if (stream->direction == direction && stream->fd == fd) {
+			return stream;
+		}
+	}
+	if (in->stream_count == INGEST_MAX_STREAMS) {
+		return NULL;
+	}
+	struct framestoreStream *stream = malloc(sizeof(*stream));
+	if (stream == NULL) {
+		abort();
+	}
+	framestore_stream_init(stream, direction, fd);
+	in->streams[in->stream_count++] = stream;
+	return stream;
+}
+
+static bool ingest_call(struct ingest *in, const struct straceCall *call) {
+	if (call->fd <= 2 || call->result <= 0 || !call->has_data) {
+		return true;
+	}
+	enum framestoreDirection direction = call->direction == STRACE_READ
+						     ? FRAMESTORE_READ
+						     : FRAMESTORE_WRITE;
+	struct framestoreStream *stream =
+		ingest_stream(in, direction, call->fd);
+	if (stream == NULL) {
+		in->dropped_calls += 1;
+		return true;
+	}
+	size_t len = call->data_len;
+	if ((unsigned long)call->result < len) {
+		len = call->result;
+	}
+	int64_t time_ns = -1;
+	if (call->timestamp >= 0) {
+		time_ns = call->timestamp * 1e9;
+	}
+	return framestore_feed(&in->store, stream, call->data, len, time_ns);
+}
+
+// Ends a capture, so the next log starts afresh
+static void ingest_reset(struct ingest *in) {
+	for (size_t i = 0; i < in->stream_count; ++i) {
+		free(in->streams[i]);
+	}
+	in->stream_count = 0;
+	strace_reader_reset(&in->reader);
+	framestore_new_capture(&in->store);
+}
+
+static bool ingest_file(struct ingest *in, const char *path) {
+	FILE *file = stdin;
+	if (strcmp(path, "-") != 0) {
+		file = fopen(path, "r");
+	}
+	if (file == NULL) {
+		perror(path);
+		return false;
+	}
+	bool ok = true;
+	char *line = NULL;
+	size_t line_cap = 0;
+	ssize_t line_len;
+	while (ok && (line_len = getline(&line, &line_cap, file)) != -1) {
+		struct straceCall call;
+		if (strace_reader_line(&in->reader, line, line_len, &call)) {
+			ok = ingest_call(in, &call);
+		}
+	}
+	if (!ok) {
+		perror("Writing frame store");
+	}
+	free(line);
+	if (file != stdin) {
+		fclose(file);
+	}
+	ingest_reset(in);
+	return ok;
+}
+
+static void ingest_summary(const char *name) {
+	struct framestoreReader r;
+	if (!framestore_map(&r, name)) {
+		fprintf(stderr, "Couldn't map frame store %s\n", name);
+		return;
+	}
+	unsigned long requests[FRAMESTORE_METHOD_UNKNOWN + 1] = {0};
+	unsigned long replies[FRAMESTORE_METHOD_UNKNOWN + 1] = {0};
+	unsigned long directions[2] = {0};
+	for (size_t i = 0; i < r.count; ++i) {
+		const struct framestoreRecord *rec = &r.records[i];
+		directions[rec->direction != FRAMESTORE_READ] += 1;
+		if (rec->flags & FRAMESTORE_REPLY) {
+			replies[rec->method] += 1;
+		} else if (rec->method != FRAMESTORE_METHOD_UNKNOWN) {
+			requests[rec->method] += 1;
+		}
+	}
+	fprintf(stdout, "%zu frames, %zu payload bytes\n", r.count,
+		r.frames_len);
+	fprintf(stdout, "%lu read, %lu written\n", directions[0],
+		directions[1]);
+	const char *method_name;
+	for (uint16_t i = 0; (method_name = framestore_method_name(i)); ++i) {
+		if (requests[i] == 0 && replies[i] == 0) {
+			continue;
+		}
+		fprintf(stdout, "%s: %lu requests, %lu replies\n", method_name,
+			requests[i], replies[i]);
+	}
+	framestore_unmap(&r);
+}
+
+int main(int argc, char *argv[]) {
+	int arg = 1;
+	bool append = false;
+	if (arg < argc && strcmp(argv[arg], "-a") == 0) {
+		append = true;
+		arg += 1;
+	}
+	if (argc - arg < 2) {
+		fprintf(stderr, "Usage: %s [-a] STORE STRACE_FILE...\n",
+			argv[0]);
+		return 1;
+	}
+	const char *name = argv[arg++];
+	static struct ingest in;
+	if (!framestore_open(&in.store, name, append)) {
+		fprintf(stderr, "Couldn't open frame store %s\n", name);
+		return 1;
+	}
+	strace_reader_init(&in.reader);
+	int status = 0;
+	for (; arg < argc; ++arg) {
+		if (!ingest_file(&in, argv[arg])) {
+			status = 1;
+		}
+	}
+	if (!framestore_close(&in.store)) {
+		perror("Closing frame store");
+		status = 1;
+	}
+	fprintf(stdout, "-- FRAME STORE --\n");
+	const struct straceStats *ts = &in.reader.stats;
+	fprintf(stdout, "%lu lines, %lu calls, %lu resumed, %lu unmatched, "
+			"%lu truncated\n",
+		ts->lines, ts->calls, ts->resumed, ts->unmatched,
+		ts->truncated);
+	const struct framestoreStats *fs = &in.store.stats;
+	fprintf(stdout, "Added %lu frames: %lu bad CRCs, %lu oversized, "
+			"%lu replies matched, %lu bytes skipped\n",
+		fs->frames, fs->bad_crcs, fs->oversized, fs->replies_matched,
+		fs->skipped_bytes);
+	if (in.dropped_calls != 0) {
+		fprintf(stdout, "Dropped %lu calls, too many fds\n",
+			in.dropped_calls);
+	}
+	ingest_summary(name);
+	strace_reader_free(&in.reader);
+	return status;
+}
@@ -0,0 +1,470 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#include <string.h>
+
+#include "jsonindex.h"
+#include "mjson.h"
+
+#define JSONINDEX_BLOCK 64
+
+static int jsonindex_always_supported(void) {
+	return 1;
+}
+
+static void jsonindex_classify_scalar(const unsigned char *block,
+	uint64_t *quotes, uint64_t *backslashes, uint64_t *structurals) {
+	uint64_t q = 0;
+	uint64_t b = 0;
+	uint64_t s = 0;
+	for (int i = 0; i < JSONINDEX_BLOCK; ++i) {
+		uint64_t bit = (uint64_t)1 << i;
+		switch (block[i]) {
+		case '"':
+			q |= bit;
+			break;
+		case '\\':
+			b |= bit;
+			break;
+		case '{':
+		case '}':
+		case '[':
+		case ']':
+		case ':':
+		case ',':
+			s |= bit;
+			break;
+		}
+	}
+	*quotes = q;
+	*backslashes = b;
+	*structurals = s;
+}
+
+// Braces and brackets only differ by 0x20, so OR-ing that in folds [ and ]
+// on to { and } and saves two compares per vector
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+static void jsonindex_classify_sse2(const unsigned char *block,
+	uint64_t *quotes, uint64_t *backslashes, uint64_t *structurals) {
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i fold = _mm_set1_epi8(0x20);
+	const __m128i open = _mm_set1_epi8('{');
+	const __m128i close = _mm_set1_epi8('}');
+	const __m128i colon = _mm_set1_epi8(':');
+	const __m128i comma = _mm_set1_epi8(',');
+	uint64_t q = 0;
+	uint64_t b = 0;
+	uint64_t s = 0;
+	for (int i = 0; i < JSONINDEX_BLOCK; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(block + i));
+		__m128i folded = _mm_or_si128(v, fold);
+		__m128i brackets = _mm_or_si128(_mm_cmpeq_epi8(folded, open),
+			_mm_cmpeq_epi8(folded, close));
+		__m128i others = _mm_or_si128(_mm_cmpeq_epi8(v, colon),
+			_mm_cmpeq_epi8(v, comma));
+		uint32_t qm = _mm_movemask_epi8(_mm_cmpeq_epi8(v, quote));
+		uint32_t bm = _mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash));
+		uint32_t sm = _mm_movemask_epi8(_mm_or_si128(brackets, others));
+		q |= (uint64_t)qm << i;
+		b |= (uint64_t)bm << i;
+		s |= (uint64_t)sm << i;
+	}
+	*quotes = q;
+	*backslashes = b;
+	*structurals = s;
+}
+
+static int jsonindex_avx2_supported(void) {
+	return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2"))) static void jsonindex_classify_avx2(
+	const unsigned char *block, uint64_t *quotes, uint64_t *backslashes,
+	uint64_t *structurals) {
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i fold = _mm256_set1_epi8(0x20);
+	const __m256i open = _mm256_set1_epi8('{');
+	const __m256i close = _mm256_set1_epi8('}');
+	const __m256i colon = _mm256_set1_epi8(':');
+	const __m256i comma = _mm256_set1_epi8(',');
+	uint64_t q = 0;
+	uint64_t b = 0;
+	uint64_t s = 0;
+	for (int i = 0; i < JSONINDEX_BLOCK; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(block + i));
+		__m256i folded = _mm256_or_si256(v, fold);
+		__m256i brackets = _mm256_or_si256(
+			_mm256_cmpeq_epi8(folded, open),
+			_mm256_cmpeq_epi8(folded, close));
+		__m256i others = _mm256_or_si256(_mm256_cmpeq_epi8(v, colon),
+			_mm256_cmpeq_epi8(v, comma));
+		uint32_t qm =
+			_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote));
+		uint32_t bm =
+			_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, backslash));
+		uint32_t sm = _mm256_movemask_epi8(
+			_mm256_or_si256(brackets, others));
+		q |= (uint64_t)qm << i;
+		b |= (uint64_t)bm << i;
+		s |= (uint64_t)sm << i;
+	}
+	*quotes = q;
+	*backslashes = b;
+	*structurals = s;
+}
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+
+// No movemask on ARM: keep one bit per lane and add neighbouring lanes
+// together until each half is a byte, this works on ARMv7 and AArch64
+static uint16_t jsonindex_neon_mask(uint8x16_t matches) {
+	static const uint8_t weights[16] = {
+		1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+	uint8x16_t bits = vandq_u8(matches, vld1q_u8(weights));
+	uint8x8_t sum = vpadd_u8(vget_low_u8(bits), vget_high_u8(bits));
+	sum = vpadd_u8(sum, sum);
+	sum = vpadd_u8(sum, sum);
+	return vget_lane_u8(sum, 0) | (vget_lane_u8(sum, 1) << 8);
+}
+
+static void jsonindex_classify_neon(const unsigned char *block,
+	uint64_t *quotes, uint64_t *backslashes, uint64_t *structurals) {
+	const uint8x16_t quote = vdupq_n_u8('"');
+	const uint8x16_t backslash = vdupq_n_u8('\\');
+	const uint8x16_t fold = vdupq_n_u8(0x20);
+	const uint8x16_t open = vdupq_n_u8('{');
+	const uint8x16_t close = vdupq_n_u8('}');
+	const uint8x16_t colon = vdupq_n_u8(':');
+	const uint8x16_t comma = vdupq_n_u8(',');
+	uint64_t q = 0;
+	uint64_t b = 0;
+	uint64_t s = 0;
+	for (int i = 0; i < JSONINDEX_BLOCK; i += 16) {
+		uint8x16_t v = vld1q_u8(block + i);
+		uint8x16_t folded = vorrq_u8(v, fold);
+		uint8x16_t brackets = vorrq_u8(
+			vceqq_u8(folded, open), vceqq_u8(folded, close));
+		uint8x16_t others =
+			vorrq_u8(vceqq_u8(v, colon), vceqq_u8(v, comma));
+		uint64_t qm = jsonindex_neon_mask(vceqq_u8(v, quote));
+		uint64_t bm = jsonindex_neon_mask(vceqq_u8(v, backslash));
+		uint64_t sm = jsonindex_neon_mask(vorrq_u8(brackets, others));
+		q |= qm << i;
+		b |= bm << i;
+		s |= sm << i;
+	}
+	*quotes = q;
+	*backslashes = b;
+	*structurals = s;
+}
+#endif
+
+// Listed from worst to best
+static const struct jsonindexEngine jsonindex_engine_list[] = {
+	{"scalar", jsonindex_classify_scalar, jsonindex_always_supported},
+#if defined(__x86_64__) && defined(__GNUC__)
+	{"sse2", jsonindex_classify_sse2, jsonindex_always_supported},
+	{"avx2", jsonindex_classify_avx2, jsonindex_avx2_supported},
+#endif
+#if defined(__ARM_NEON)
+	{"neon", jsonindex_classify_neon, jsonindex_always_supported},
+#endif
+};
+
+static const struct jsonindexEngine *jsonindex_selected = NULL;
+
+size_t jsonindex_engines(const struct jsonindexEngine **engines) {
+	*engines = jsonindex_engine_list;
+	return sizeof(jsonindex_engine_list) / sizeof(*jsonindex_engine_list);
+}
+
+const char *jsonindex_select(void) {
+	const struct jsonindexEngine *engines;
+	size_t count = jsonindex_engines(&engines);
+	for (size_t i = 0; i < count; ++i) {
+		if (engines[i].supported()) {
+			jsonindex_selected = &engines[i];
+		}
+	}
+	return jsonindex_selected->name;
+}
+
+// Bits that are escaped by a backslash. Runs of backslashes are rare in
+// what the ACE sends so they're walked a bit at a time when they turn up.
+static uint64_t jsonindex_escaped(uint64_t backslashes, uint64_t *carry) {
+	if (backslashes == 0 && *carry == 0) {
+		return 0;
+	}
+	uint64_t escaped = 0;
+	for (int i = 0; i < JSONINDEX_BLOCK; ++i) {
+		uint64_t bit = (uint64_t)1 << i;
+		if (*carry) {
+			escaped |= bit;
+			*carry = 0;
+		} else if (backslashes & bit) {
+			*carry = 1;
+		}
+	}
+	return escaped;
+}
+
+// Bit n is set if an odd number of bits up to n are set, which marks
+// everything from an opening quote up to before its closing quote
+static uint64_t jsonindex_prefix_xor(uint64_t bits) {
+	bits ^= bits << 1;
+	bits ^= bits << 2;
+	bits ^= bits << 4;
+	bits ^= bits << 8;
+	bits ^= bits << 16;
+	bits ^= bits << 32;
+	return bits;
+}
+
+static char jsonindex_char(const struct jsonIndex *idx, size_t token) {
+	return idx->buf[idx->offsets[token]];
+}
+
+static bool jsonindex_add(struct jsonIndex *idx, size_t offset,
+	uint16_t *stack, size_t *depth) {
+	if (idx->count == JSONINDEX_MAX_TOKENS) {
+		return false;
+	}
+	size_t token = idx->count++;
+	idx->offsets[token] = offset;
+	idx->match[token] = 0;
+	char c = idx->buf[offset];
+	if (c == '{' || c == '[') {
+		if (*depth == JSONINDEX_MAX_DEPTH) {
+			return false;
+		}
+		stack[(*depth)++] = token;
+	} else if (c == '}' || c == ']') {
+		if (*depth == 0) {
+			return false;
+		}
+		size_t open = stack[--(*depth)];
+		if (jsonindex_char(idx, open) != (c == '}' ? '{' : '[')) {
+			return false;
+		}
+		idx->match[open] = token;
+		idx->match[token] = open;
+	}
+	return true;
+}
+
+bool jsonindex_build_with(struct jsonIndex *idx, const char *buf, size_t len,
+	const struct jsonindexEngine *engine) {
+	if (len > JSONINDEX_MAX_LEN) {
+		return false;
+	}
+	idx->buf = buf;
+	idx->len = len;
+	idx->count = 0;
+	uint16_t stack[JSONINDEX_MAX_DEPTH];
+	size_t depth = 0;
+	uint64_t escape_carry = 0;
+	uint64_t in_string = 0;
+	for (size_t base = 0; base < len; base += JSONINDEX_BLOCK) {
+		const unsigned char *block = (const unsigned char *)buf + base;
+		unsigned char tail[JSONINDEX_BLOCK];
+		if (len - base < JSONINDEX_BLOCK) {
+			memset(tail, ' ', sizeof(tail));
+			memcpy(tail, block, len - base);
+			block = tail;
+		}
+		uint64_t quotes, backslashes, structurals;
+		engine->classify(block, &quotes, &backslashes, &structurals);
+		quotes &= ~jsonindex_escaped(backslashes, &escape_carry);
+		uint64_t inside = jsonindex_prefix_xor(quotes) ^ in_string;
+		in_string = (inside >> 63) ? ~(uint64_t)0 : 0;
+		uint64_t tokens = (structurals & ~inside) | quotes;
+		while (tokens != 0) {
+			size_t offset = base + __builtin_ctzll(tokens);
+			tokens &= tokens - 1;
+			if (!jsonindex_add(idx, offset, stack, &depth)) {
+				return false;
+			}
+		}
+	}
+	return in_string == 0 && depth == 0;
+}
+
+bool jsonindex_build(struct jsonIndex *idx, const char *buf, size_t len) {
+	if (jsonindex_selected == NULL) {
+		jsonindex_select();
+	}
+	return jsonindex_build_with(idx, buf, len, jsonindex_selected);
+}
+
+static bool jsonindex_space(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// True if there's anything but whitespace between two tokens
+static bool jsonindex_gap(const struct jsonIndex *idx, size_t token) {
+	size_t start = idx->offsets[token - 1] + 1;
+	size_t end = idx->offsets[token];
+	for (size_t i = start; i < end; ++i) {
+		if (!jsonindex_space(idx->buf[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Where the value starting at token ends, plus one
+static size_t jsonindex_skip(const struct jsonIndex *idx, size_t token) {
+	char c = jsonindex_char(idx, token);
+	if (c == '{' || c == '[') {
+		return idx->match[token] + 1;
+	} else if (c == '"') {
+		return token + 2;
+	}
+	// Bare value, token is whatever comes after it
+	return token;
+}
+
+bool jsonindex_next(const struct jsonIndex *idx, size_t container,
+	size_t *pos, int *key, size_t *value) {
+	size_t end = idx->match[container];
+	bool object = (jsonindex_char(idx, container) == '{');
+	size_t token = (*pos == 0) ? container + 1 : *pos;
+	if (token >= end + 1 || (token == end && !jsonindex_gap(idx, end))) {
+		return false;
+	}
+	*key = -1;
+	if (object) {
+		if (token + 2 >= end || jsonindex_char(idx, token) != '"' ||
+			jsonindex_char(idx, token + 2) != ':') {
+			return false;
+		}
+		*key = token;
+		token += 3;
+	}
+	char c = jsonindex_char(idx, token);
+	if ((c == ',' || c == '}' || c == ']') && !jsonindex_gap(idx, token)) {
+		// Nothing between the colon or comma and here
+		return false;
+	}
+	*value = token;
+	size_t after = jsonindex_skip(idx, token);
+	if (after > end) {
+		return false;
+	}
+	c = jsonindex_char(idx, after);
+	*pos = (c == ',') ? after + 1 : end + 1;
+	return c == ',' || after == end;
+}
+
+int jsonindex_value(const struct jsonIndex *idx, size_t token,
+	const char **value, int *value_len) {
+	char c = jsonindex_char(idx, token);
+	size_t start = idx->offsets[token];
+	size_t end;
+	int type;
+	if (c == '{' || c == '[') {
+		end = idx->offsets[idx->match[token]] + 1;
+		type = (c == '{') ? MJSON_TOK_OBJECT : MJSON_TOK_ARRAY;
+	} else if (c == '"') {
+		end = idx->offsets[token + 1] + 1;
+		type = MJSON_TOK_STRING;
+	} else {
+		start = idx->offsets[token - 1] + 1;
+		end = idx->offsets[token];
+		while (start < end && jsonindex_space(idx->buf[start])) {
+			start += 1;
+		}
+		while (end > start && jsonindex_space(idx->buf[end - 1])) {
+			end -= 1;
+		}
+		if (start == end) {
+			return MJSON_TOK_INVALID;
+		}
+		switch (idx->buf[start]) {
+		case 't':
+			type = MJSON_TOK_TRUE;
+			break;
+		case 'f':
+			type = MJSON_TOK_FALSE;
+			break;
+		case 'n':
+			type = MJSON_TOK_NULL;
+			break;
+		default:
+			type = MJSON_TOK_NUMBER;
+			break;
+		}
+	}
+	*value = idx->buf + start;
+	*value_len = end - start;
+	return type;
+}
+
+static bool jsonindex_key_is(const struct jsonIndex *idx, size_t token,
+	const char *key, size_t key_len) {
+	size_t start = idx->offsets[token] + 1;
+	size_t len = idx->offsets[token + 1] - start;
+	return len == key_len && memcmp(idx->buf + start, key, key_len) == 0;
+}
+
+int jsonindex_lookup(const struct jsonIndex *idx, const char *path) {
+	if (idx->count == 0 || path[0] != '$') {
+		return -1;
+	}
+	size_t current = 0;
+	const char *step = path + 1;
+	while (*step != '\0') {
+		char c = jsonindex_char(idx, current);
+		size_t pos = 0;
+		int key;
+		size_t value;
+		bool found = false;
+		if (*step == '.' && c == '{') {
+			const char *name = step + 1;
+			size_t name_len = strcspn(name, ".[");
+			while (!found && jsonindex_next(
+					 idx, current, &pos, &key, &value)) {
+				found = jsonindex_key_is(
+					idx, key, name, name_len);
+			}
+			step = name + name_len;
+		} else if (*step == '[' && c == '[') {
+			long want = 0;
+			step += 1;
+			while (*step >= '0' && *step <= '9') {
+				want = want * 10 + (*step++ - '0');
+			}
+			if (*step++ != ']') {
+				return -1;
+			}
+			for (long i = 0; i <= want; ++i) {
+				found = jsonindex_next(
+					idx, current, &pos, &key, &value);
+				if (!found) {
+					break;
+				}
+			}
+		}
+		if (!found) {
+			return -1;
+		}
+		current = value;
+	}
+	return current;
+}
+
+int jsonindex_find(const struct jsonIndex *idx, const char *path,
+	const char **value, int *value_len) {
+	int token = jsonindex_lookup(idx, path);
+	if (token == -1) {
+		return MJSON_TOK_INVALID;
+	}
+	return jsonindex_value(idx, token, value, value_len);
+}
@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#ifndef JSONINDEX_H
+#define JSONINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Structural index of a JSON payload: the offset of every quote, brace,
+// bracket, colon and comma outside of strings, with each brace or bracket
+// linked to the one that closes it. Payloads are classified 64 bytes at a
+// time with SIMD where the CPU has it, then lookups walk the index and jump
+// over nested values instead of scanning characters.
+//
+// A string is two entries, its quotes. Numbers, true, false and null have no
+// entries, they sit between a colon or comma and the next entry.
+
+#define JSONINDEX_MAX_LEN 65535
+#define JSONINDEX_MAX_TOKENS 2048
+#define JSONINDEX_MAX_DEPTH 64
+
+struct jsonIndex {
+	const char *buf;
+	size_t len;
+	size_t count;
+	uint16_t offsets[JSONINDEX_MAX_TOKENS];
+	// For an opening brace or bracket, the index of its closing one
+	uint16_t match[JSONINDEX_MAX_TOKENS];
+};
+
+// Classifies 64 bytes in to masks, bit n standing for byte n
+typedef void (*jsonindex_classify_fn)(const unsigned char *block,
+	uint64_t *quotes, uint64_t *backslashes, uint64_t *structurals);
+
+struct jsonindexEngine {
+	const char *name;
+	jsonindex_classify_fn classify;
+	int (*supported)(void);
+};
+
+// Picks the best engine the CPU supports and returns its name
+const char *jsonindex_select(void);
+size_t jsonindex_engines(const struct jsonindexEngine **engines);
+
+// Indexes buf with the selected engine or a given one. buf must stay around
+// while the index is used. Returns false if it isn't balanced JSON or is too
+// big to index.
+bool jsonindex_build(struct jsonIndex *idx, const char *buf, size_t len);
+bool jsonindex_build_with(struct jsonIndex *idx, const char *buf, size_t len,
+	const struct jsonindexEngine *engine);
+
+// Looks up a path like mjson does, such as "$.result.slots[2].rfid".
+// Returns an MJSON_TOK_* type and sets the value's span, strings including
+// their quotes, or MJSON_TOK_INVALID if it isn't there.
+int jsonindex_find(const struct jsonIndex *idx, const char *path,
+	const char **value, int *value_len);
+
+// Token index of the value at a path, or -1. Scalars other than strings have
+// no token of their own, this gives the token before them instead and
+// jsonindex_value works out the rest.
+int jsonindex_lookup(const struct jsonIndex *idx, const char *path);
+
+// Span and type of the value starting at token index from the token index
+// returned by jsonindex_lookup or jsonindex_next
+int jsonindex_value(const struct jsonIndex *idx, size_t token,
+	const char **value, int *value_len);
+
+// Iterates over an object or array at token index container. Starts with
+// *pos set to 0, returns false at the end. Sets *key to the key's token
+// index for objects or -1 for arrays, and *value for jsonindex_value.
+bool jsonindex_next(const struct jsonIndex *idx, size_t container,
+	size_t *pos, int *key, size_t *value);
+
+#endif
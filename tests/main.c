@@ -10,22 +10,26 @@
 #define SLEEP_LENGTH_US (1 * SECOND_US)
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
 
-#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "crc.h"
+#include "encoder.h"
 #include "mjson.h"
+#include "poller.h"
+#include "query.h"
+#include "session.h"
 
 int tryOpenSimulator(void) {
-	static char sim_path[1024];
+	char sim_path[1024];
 	const char *xdg_path = getenv("XDG_RUNTIME_DIR");
 	if (xdg_path == NULL) {
 		return -1;
@@ -48,8 +52,13 @@ int tryOpenSerial(void) {
 	return tty;
 }
 
+// Set if tryOpenACE found the emulator, tests that move filament only run
+// against it
+bool openedSimulator = false;
+
 int tryOpenACE(void) {
 	int tty = tryOpenSimulator();
+	openedSimulator = (tty != -1);
 	if (tty == -1) {
 		tty = tryOpenSerial();
 	}
@@ -63,7 +72,30 @@ int tryOpenACE(void) {
 	return tty;
 }
 
+// Real seconds per second of device time, for the emulator's virtual clock.
+// ACE_TIME_SCALE=0.03 runs 3 seconds of keepalive in 90 milliseconds. Times
+// and sleeps in the tests are in device time, this scales them to and from
+// real time. Leave it unset for a real ACE.
+double timeScale = 1.0;
+
+void readTimeScale(void) {
+	const char *scale = getenv("ACE_TIME_SCALE");
+	if (scale == NULL) {
+		return;
+	}
+	double value = strtod(scale, NULL);
+	if (value > 0) {
+		timeScale = value;
+	}
+}
+
+int scaleMilliseconds(int milliseconds) {
+	int scaled = milliseconds * timeScale;
+	return scaled > 0 ? scaled : 1;
+}
+
 void sleepMicroseconds(int microseconds) {
+	microseconds *= timeScale;
 	if (microseconds == 0) {
 		return;
 	}
@@ -89,7 +121,7 @@ int waitOpenACE(void) {
 ssize_t waitTTYClosed(int tty) {
 	ssize_t ret = 0;
 	ssize_t count = 0;
-	static char buf[1024];
+	char buf[1024];
 	do {
 		count = read(tty, &buf, sizeof(buf));
 		if (count > 0) {
@@ -122,7 +154,7 @@ int durationMicroseconds(struct timespec *start, struct timespec *end) {
 	int sec_delta_ms = sec_delta * 1000000;
 	int nsec_delta_ms = nsec_delta / 1000;
 	int duration = sec_delta_ms + nsec_delta_ms;
-	return duration;
+	return duration / timeScale;
 }
 
 int microsecondsEqual(int microseconds, int target, int error) {
@@ -193,19 +225,6 @@ void writeTTYData(int tty, ssize_t data_len, const unsigned char *data_buf,
 	}
 }
 
-int getTTYUnreadBytes(int tty) {
-	int unread;
-	int rc = ioctl(tty, FIONREAD, &unread);
-	if (rc != 0) {
-		if (errno == EIO) {
-			return -1;
-		}
-		fprintf(stdout, "Unable to get unread TTY bytes!\n");
-		abort();
-	}
-	return unread;
-}
-
 void testFrameHang(int size) {
 	fprintf(stdout, "Frame hang, size %i ", size);
 	fflush(stdout);
@@ -232,16 +251,20 @@ void testFrameHang(int size) {
 	int max_tries = 10000;
 	int total_bytes = 0;
 	int try = 0;
+	// Writes block while the ACE is behind, after each one give it a
+	// moment to answer before sending the next
+	int reply_ms = scaleMilliseconds(10);
 	for (try = 0; try < max_tries; ++try) {
 		ssize_t wrote = write(tty, status_buf, status_len);
 		total_bytes += (wrote > 0) ? wrote : 0;
-		int bytes_ready = getTTYUnreadBytes(tty);
-		if (wrote == -1 || bytes_ready == -1) {
+		struct pollfd pfd = {.fd = tty, .events = POLLIN};
+		int ready = poll(&pfd, 1, reply_ms);
+		bool hung_up = (pfd.revents & (POLLHUP | POLLERR));
+		if (wrote == -1 || ready == -1 || hung_up) {
 			// Keepalive timed out, reconnect
 			close(tty);
 			tty = waitOpenACE();
-		}
-		if (bytes_ready > 0) {
+		} else if (pfd.revents & POLLIN) {
 			total_bytes -= status_len;
 			break;
 		}
@@ -494,127 +517,40 @@ int json_count_keys(const char *json, int json_len, const char *field) {
 	return key_count;
 }
 
-// Calculates CRC-16/MCRF4XX
-int calc_crc(const unsigned char *data_buf, size_t data_len) {
-	int crc = 0xFFFF;
-
-	for (size_t i = 0; i < data_len; ++i) {
-		unsigned char byte = data_buf[i];
-		crc ^= byte;
-		for (int j = 0; j < 8; ++j) {
-			if (crc & 1) {
-				crc = (crc >> 1) ^ 0x8408;
-			} else {
-				crc = (crc >> 1);
-			}
-		}
-	}
-
-	return crc;
-}
-
-#define FRAME_OVERHEAD 7
-
-void writeFrame(
-	int tty, ssize_t payload_len, const unsigned char *payload_buf) {
-	static unsigned char frame_buf[1024];
-	size_t frame_len = payload_len + FRAME_OVERHEAD;
-	int checksum = calc_crc(payload_buf, payload_len);
-	if (frame_len > sizeof(frame_buf)) {
-		fprintf(stdout, "writeFrame buffer too larger\n");
-		abort();
-	}
-	unsigned char *header = frame_buf + 0;
-	unsigned char *payload = frame_buf + 4;
-	unsigned char *trailer = payload + payload_len;
-	header[0] = 0xFF;
-	header[1] = 0xAA;
-	header[2] = (payload_len & 0xFF);
-	header[3] = ((payload_len >> 8) & 0xFF);
-	trailer[0] = (checksum & 0xFF);
-	trailer[1] = ((checksum >> 8) & 0xFF);
-	trailer[2] = 0xFE;
-	memcpy(payload, payload_buf, payload_len);
-	writeTTYData(tty, frame_len, frame_buf, 0);
-}
-
-unsigned char *readFrame(int tty) {
-	// This function assumes a frame begins at the start of the buffer
-	// and that it's well-formed. Good enough for testing?
-	static unsigned char frame_buf[1024];
-	ssize_t read_count = read(tty, &frame_buf, 4);
-	if (read_count != 4) {
-		fprintf(stdout, "readFrame can't read TTY\n");
-		abort();
-	}
-	unsigned char *header = frame_buf + 0;
-	unsigned char *payload = frame_buf + 4;
-	if (header[0] != 0xFF || header[1] != 0xAA) {
-		fprintf(stdout, "readFrame invalid header\n");
-		abort();
-	}
-	unsigned int payload_len = (header[3] << 8) | header[2];
-	size_t read_amount = payload_len + FRAME_OVERHEAD;
-	size_t read_left = read_amount - read_count;
-	while (read_left != 0) {
-		unsigned char *buf_pos = frame_buf + read_amount - read_left;
-		read_count = read(tty, buf_pos, read_left);
-		read_left -= read_count;
-		if (read_count < 0) {
-			fprintf(stdout, "readFrame failed to read TTY\n");
-			abort();
-		}
-	}
-	unsigned char *trailer = payload + payload_len;
-	int read_checksum = (trailer[1] << 8) | trailer[0];
-	int checksum = calc_crc(payload, payload_len);
-	if (trailer[2] != 0xFE) {
-		fprintf(stdout, "readFrame invalid trailer\n");
-		abort();
-	}
-	if (checksum != read_checksum) {
-		fprintf(stdout, "readFrame invalid checksum\n");
-		abort();
-	}
-	memmove(frame_buf, payload, payload_len);
-	frame_buf[payload_len] = 0;
-	return frame_buf;
-}
-
-const char *doRPC(const char *frame) {
-	int tty = openTTYCatchLastCycle();
-	writeFrame(tty, strlen(frame), (const unsigned char *)frame);
-	progressDot();
-	const char *result = (const char *)readFrame(tty);
-	progressDot();
-	close(tty);
-	return result;
-}
+// Compiled once for all the ID tests
+struct rpcIDQuery {
+	struct query q;
+	int id_path;
+	struct jsonIndex idx;
+};
 
-bool testRPCID(int id) {
+bool testRPCID(struct session *s, struct rpcIDQuery *query, int id) {
 	fprintf(stdout, "Testing ID %i ", id);
 	fflush(stdout);
 
 	// Get status with a specific ID
-	char frame[128];
-	snprintf(frame, sizeof(frame), "{\"id\":%i,\"method\":\"get_status\"}",
-		id);
-	const char *result = doRPC(frame);
-	int result_len = strlen(result);
+	const char *result = session_call_id(s, id, "get_status", NULL);
 	progressDot();
+	if (result == NULL) {
+		fprintf(stdout, " ERROR: No response\n");
+		return false;
+	}
+	int result_len = strlen(result);
 
 	// Check the new value
+	struct queryValue id_match;
+	struct queryResult results[] = {{&id_match, 1, 0}};
 	double id_value;
-	int ret = mjson_get_number(result, result_len, "$.id", &id_value);
+	query_extract(&query->q, &query->idx, result, result_len, results);
+	bool found = query_number(&results[query->id_path], &id_value);
 	progressDot();
-	if (ret != 1) {
-		fprintf(stdout, " ERROR: No ID value, frame %s, result: %s\n",
-			frame, result);
+	if (!found) {
+		fprintf(stdout, " ERROR: No ID value, result: %s\n", result);
 		return false;
 	}
 	if ((int)id_value != id) {
-		fprintf(stdout, " ERROR: ID was %f, frame %s, result: %s\n",
-			id_value, frame, result);
+		fprintf(stdout, " ERROR: ID was %f, result: %s\n", id_value,
+			result);
 		return false;
 	}
 
@@ -632,42 +568,121 @@ int testIDs[] = {
 	101,
 };
 
-void testRPCIDs(void) {
+void testRPCIDs(struct session *s) {
+	static struct rpcIDQuery query;
 	fprintf(stdout, "-- RPC IDs TESTS --\n");
+	query_init(&query.q);
+	query.id_path = query_add(&query.q, "$.id");
 	for (size_t i = 0; i < ARRAY_SIZE(testIDs); ++i) {
 		int id = testIDs[i];
-		testRPCID(id);
+		testRPCID(s, &query, id);
+	}
+	const struct poolStats *stats = &s->p.pool.stats;
+	for (int i = 0; i < POOL_CLASS_COUNT; ++i) {
+		const struct poolClassStats *class = &stats->classes[i];
+		fprintf(stdout,
+			"Reply pool %zu byte blocks: %lu allocations, "
+			"%zu of %zu used at most\n",
+			class->size, class->allocs, class->high_water,
+			class->blocks);
+	}
+}
+
+bool testPollerCycle(struct session *s, int cycle) {
+	fprintf(stdout, "Poller cycle %i ", cycle);
+	fflush(stdout);
+	struct poller pl;
+	if (!poller_init(&pl, &s->p, NULL, NULL)) {
+		fprintf(stdout, " ERROR: Unable to start poller\n");
+		return false;
+	}
+	transport_set_keepalive(
+		&s->p.t, scaleMilliseconds(POLLER_KEEPALIVE_MS));
+	progressDot();
+
+	bool success = true;
+	const char *error = NULL;
+	if (cycle == 0) {
+		// Close with a poll in flight, its reply mustn't reach pl
+		int64_t deadline = pipeline_now_us() + POLLER_IDLE_MS * 2000LL;
+		while (!pl.polling && pipeline_now_us() < deadline) {
+			session_run(s, 10);
+		}
+		success = pl.polling;
+		error = "Never polled";
+	} else if (cycle == 1 && openedSimulator) {
+		// A ten second move, long enough for quick polls to see it
+		const char *params =
+			"{\"index\":0,\"length\":100,\"speed\":10}";
+		enum pollerResult result = poller_call_motion(&pl,
+			"feed_filament", params, 20000);
+		success = (result == POLLER_DONE);
+		error = (result == POLLER_NO_MOTION) ? "Motion never started"
+						     : "Motion didn't finish";
+	} else {
+		success = poller_await_idle(&pl, 5000);
+		error = "Never idle";
+	}
+	progressDot();
+	poller_close(&pl);
+	session_run(s, 100);
+	progressDot();
+
+	if (success) {
+		fprintf(stdout, " SUCCESS: %lu polls, %lu replies\n",
+			pl.stats.polls, pl.stats.replies);
+	} else {
+		fprintf(stdout, " ERROR: %s\n", error);
 	}
+	return success;
 }
 
-void printInfo(void) {
+void testPoller(struct session *s) {
+	fprintf(stdout, "-- POLLER TESTS --\n");
+	// More cycles than the transport has watches, so leaks show
+	for (int i = 0; i < TRANSPORT_MAX_WATCHES * 2; ++i) {
+		testPollerCycle(s, i);
+	}
+}
+
+void printInfo(struct session *s) {
 	fprintf(stdout, "-- TEST INFO --\n");
 	const char *result;
 
 	fprintf(stdout, "Test date: Write your info here\n");
 	fprintf(stdout, "ACE description: Write your info here\n");
 	fprintf(stdout, "Tests version: Write your info here\n");
+	fprintf(stdout, "CRC engine: %s\n", crc_select());
+	fprintf(stdout, "Time scale: %g\n", timeScale);
 
 	fprintf(stdout, "Getting ACE info ");
-	const char *frameInfo = "{\"id\":0,\"method\":\"get_info\"}";
-	result = doRPC(frameInfo);
-	fprintf(stdout, " %s\n", result);
+	result = session_call_id(s, 0, "get_info", NULL);
+	fprintf(stdout, " %s\n", result ? result : "ERROR: No response");
 
 	fprintf(stdout, "Getting filament info ");
-	const char *frameFilamentInfo =
-		"{\"id\":0,\"method\":\"get_filament_info\"}";
-	result = doRPC(frameFilamentInfo);
-	fprintf(stdout, " %s\n", result);
+	result = session_call_id(s, 0, "get_filament_info", NULL);
+	fprintf(stdout, " %s\n", result ? result : "ERROR: No response");
 
 	fprintf(stdout, "Getting status ");
-	const char *frameStatus = "{\"id\":0,\"method\":\"get_status\"}";
-	result = doRPC(frameStatus);
-	fprintf(stdout, " %s\n", result);
+	result = session_call_id(s, 0, "get_status", NULL);
+	fprintf(stdout, " %s\n", result ? result : "ERROR: No response");
 }
 
 int main(void) {
-	printInfo();
-	testRPCIDs();
+	readTimeScale();
+	struct session s;
+	if (!session_open(&s, tryOpenACE)) {
+		fprintf(stdout, "Unable to open ACE\n");
+		abort();
+	}
+	int keepalive_ms = scaleMilliseconds(TRANSPORT_KEEPALIVE_MS);
+	int reconnect_ms = scaleMilliseconds(TRANSPORT_RECONNECT_MS);
+	transport_set_keepalive(&s.p.t, keepalive_ms);
+	transport_set_reconnect(&s.p.t, reconnect_ms);
+	printInfo(&s);
+	testRPCIDs(&s);
+	testPoller(&s);
+	session_close(&s);
 	testFrames();
 	testHangs();
 	benchmarkFrames();
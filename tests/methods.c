@@ -0,0 +1,183 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#include <string.h>
+
+#include "crc.h"
+#include "methods.h"
+
+// Constant text with its CRC from zero and the shift that skips over it,
+// worked out by methods_init
+struct methodPiece {
+	const char *text;
+	size_t len;
+	uint16_t crc;
+	struct crcShift shift;
+};
+
+#define METHOD_PIECE(x) {x, sizeof(x) - 1, 0, {{{0}}}}
+
+struct methodWriter {
+	struct encoder *enc;
+	unsigned char *pos;
+	uint16_t crc;
+	bool has_params;
+};
+
+static struct methodPiece method_open = METHOD_PIECE("{\"id\":");
+static struct methodPiece method_params = METHOD_PIECE(",\"params\":{");
+static struct methodPiece method_comma = METHOD_PIECE(",");
+static struct methodPiece method_close = METHOD_PIECE("}");
+
+// Each method's name followed by its keys in order
+
+#define NEW_METHOD(name, result_type, schema)                     \
+	static struct methodPiece method_pieces_##name[] = {      \
+		METHOD_PIECE(",\"method\":\"" #name "\""),
+#define PARAM(key) METHOD_PIECE("\"" #key "\":"),
+#define END_METHOD() \
+	}            \
+	;
+
+#include "methods.inc"
+
+#undef NEW_METHOD
+#undef PARAM
+#undef END_METHOD
+
+static void method_piece_init(struct methodPiece *piece) {
+	piece->crc = crc_update(0, (const unsigned char *)piece->text,
+		piece->len);
+	crc_shift_init(&piece->shift, piece->len);
+}
+
+static void method_pieces_init(struct methodPiece *pieces, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		method_piece_init(&pieces[i]);
+	}
+}
+
+void methods_init(void) {
+	// Picks the CRC engine now too, rather than on first use
+	crc_select();
+	method_piece_init(&method_open);
+	method_piece_init(&method_params);
+	method_piece_init(&method_comma);
+	method_piece_init(&method_close);
+#define NEW_METHOD(name, result_type, schema)                  \
+	method_pieces_init(method_pieces_##name,               \
+		sizeof(method_pieces_##name) /                 \
+			sizeof(*method_pieces_##name));
+#define PARAM(key)
+#define END_METHOD()
+#include "methods.inc"
+#undef NEW_METHOD
+#undef PARAM
+#undef END_METHOD
+}
+
+static void method_piece(
+	struct methodWriter *w, const struct methodPiece *piece) {
+	memcpy(w->pos, piece->text, piece->len);
+	w->pos += piece->len;
+	w->crc = crc_shift(&piece->shift, w->crc) ^ piece->crc;
+}
+
+static void method_int(struct methodWriter *w, int value) {
+	size_t len = encoder_int(w->pos, value);
+	w->crc = crc_update(w->crc, w->pos, len);
+	w->pos += len;
+}
+
+static void method_begin(struct methodWriter *w, struct encoder *enc, int id,
+	const struct methodPiece *name) {
+	w->enc = enc;
+	w->pos = encoder_payload(enc);
+	w->crc = crc_init();
+	w->has_params = false;
+	method_piece(w, &method_open);
+	method_int(w, id);
+	method_piece(w, name);
+}
+
+static void method_param(
+	struct methodWriter *w, const struct methodPiece *key, int value) {
+	method_piece(w, w->has_params ? &method_comma : &method_params);
+	w->has_params = true;
+	method_piece(w, key);
+	method_int(w, value);
+}
+
+static size_t method_finish(struct methodWriter *w) {
+	if (w->has_params) {
+		method_piece(w, &method_close);
+	}
+	method_piece(w, &method_close);
+	struct encoder *enc = w->enc;
+	unsigned char *payload = encoder_payload(enc);
+	size_t payload_len = w->pos - payload;
+	encoder_header(enc->buf, payload_len);
+	encoder_trailer(w->pos, crc_finish(w->crc));
+	size_t frame_len = payload_len + ENCODER_OVERHEAD;
+	if (!encoder_collides(enc->buf, frame_len)) {
+		return frame_len;
+	}
+	// Let the encoder pad it, going over the whole payload again
+	enc->payload_len = payload_len;
+	enc->crc_len = 0;
+	enc->crc = crc_init();
+	enc->overflow = false;
+	return encoder_finish(enc);
+}
+
+// Frames are checked to fit with the longest ints and every key at once
+
+#define NEW_METHOD(name, result_type, schema) \
+	_Static_assert(ENCODER_OVERHEAD + ENCODER_INT_LEN + \
+			sizeof("{\"id\":,\"method\":\"" #name \
+			       "\",\"params\":{}}") - 1
+#define PARAM(key) + sizeof(",\"" #key "\":") - 1 + ENCODER_INT_LEN
+#define END_METHOD() \
+	<= ENCODER_MAX_FRAME, "Method frame may not fit");
+
+#include "methods.inc"
+
+#undef NEW_METHOD
+#undef PARAM
+#undef END_METHOD
+
+#define NEW_METHOD(name, result_type, schema)                              \
+	bool method_decode_##name(const char *payload, size_t payload_len, \
+		result_type *result, struct schemaReply *reply) {          \
+		return schema_parse(                                       \
+			payload, payload_len, &schema, result, reply);     \
+	}                                                                  \
+                                                                           \
+	static size_t method_encode_any_##name(                            \
+		struct encoder *enc, int id, const void *params) {         \
+		(void)id;                                                  \
+		return method_encode_##name(enc, params);                  \
+	}                                                                  \
+                                                                           \
+	bool method_call_##name(struct pipeline *p,                        \
+		const struct method_##name *req, pipeline_reply_fn fn,     \
+		void *data) {                                              \
+		return pipeline_call_encoded(p, req->id, #name,            \
+			method_encode_any_##name, req, fn, data);          \
+	}                                                                  \
+                                                                           \
+	size_t method_encode_##name(                                       \
+		struct encoder *enc, const struct method_##name *req) {    \
+		const struct methodPiece *piece = method_pieces_##name;    \
+		struct methodWriter w;                                     \
+		method_begin(&w, enc, req->id, piece++);
+#define PARAM(key) method_param(&w, piece++, req->key);
+#define END_METHOD()                    \
+	return method_finish(&w); \
+	}
+
+#include "methods.inc"
+
+#undef NEW_METHOD
+#undef PARAM
+#undef END_METHOD
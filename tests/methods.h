@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#ifndef METHODS_H
+#define METHODS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "encoder.h"
+#include "pipeline.h"
+#include "schema.h"
+#include "status.h"
+
+// Typed requests for every method in methods.inc. Each method gets a struct
+// with the request id and its params, plus:
+//
+//   size_t method_encode_feed_filament(struct encoder *enc,
+//           const struct method_feed_filament *req);
+//   bool method_call_feed_filament(struct pipeline *p,
+//           const struct method_feed_filament *req,
+//           pipeline_reply_fn fn, void *data);
+//   bool method_decode_feed_filament(const char *payload,
+//           size_t payload_len, struct schemaEmpty *result,
+//           struct schemaReply *reply);
+//
+// Encoding copies the constant JSON around the integers and skips the CRC
+// over it, so only the digits are formatted and run through the CRC. The
+// encoder returns the frame length like encoder_finish does, padding the
+// frame if it has FF AA in it.
+//
+// The CRCs of the constant JSON are worked out by methods_init, which has to
+// be called once before anything is encoded and before other threads start.
+
+#define NEW_METHOD(name, result_type, schema) \
+	struct method_##name {                \
+		int id;
+#define PARAM(key) int key;
+#define END_METHOD() \
+	}            \
+	;
+
+#include "methods.inc"
+
+#undef NEW_METHOD
+#undef PARAM
+#undef END_METHOD
+
+void methods_init(void);
+
+#define NEW_METHOD(name, result_type, schema)                             \
+	size_t method_encode_##name(                                      \
+		struct encoder *enc, const struct method_##name *req);    \
+	bool method_call_##name(struct pipeline *p,                       \
+		const struct method_##name *req, pipeline_reply_fn fn,    \
+		void *data);                                              \
+	bool method_decode_##name(const char *payload,                    \
+		size_t payload_len, result_type *result,                  \
+		struct schemaReply *reply);
+#define PARAM(key)
+#define END_METHOD()
+
+#include "methods.inc"
+
+#undef NEW_METHOD
+#undef PARAM
+#undef END_METHOD
+
+#endif
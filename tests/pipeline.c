@@ -0,0 +1,579 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#define _POSIX_C_SOURCE 199309L
+#define _DEFAULT_SOURCE
+
+#include <limits.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mjson.h"
+#include "pipeline.h"
+
+// Starting guesses for reply frame lengths, from the emulator
+static const struct pipelineGuess {
+	const char *name;
+	size_t reply_len;
+} pipeline_guesses[] = {
+	{"get_status", 576},
+	{"get_filament_info", 384},
+	{"get_info", 192},
+};
+
+int64_t pipeline_now_us(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int pipeline_find_method(struct pipeline *p, const char *method) {
+	for (size_t i = 0; i < p->method_count; ++i) {
+		if (strcmp(p->methods[i].name, method) == 0) {
+			return i;
+		}
+	}
+	if (p->method_count == PIPELINE_MAX_METHODS ||
+		strlen(method) >= PIPELINE_METHOD_LEN) {
+		return -1;
+	}
+	struct pipelineMethod *entry = &p->methods[p->method_count];
+	strcpy(entry->name, method);
+	entry->reply_len = PIPELINE_DEFAULT_REPLY_LEN;
+	entry->templated = template_init(&entry->request, method, NULL);
+	size_t guess_count =
+		sizeof(pipeline_guesses) / sizeof(*pipeline_guesses);
+	for (size_t i = 0; i < guess_count; ++i) {
+		if (strcmp(pipeline_guesses[i].name, method) == 0) {
+			entry->reply_len = pipeline_guesses[i].reply_len;
+		}
+	}
+	return p->method_count++;
+}
+
+static size_t pipeline_reply_len(const struct pipeline *p, int method) {
+	if (method == -1) {
+		return PIPELINE_DEFAULT_REPLY_LEN;
+	}
+	return p->methods[method].reply_len;
+}
+
+static void pipeline_learn_reply_len(
+	struct pipeline *p, int method, size_t frame_len) {
+	if (method != -1 && p->methods[method].reply_len < frame_len) {
+		p->methods[method].reply_len = frame_len;
+	}
+}
+
+static void pipeline_forget_id(struct pipeline *p, int id) {
+	struct idtableEntry *entry = idtable_find(&p->ids, id);
+	if (entry != NULL) {
+		idtable_remove(&p->ids, entry);
+	}
+}
+
+// Drops timed out ids that expire by limit_us
+static void pipeline_purge_late(struct pipeline *p, int64_t limit_us) {
+	int ids[IDTABLE_SIZE];
+	size_t count = 0;
+	for (size_t i = 0; i < IDTABLE_SIZE; ++i) {
+		struct idtableEntry *entry = &p->ids.entries[i];
+		if (entry->used && entry->value == -1 &&
+			entry->expires_us <= limit_us) {
+			ids[count++] = entry->id;
+		}
+	}
+	for (size_t i = 0; i < count; ++i) {
+		pipeline_forget_id(p, ids[i]);
+	}
+}
+
+static void pipeline_remove(int *list, size_t *count, size_t index) {
+	memmove(&list[index], &list[index + 1],
+		(*count - index - 1) * sizeof(*list));
+	*count -= 1;
+}
+
+static void pipeline_arm_timeout(struct pipeline *p) {
+	struct itimerspec spec = {0};
+	if (p->in_flight_count != 0) {
+		struct pipelineRequest *req = &p->requests[p->in_flight[0]];
+		int64_t left_us = req->deadline_us - pipeline_now_us();
+		if (left_us < 1) {
+			left_us = 1;
+		}
+		spec.it_value.tv_sec = left_us / 1000000;
+		spec.it_value.tv_nsec = (left_us % 1000000) * 1000;
+	}
+	timerfd_settime(p->timeout_fd, 0, &spec, NULL);
+}
+
+// Frees the slot before calling back so the callback can queue another call.
+// The id is left for the caller to deal with.
+static void pipeline_complete(struct pipeline *p, int slot,
+	const char *payload, size_t payload_len) {
+	struct pipelineRequest *req = &p->requests[slot];
+	pipeline_reply_fn fn = req->fn;
+	void *data = req->data;
+	int id = req->id;
+	p->free_slots[p->free_count++] = slot;
+	if (payload == NULL) {
+		p->stats.failed += 1;
+	} else {
+		p->stats.completed += 1;
+	}
+	if (fn) {
+		fn(data, id, payload, payload_len);
+	}
+}
+
+static void pipeline_pump(struct pipeline *p) {
+	while (p->queued_count != 0 && transport_connected(&p->t)) {
+		int slot = p->queued[0];
+		struct pipelineRequest *req = &p->requests[slot];
+		req->cost = req->frame_len + pipeline_reply_len(p, req->method);
+		bool fits = (p->credit + req->cost <= p->window);
+		if (p->in_flight_count != 0 && !fits) {
+			p->stats.window_stalls += 1;
+			break;
+		}
+		if (!transport_send(&p->t, req->enc.buf, req->frame_len)) {
+			// Out of room, drained will pump again
+			break;
+		}
+		pipeline_remove(p->queued, &p->queued_count, 0);
+		req->sent = true;
+		req->deadline_us = pipeline_now_us() +
+			PIPELINE_REPLY_TIMEOUT_MS * 1000LL;
+		p->in_flight[p->in_flight_count++] = slot;
+		p->credit += req->cost;
+		if (p->in_flight_count == 1) {
+			pipeline_arm_timeout(p);
+		}
+		if (p->stats.max_in_flight < p->in_flight_count) {
+			p->stats.max_in_flight = p->in_flight_count;
+		}
+		if (p->stats.max_credit < p->credit) {
+			p->stats.max_credit = p->credit;
+		}
+	}
+}
+
+// Only ids that a request could have been sent with count
+static bool pipeline_reply_id(const struct decoderFrame *frame, int *id) {
+	const char *payload = (const char *)frame->payload;
+	double reply_id = 0;
+	if (mjson_get_number(payload, frame->payload_len, "$.id",
+		    &reply_id) != 1) {
+		return false;
+	}
+	// Written so NaN fails too
+	if (!(reply_id >= INT_MIN && reply_id <= INT_MAX)) {
+		return false;
+	}
+	*id = (int)reply_id;
+	return (*id == reply_id);
+}
+
+static void pipeline_on_frame(void *data, const struct decoderFrame *frame) {
+	struct pipeline *p = data;
+	int id;
+	struct idtableEntry *entry = NULL;
+	if (pipeline_reply_id(frame, &id)) {
+		entry = idtable_find(&p->ids, id);
+	}
+	if (entry != NULL && entry->value == -1) {
+		p->stats.late_replies += 1;
+		idtable_remove(&p->ids, entry);
+		return;
+	}
+	int slot = (entry != NULL) ? entry->value : -1;
+	if (slot == -1 || !p->requests[slot].sent) {
+		// Left over from an earlier connection or not a reply at all
+		p->stats.stale_frames += 1;
+		return;
+	}
+	idtable_remove(&p->ids, entry);
+	size_t index = 0;
+	while (p->in_flight[index] != slot) {
+		index += 1;
+	}
+	struct pipelineRequest *req = &p->requests[slot];
+	p->credit -= req->cost;
+	pipeline_learn_reply_len(
+		p, req->method, frame->payload_len + ENCODER_OVERHEAD);
+	pipeline_remove(p->in_flight, &p->in_flight_count, index);
+	if (index == 0) {
+		pipeline_arm_timeout(p);
+	}
+	pipeline_complete(p, slot, (const char *)frame->payload,
+		frame->payload_len);
+	pipeline_pump(p);
+}
+
+static void pipeline_on_timeout(void *data) {
+	struct pipeline *p = data;
+	uint64_t expirations;
+	ssize_t ret = read(p->timeout_fd, &expirations, sizeof(expirations));
+	(void)ret;
+	int64_t now = pipeline_now_us();
+	while (p->in_flight_count != 0) {
+		int slot = p->in_flight[0];
+		struct pipelineRequest *req = &p->requests[slot];
+		if (req->deadline_us > now) {
+			break;
+		}
+		p->credit -= req->cost;
+		p->stats.timeouts += 1;
+		// Keep the id around for a while to catch a late reply
+		struct idtableEntry *entry = idtable_find(&p->ids, req->id);
+		if (entry != NULL) {
+			entry->value = -1;
+			entry->expires_us = now + PIPELINE_LATE_MS * 1000LL;
+		}
+		pipeline_remove(p->in_flight, &p->in_flight_count, 0);
+		pipeline_complete(p, slot, NULL, 0);
+	}
+	pipeline_arm_timeout(p);
+	pipeline_pump(p);
+}
+
+static void pipeline_on_disconnected(void *data) {
+	struct pipeline *p = data;
+	// Whatever was in flight is lost, put it back in front of the queue
+	int failed[PIPELINE_MAX_REQUESTS];
+	size_t failed_count = 0;
+	int queued[PIPELINE_MAX_REQUESTS];
+	size_t queued_count = 0;
+	for (size_t i = 0; i < p->in_flight_count; ++i) {
+		int slot = p->in_flight[i];
+		struct pipelineRequest *req = &p->requests[slot];
+		req->sent = false;
+		if (req->retries == PIPELINE_MAX_RETRIES) {
+			pipeline_forget_id(p, req->id);
+			failed[failed_count++] = slot;
+		} else {
+			req->retries += 1;
+			p->stats.retries += 1;
+			queued[queued_count++] = slot;
+		}
+	}
+	memcpy(&queued[queued_count], p->queued,
+		p->queued_count * sizeof(*queued));
+	queued_count += p->queued_count;
+	memcpy(p->queued, queued, queued_count * sizeof(*queued));
+	p->queued_count = queued_count;
+	p->in_flight_count = 0;
+	p->credit = 0;
+	pipeline_arm_timeout(p);
+	// Replies to timed out requests went with the connection
+	pipeline_purge_late(p, INT64_MAX);
+	for (size_t i = 0; i < failed_count; ++i) {
+		pipeline_complete(p, failed[i], NULL, 0);
+	}
+}
+
+static void pipeline_on_connected(void *data) {
+	pipeline_pump(data);
+}
+
+static void pipeline_on_drained(void *data) {
+	pipeline_pump(data);
+}
+
+static void pipeline_on_status(
+	void *data, int id, const char *payload, size_t payload_len) {
+	struct pipeline *p = data;
+	if (p->status_fn) {
+		p->status_fn(p->status_data, id, payload, payload_len);
+	}
+}
+
+static void pipeline_on_keepalive(void *data) {
+	struct pipeline *p = data;
+	// Anything queued is about to be sent and will do the job itself
+	if (p->queued_count != 0) {
+		return;
+	}
+	if (pipeline_call(p, "get_status", NULL, pipeline_on_status, p) != -1) {
+		p->stats.keepalives += 1;
+	}
+}
+
+static const struct transportCallbacks pipeline_callbacks = {
+	.frame = pipeline_on_frame,
+	.connected = pipeline_on_connected,
+	.disconnected = pipeline_on_disconnected,
+	.keepalive = pipeline_on_keepalive,
+	.drained = pipeline_on_drained,
+};
+
+bool pipeline_init(struct pipeline *p, int (*open_tty)(void)) {
+	p->window = PIPELINE_WINDOW;
+	p->credit = 0;
+	p->next_id = 0;
+	p->free_count = 0;
+	for (int slot = PIPELINE_MAX_REQUESTS - 1; slot >= 0; --slot) {
+		p->free_slots[p->free_count++] = slot;
+		encoder_init(&p->requests[slot].enc);
+	}
+	p->queued_count = 0;
+	p->in_flight_count = 0;
+	p->method_count = 0;
+	idtable_init(&p->ids);
+	p->status_fn = NULL;
+	p->status_data = NULL;
+	memset(&p->stats, 0, sizeof(p->stats));
+	if (!pool_init(&p->pool)) {
+		return false;
+	}
+	p->timeout_fd = timerfd_create(
+		CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (p->timeout_fd == -1) {
+		pool_close(&p->pool);
+		return false;
+	}
+	if (!transport_init(&p->t, open_tty, &pipeline_callbacks, p)) {
+		close(p->timeout_fd);
+		pool_close(&p->pool);
+		return false;
+	}
+	if (!transport_watch(&p->t, p->timeout_fd, pipeline_on_timeout, p)) {
+		pipeline_close(p);
+		return false;
+	}
+	return true;
+}
+
+void pipeline_close(struct pipeline *p) {
+	transport_close(&p->t);
+	close(p->timeout_fd);
+	p->timeout_fd = -1;
+	pool_close(&p->pool);
+}
+
+void pipeline_set_window(struct pipeline *p, size_t window) {
+	p->window = window;
+	pipeline_pump(p);
+}
+
+// Finds a slot for a call with an id, or -1 if the id is taken or there's
+// no room. The slot isn't taken until pipeline_submit.
+static int pipeline_claim(struct pipeline *p, int id) {
+	struct idtableEntry *entry = idtable_find(&p->ids, id);
+	if (entry != NULL && entry->value == -1 &&
+		entry->expires_us <= pipeline_now_us()) {
+		idtable_remove(&p->ids, entry);
+		entry = NULL;
+	}
+	if (entry != NULL) {
+		p->stats.id_collisions += 1;
+		return -1;
+	}
+	if (p->free_count == 0) {
+		return -1;
+	}
+	return p->free_slots[p->free_count - 1];
+}
+
+// Queues the claimed slot once its frame is built
+static void pipeline_submit(struct pipeline *p, int slot, int id,
+	int method_num, pipeline_reply_fn fn, void *data) {
+	struct pipelineRequest *req = &p->requests[slot];
+	if (idtable_insert(&p->ids, id, slot) == NULL) {
+		// Full of timed out ids, give up on catching their replies
+		pipeline_purge_late(p, INT64_MAX);
+		idtable_insert(&p->ids, id, slot);
+	}
+	p->free_count -= 1;
+	req->id = id;
+	req->method = method_num;
+	req->retries = 0;
+	req->sent = false;
+	req->fn = fn;
+	req->data = data;
+	p->queued[p->queued_count++] = slot;
+	p->stats.submitted += 1;
+	pipeline_pump(p);
+}
+
+bool pipeline_call_id(struct pipeline *p, int id, const char *method,
+	const char *params, pipeline_reply_fn fn, void *data) {
+	int slot = pipeline_claim(p, id);
+	if (slot == -1) {
+		return false;
+	}
+	struct pipelineRequest *req = &p->requests[slot];
+	struct encoder *enc = &req->enc;
+	int method_num = pipeline_find_method(p, method);
+	req->frame_len = 0;
+	if (params == NULL && method_num != -1 &&
+		p->methods[method_num].templated) {
+		// Falls back to the encoder if the frame needs padding
+		req->frame_len = template_render(
+			&p->methods[method_num].request, id, enc->buf);
+		p->stats.templated_frames += (req->frame_len != 0);
+	}
+	if (req->frame_len == 0) {
+		encoder_begin(enc);
+		if (params == NULL) {
+			mjson_printf(encoder_print, enc, "{%Q:%d,%Q:%Q}",
+				"id", id, "method", method);
+		} else {
+			mjson_printf(encoder_print, enc,
+				"{%Q:%d,%Q:%Q,%Q:%s}", "id", id, "method",
+				method, "params", params);
+		}
+		req->frame_len = encoder_finish(enc);
+	}
+	if (req->frame_len == 0) {
+		return false;
+	}
+	pipeline_submit(p, slot, id, method_num, fn, data);
+	return true;
+}
+
+bool pipeline_call_encoded(struct pipeline *p, int id, const char *method,
+	pipeline_encode_fn encode, const void *params, pipeline_reply_fn fn,
+	void *data) {
+	int slot = pipeline_claim(p, id);
+	if (slot == -1) {
+		return false;
+	}
+	struct pipelineRequest *req = &p->requests[slot];
+	req->frame_len = encode(&req->enc, id, params);
+	if (req->frame_len == 0) {
+		return false;
+	}
+	pipeline_submit(p, slot, id, pipeline_find_method(p, method), fn,
+		data);
+	return true;
+}
+
+int pipeline_next_id(struct pipeline *p) {
+	int id;
+	do {
+		id = p->next_id;
+		p->next_id = (p->next_id + 1) & INT32_MAX;
+		if (p->next_id == 0) {
+			p->stats.id_wraps += 1;
+		}
+	} while (idtable_find(&p->ids, id) != NULL);
+	return id;
+}
+
+int pipeline_call(struct pipeline *p, const char *method, const char *params,
+	pipeline_reply_fn fn, void *data) {
+	int id = pipeline_next_id(p);
+	if (!pipeline_call_id(p, id, method, params, fn, data)) {
+		return -1;
+	}
+	return id;
+}
+
+static void pipeline_on_future(
+	void *data, int id, const char *payload, size_t payload_len) {
+	struct pipelineFuture *future = data;
+	future->done = true;
+	future->id = id;
+	future->payload = payload;
+	future->payload_len = payload_len;
+	if (payload != NULL &&
+		pool_copy(future->pool, payload, payload_len, &future->view)) {
+		future->payload = future->view.data;
+	}
+}
+
+bool pipeline_call_id_future(struct pipeline *p, int id, const char *method,
+	const char *params, struct pipelineFuture *future) {
+	future->done = false;
+	future->id = id;
+	future->payload = NULL;
+	future->payload_len = 0;
+	future->pool = &p->pool;
+	future->view = (struct poolView){NULL, NULL, 0};
+	return pipeline_call_id(
+		p, id, method, params, pipeline_on_future, future);
+}
+
+void pipeline_release_future(
+	struct pipeline *p, struct pipelineFuture *future) {
+	if (future->done) {
+		pool_view_release(&future->view);
+		future->payload = NULL;
+		future->payload_len = 0;
+		return;
+	}
+	pipeline_detach(p, future->id, pipeline_on_future, future);
+}
+
+void pipeline_detach(
+	struct pipeline *p, int id, pipeline_reply_fn fn, void *data) {
+	struct idtableEntry *entry = idtable_find(&p->ids, id);
+	if (entry != NULL && entry->value != -1) {
+		struct pipelineRequest *req = &p->requests[entry->value];
+		if (req->fn == fn && req->data == data) {
+			req->fn = NULL;
+		}
+	}
+}
+
+bool pipeline_call_future(struct pipeline *p, const char *method,
+	const char *params, struct pipelineFuture *future) {
+	return pipeline_call_id_future(
+		p, pipeline_next_id(p), method, params, future);
+}
+
+bool pipeline_wait(
+	struct pipeline *p, struct pipelineFuture *future, int timeout_ms) {
+	int64_t deadline = pipeline_now_us() + timeout_ms * 1000LL;
+	while (!future->done) {
+		int left_ms = -1;
+		if (timeout_ms != -1) {
+			int64_t left_us = deadline - pipeline_now_us();
+			if (left_us <= 0) {
+				break;
+			}
+			left_ms = (left_us + 999) / 1000;
+		}
+		if (pipeline_run(p, left_ms) == -1) {
+			break;
+		}
+	}
+	return future->done;
+}
+
+void pipeline_cancel(struct pipeline *p) {
+	int slots[PIPELINE_MAX_REQUESTS];
+	size_t count = 0;
+	for (size_t i = 0; i < p->in_flight_count; ++i) {
+		slots[count++] = p->in_flight[i];
+	}
+	for (size_t i = 0; i < p->queued_count; ++i) {
+		slots[count++] = p->queued[i];
+	}
+	p->in_flight_count = 0;
+	p->queued_count = 0;
+	p->credit = 0;
+	pipeline_arm_timeout(p);
+	for (size_t i = 0; i < count; ++i) {
+		pipeline_forget_id(p, p->requests[slots[i]].id);
+	}
+	for (size_t i = 0; i < count; ++i) {
+		pipeline_complete(p, slots[i], NULL, 0);
+	}
+}
+
+size_t pipeline_queued(const struct pipeline *p) {
+	return p->queued_count;
+}
+
+size_t pipeline_in_flight(const struct pipeline *p) {
+	return p->in_flight_count;
+}
+
+int pipeline_run(struct pipeline *p, int timeout_ms) {
+	return transport_run(&p->t, timeout_ms);
+}
@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "encoder.h"
+#include "idtable.h"
+#include "pool.h"
+#include "template.h"
+#include "transport.h"
+
+// Keeps several requests in flight on one transport without overrunning the
+// ACE. It seems to share a single buffer of around 1024 bytes between input
+// and output, so each request costs its frame length plus the expected length
+// of its reply until that reply arrives. Requests are sent in order while the
+// total cost fits in the window, the rest wait in a queue. A single request is
+// always allowed so nothing larger than the window gets stuck.
+//
+// Expected reply lengths start from a guess per method and grow to the
+// largest reply seen. Requests in flight when the ACE drops the connection are
+// resent once it's back, up to PIPELINE_MAX_RETRIES times.
+//
+// Replies are matched to requests by id through a hash table, so they can
+// arrive in any order. An id can't be reused while its request is outstanding,
+// or for PIPELINE_LATE_MS after it timed out in case the reply turns up late
+// and gets mistaken for the new request's. Automatic ids skip over ids that
+// are still taken after they wrap around.
+
+#define PIPELINE_WINDOW 1024
+#define PIPELINE_MAX_REQUESTS 32
+#define PIPELINE_MAX_METHODS 16
+#define PIPELINE_METHOD_LEN 32
+#define PIPELINE_DEFAULT_REPLY_LEN 128
+#define PIPELINE_REPLY_TIMEOUT_MS 1000
+#define PIPELINE_MAX_RETRIES 1
+#define PIPELINE_LATE_MS 3000
+
+// Called once per request. On failure payload is NULL, otherwise it's the
+// NUL terminated reply, valid until the next pipeline_run.
+typedef void (*pipeline_reply_fn)(
+	void *data, int id, const char *payload, size_t payload_len);
+
+struct pipelineRequest {
+	struct encoder enc;
+	size_t frame_len;
+	size_t cost;
+	int id;
+	int method;
+	int retries;
+	bool sent;
+	int64_t deadline_us;
+	pipeline_reply_fn fn;
+	void *data;
+};
+
+struct pipelineMethod {
+	char name[PIPELINE_METHOD_LEN];
+	size_t reply_len;
+	// Prebuilt frame for calls without params
+	struct requestTemplate request;
+	bool templated;
+};
+
+struct pipelineStats {
+	unsigned long submitted;
+	unsigned long completed;
+	unsigned long failed;
+	unsigned long timeouts;
+	unsigned long retries;
+	unsigned long stale_frames;
+	unsigned long keepalives;
+	unsigned long window_stalls;
+	unsigned long late_replies;
+	unsigned long id_collisions;
+	unsigned long id_wraps;
+	unsigned long templated_frames;
+	size_t max_in_flight;
+	size_t max_credit;
+};
+
+struct pipeline {
+	struct transport t;
+	int timeout_fd;
+	size_t window;
+	size_t credit;
+	int next_id;
+	struct pipelineRequest requests[PIPELINE_MAX_REQUESTS];
+	int free_slots[PIPELINE_MAX_REQUESTS];
+	size_t free_count;
+	// Slot indexes in the order they were queued and sent
+	int queued[PIPELINE_MAX_REQUESTS];
+	size_t queued_count;
+	int in_flight[PIPELINE_MAX_REQUESTS];
+	size_t in_flight_count;
+	// Outstanding ids to slots, and recently timed out ids to -1
+	struct idtable ids;
+	struct pipelineMethod methods[PIPELINE_MAX_METHODS];
+	size_t method_count;
+	// Gets the replies to keepalive get_status requests, may be NULL
+	pipeline_reply_fn status_fn;
+	void *status_data;
+	// Replies handed to futures are copied in to here
+	struct pool pool;
+	struct pipelineStats stats;
+};
+
+// Sets up the transport, see transport_init
+bool pipeline_init(struct pipeline *p, int (*open_tty)(void));
+void pipeline_close(struct pipeline *p);
+
+// Sets the credit window in bytes, PIPELINE_WINDOW by default
+void pipeline_set_window(struct pipeline *p, size_t window);
+
+// Queues a call, params is a JSON object or NULL. Returns the request id, or
+// -1 if the queue is full or the request doesn't fit in a frame.
+int pipeline_call(struct pipeline *p, const char *method, const char *params,
+	pipeline_reply_fn fn, void *data);
+
+// Takes the next automatic id that isn't in use
+int pipeline_next_id(struct pipeline *p);
+
+// Same as pipeline_call with a given id, which may be any int. Returns false
+// on failure, including when the id is taken.
+bool pipeline_call_id(struct pipeline *p, int id, const char *method,
+	const char *params, pipeline_reply_fn fn, void *data);
+
+// Builds a request's frame in to enc, returning the frame length or 0
+typedef size_t (*pipeline_encode_fn)(
+	struct encoder *enc, int id, const void *params);
+
+// Like pipeline_call_id but the frame is built by encode, such as one of the
+// method_encode functions from methods.h
+bool pipeline_call_encoded(struct pipeline *p, int id, const char *method,
+	pipeline_encode_fn encode, const void *params, pipeline_reply_fn fn,
+	void *data);
+
+// A reply to wait for instead of using a callback. The payload is kept in
+// view, which holds a reference to a pool block so it stays valid until the
+// future is released, or shares it with pool_view_share to keep it longer.
+// If the pool has run out the view is empty and the payload is only valid
+// until the next pipeline_run.
+struct pipelineFuture {
+	bool done;
+	int id;
+	const char *payload;
+	size_t payload_len;
+	struct pool *pool;
+	struct poolView view;
+};
+
+// Queues a call that completes future, returning false on failure
+bool pipeline_call_future(struct pipeline *p, const char *method,
+	const char *params, struct pipelineFuture *future);
+bool pipeline_call_id_future(struct pipeline *p, int id, const char *method,
+	const char *params, struct pipelineFuture *future);
+
+// Runs the loop until future is done or timeout_ms passes, -1 waits forever.
+// Returns future->done.
+bool pipeline_wait(
+	struct pipeline *p, struct pipelineFuture *future, int timeout_ms);
+
+// Drops the future's reply, or stops it being completed if it's still
+// waiting. Must be called before the future goes away.
+void pipeline_release_future(
+	struct pipeline *p, struct pipelineFuture *future);
+
+// Stops a call's fn being called if it's still outstanding with data
+void pipeline_detach(
+	struct pipeline *p, int id, pipeline_reply_fn fn, void *data);
+
+// Fails everything queued or in flight
+void pipeline_cancel(struct pipeline *p);
+
+size_t pipeline_queued(const struct pipeline *p);
+size_t pipeline_in_flight(const struct pipeline *p);
+
+// Requests queued or in flight
+static inline size_t pipeline_outstanding(const struct pipeline *p) {
+	return p->queued_count + p->in_flight_count;
+}
+
+// Handles events for up to timeout_ms, see transport_run
+int pipeline_run(struct pipeline *p, int timeout_ms);
+
+// Monotonic time in microseconds
+int64_t pipeline_now_us(void);
+
+#endif
@@ -0,0 +1,223 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "mjson.h"
+#include "poller.h"
+
+static bool poller_is_moving(const struct statusState *state) {
+	static const char *const actions[] = {
+		"feeding", "unwinding", "shifting"};
+	if (strcmp(state->status, "busy") == 0) {
+		return true;
+	}
+	for (size_t i = 0; i < sizeof(actions) / sizeof(*actions); ++i) {
+		if (strcmp(state->action, actions[i]) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int poller_pick_interval(const struct poller *pl) {
+	if (pl->moving || pl->awaiting != 0) {
+		return POLLER_MOVING_MS;
+	} else if (strcmp(pl->cache.state.dryer.status, "drying") == 0) {
+		return POLLER_DRYING_MS;
+	}
+	return POLLER_IDLE_MS;
+}
+
+static void poller_update_interval(struct poller *pl) {
+	int interval_ms = poller_pick_interval(pl);
+	if (interval_ms == pl->interval_ms) {
+		return;
+	}
+	pl->interval_ms = interval_ms;
+	pl->stats.interval_changes += 1;
+	long interval_ns = interval_ms * 1000000L;
+	struct itimerspec spec = {0};
+	spec.it_value.tv_sec = interval_ns / 1000000000;
+	spec.it_value.tv_nsec = interval_ns % 1000000000;
+	spec.it_interval = spec.it_value;
+	timerfd_settime(pl->timer_fd, 0, &spec, NULL);
+}
+
+static void poller_handle_status(
+	struct poller *pl, const char *payload, size_t payload_len) {
+	pl->stats.replies += 1;
+	struct statusDiff diff;
+	enum statusResult result = status_cache_update(
+		&pl->cache, payload, payload_len, &diff);
+	if (result == STATUS_CHANGED) {
+		pl->stats.changes += 1;
+		pl->moving = poller_is_moving(&pl->cache.state);
+		poller_update_interval(pl);
+		if (pl->changed) {
+			pl->changed(pl->changed_data, &pl->cache.state, &diff);
+		}
+	}
+}
+
+static void poller_on_reply(
+	void *data, int id, const char *payload, size_t payload_len) {
+	struct poller *pl = data;
+	(void)id;
+	pl->polling = false;
+	if (payload != NULL) {
+		poller_handle_status(pl, payload, payload_len);
+	}
+}
+
+static void poller_on_keepalive_reply(
+	void *data, int id, const char *payload, size_t payload_len) {
+	struct poller *pl = data;
+	(void)id;
+	if (payload != NULL) {
+		poller_handle_status(pl, payload, payload_len);
+	}
+}
+
+static void poller_on_timer(void *data) {
+	struct poller *pl = data;
+	uint64_t expirations;
+	ssize_t ret = read(pl->timer_fd, &expirations, sizeof(expirations));
+	(void)ret;
+	// Don't pile up polls behind a slow reply or a missing ACE
+	if (pl->polling || !transport_connected(&pl->p->t)) {
+		pl->stats.skipped_polls += 1;
+		return;
+	}
+	int id = pipeline_call(pl->p, "get_status", NULL, poller_on_reply, pl);
+	if (id != -1) {
+		pl->poll_id = id;
+		pl->polling = true;
+		pl->stats.polls += 1;
+	}
+}
+
+bool poller_init(struct poller *pl, struct pipeline *p,
+	poller_changed_fn changed, void *changed_data) {
+	pl->p = p;
+	status_cache_init(&pl->cache);
+	pl->interval_ms = 0;
+	pl->polling = false;
+	pl->moving = false;
+	pl->awaiting = 0;
+	pl->changed = changed;
+	pl->changed_data = changed_data;
+	memset(&pl->stats, 0, sizeof(pl->stats));
+	pl->timer_fd = timerfd_create(
+		CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (pl->timer_fd == -1) {
+		return false;
+	}
+	if (!transport_watch(&p->t, pl->timer_fd, poller_on_timer, pl)) {
+		close(pl->timer_fd);
+		pl->timer_fd = -1;
+		return false;
+	}
+	p->status_fn = poller_on_keepalive_reply;
+	p->status_data = pl;
+	pl->keepalive_ms = p->t.keepalive_ms;
+	transport_set_keepalive(&p->t, POLLER_KEEPALIVE_MS);
+	poller_update_interval(pl);
+	return true;
+}
+
+void poller_close(struct poller *pl) {
+	pl->p->status_fn = NULL;
+	pl->p->status_data = NULL;
+	transport_set_keepalive(&pl->p->t, pl->keepalive_ms);
+	if (pl->polling) {
+		pipeline_detach(pl->p, pl->poll_id, poller_on_reply, pl);
+		pl->polling = false;
+	}
+	if (pl->timer_fd != -1) {
+		transport_unwatch(&pl->p->t, pl->timer_fd);
+		close(pl->timer_fd);
+		pl->timer_fd = -1;
+	}
+}
+
+// Runs the loop until the ACE has been seen to move and then stop. Replies
+// only count once after_replies have come in, so they were asked for after
+// whatever started the move.
+static enum pollerResult poller_wait_motion(
+	struct poller *pl, unsigned long after_replies, int64_t deadline) {
+	int64_t start = pipeline_now_us();
+	bool seen_moving = false;
+	for (;;) {
+		if (pl->stats.replies > after_replies) {
+			seen_moving = seen_moving || pl->moving;
+			int64_t waited = pipeline_now_us() - start;
+			bool gave_up = (waited >= POLLER_START_MS * 1000LL);
+			if (!pl->moving && seen_moving) {
+				return POLLER_DONE;
+			}
+			if (!pl->moving && gave_up) {
+				return POLLER_NO_MOTION;
+			}
+		}
+		int64_t left_us = deadline - pipeline_now_us();
+		if (left_us <= 0) {
+			return POLLER_TIMEOUT;
+		}
+		if (pipeline_run(pl->p, (left_us + 999) / 1000) == -1) {
+			return POLLER_FAILED;
+		}
+	}
+}
+
+enum pollerResult poller_call_motion(struct poller *pl, const char *method,
+	const char *params, int timeout_ms) {
+	int64_t deadline = pipeline_now_us() + timeout_ms * 1000LL;
+	pl->awaiting += 1;
+	poller_update_interval(pl);
+	enum pollerResult result = POLLER_FAILED;
+	struct pipelineFuture future;
+	if (pipeline_call_future(pl->p, method, params, &future)) {
+		if (!pipeline_wait(pl->p, &future, timeout_ms)) {
+			result = POLLER_TIMEOUT;
+		} else if (future.payload != NULL) {
+			double code = -1;
+			mjson_get_number(future.payload, future.payload_len,
+				"$.code", &code);
+			if (code == 0) {
+				result = poller_wait_motion(
+					pl, pl->stats.replies, deadline);
+			}
+		}
+		pipeline_release_future(pl->p, &future);
+	}
+	pl->awaiting -= 1;
+	poller_update_interval(pl);
+	return result;
+}
+
+bool poller_await_idle(struct poller *pl, int timeout_ms) {
+	int64_t deadline = pipeline_now_us() + timeout_ms * 1000LL;
+	pl->awaiting += 1;
+	poller_update_interval(pl);
+	unsigned long after_replies = pl->stats.replies;
+	bool idle = false;
+	for (;;) {
+		if (pl->stats.replies > after_replies && !pl->moving) {
+			idle = true;
+			break;
+		}
+		int64_t left_us = deadline - pipeline_now_us();
+		if (left_us <= 0 ||
+			pipeline_run(pl->p, (left_us + 999) / 1000) == -1) {
+			break;
+		}
+	}
+	pl->awaiting -= 1;
+	poller_update_interval(pl);
+	return idle;
+}
@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#ifndef POLLER_H
+#define POLLER_H
+
+#include <stdbool.h>
+
+#include "pipeline.h"
+#include "status.h"
+
+// Polls get_status on a pipeline as often as the ACE's activity calls for:
+// quickly while it's moving filament so the end of a move is seen straight
+// away, less often while drying, and slowly when idle. Idle polls double as
+// the keepalive, the pipeline's own keepalive is pushed back to only cover
+// gaps in polling. Keepalive replies are fed into the status cache too.
+//
+// The ACE is moving if its status is busy or its action is feeding,
+// unwinding or shifting.
+
+#define POLLER_MOVING_MS 100
+#define POLLER_DRYING_MS 1000
+#define POLLER_IDLE_MS 2000
+#define POLLER_KEEPALIVE_MS 2500
+// How long a move has to show up in the status before it's assumed done
+#define POLLER_START_MS 1000
+
+// Called when a reply changes something in the status cache
+typedef void (*poller_changed_fn)(void *data, const struct statusState *state,
+	const struct statusDiff *diff);
+
+enum pollerResult {
+	POLLER_DONE,
+	// The call worked but the status never showed a move
+	POLLER_NO_MOTION,
+	POLLER_FAILED,
+	POLLER_TIMEOUT,
+};
+
+struct pollerStats {
+	unsigned long polls;
+	unsigned long skipped_polls;
+	unsigned long replies;
+	unsigned long changes;
+	unsigned long interval_changes;
+};
+
+struct poller {
+	struct pipeline *p;
+	struct statusCache cache;
+	int timer_fd;
+	int interval_ms;
+	// Transport keepalive to put back on close
+	int keepalive_ms;
+	// Id of the poll in flight if polling is set
+	int poll_id;
+	bool polling;
+	bool moving;
+	int awaiting;
+	poller_changed_fn changed;
+	void *changed_data;
+	struct pollerStats stats;
+};
+
+// Starts polling on p, changed may be NULL. Returns false if the timer can't
+// be set up.
+bool poller_init(struct poller *pl, struct pipeline *p,
+	poller_changed_fn changed, void *changed_data);
+void poller_close(struct poller *pl);
+
+// Calls a motion method such as feed_filament or unwind_filament and waits
+// for the ACE to finish moving, polling quickly in the meantime. Returns
+// POLLER_FAILED if the call fails or returns a non-zero code, and
+// POLLER_NO_MOTION if no move shows up within POLLER_START_MS.
+enum pollerResult poller_call_motion(struct poller *pl, const char *method,
+	const char *params, int timeout_ms);
+
+// Waits for the ACE to stop moving, returns false on timeout
+bool poller_await_idle(struct poller *pl, int timeout_ms);
+
+// Latest status, valid once pl->cache.valid is set
+static inline const struct statusState *poller_state(
+	const struct poller *pl) {
+	return &pl->cache.state;
+}
+
+#endif
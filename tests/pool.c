@@ -0,0 +1,208 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+// Replies under the smallest class are small errors and short results, get
+// status replies fit the second and every request fits the third
+static const struct poolClass {
+	size_t size;
+	size_t blocks;
+} pool_classes[POOL_CLASS_COUNT] = {
+	{128, 32},
+	{640, 32},
+	{1024, 16},
+	{POOL_MAX_ALLOC, 8},
+};
+
+#define POOL_LARGEST (POOL_CLASS_COUNT - 1)
+
+static size_t pool_align(size_t len) {
+	return (len + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+}
+
+bool pool_init(struct pool *pool) {
+	memset(pool, 0, sizeof(*pool));
+	size_t total = 0;
+	for (int i = 0; i < POOL_CLASS_COUNT; ++i) {
+		size_t stride = pool_align(sizeof(struct poolBlock)) +
+				pool_classes[i].size;
+		total += stride * pool_classes[i].blocks;
+	}
+	pool->storage = aligned_alloc(POOL_ALIGN, total);
+	if (pool->storage == NULL) {
+		return false;
+	}
+	unsigned char *pos = pool->storage;
+	for (int i = 0; i < POOL_CLASS_COUNT; ++i) {
+		struct poolClassStats *stats = &pool->stats.classes[i];
+		stats->size = pool_classes[i].size;
+		stats->blocks = pool_classes[i].blocks;
+		for (size_t j = 0; j < pool_classes[i].blocks; ++j) {
+			struct poolBlock *block = (struct poolBlock *)pos;
+			block->pool = pool;
+			block->size_class = i;
+			block->refs = 0;
+			block->data = pos + pool_align(sizeof(*block));
+			block->next = pool->free[i];
+			pool->free[i] = block;
+			pos = block->data + pool_classes[i].size;
+		}
+	}
+	return true;
+}
+
+void pool_close(struct pool *pool) {
+	free(pool->storage);
+	pool->storage = NULL;
+	memset(pool->free, 0, sizeof(pool->free));
+}
+
+static struct poolBlock *pool_take(struct pool *pool, int size_class) {
+	struct poolBlock *block = pool->free[size_class];
+	if (block == NULL) {
+		return NULL;
+	}
+	pool->free[size_class] = block->next;
+	block->next = NULL;
+	block->refs = 1;
+	struct poolClassStats *stats = &pool->stats.classes[size_class];
+	stats->allocs += 1;
+	stats->in_use += 1;
+	if (stats->high_water < stats->in_use) {
+		stats->high_water = stats->in_use;
+	}
+	return block;
+}
+
+struct poolBlock *pool_alloc(struct pool *pool, size_t len) {
+	int size_class = 0;
+	while (size_class < POOL_CLASS_COUNT &&
+		pool_classes[size_class].size < len) {
+		size_class += 1;
+	}
+	for (int i = size_class; i < POOL_CLASS_COUNT; ++i) {
+		struct poolBlock *block = pool_take(pool, i);
+		if (block != NULL) {
+			if (i != size_class) {
+				pool->stats.classes[size_class].borrowed += 1;
+			}
+			return block;
+		}
+	}
+	pool->stats.failures += 1;
+	return NULL;
+}
+
+void pool_ref(struct poolBlock *block) {
+	block->refs += 1;
+}
+
+void pool_unref(struct poolBlock *block) {
+	block->refs -= 1;
+	if (block->refs != 0) {
+		return;
+	}
+	struct pool *pool = block->pool;
+	block->next = pool->free[block->size_class];
+	pool->free[block->size_class] = block;
+	pool->stats.classes[block->size_class].in_use -= 1;
+}
+
+bool pool_copy(
+	struct pool *pool, const void *buf, size_t len, struct poolView *view) {
+	struct poolBlock *block = pool_alloc(pool, len + 1);
+	if (block == NULL) {
+		view->block = NULL;
+		view->data = NULL;
+		view->len = 0;
+		return false;
+	}
+	memcpy(block->data, buf, len);
+	block->data[len] = '\0';
+	view->block = block;
+	view->data = (const char *)block->data;
+	view->len = len;
+	return true;
+}
+
+struct poolView pool_view_share(const struct poolView *view) {
+	if (view->block != NULL) {
+		pool_ref(view->block);
+	}
+	return *view;
+}
+
+struct poolView pool_view_slice(
+	const struct poolView *view, size_t offset, size_t len) {
+	if (offset > view->len || len > view->len - offset) {
+		struct poolView empty = {0};
+		return empty;
+	}
+	struct poolView slice = pool_view_share(view);
+	slice.data += offset;
+	slice.len = len;
+	return slice;
+}
+
+void pool_view_release(struct poolView *view) {
+	if (view->block != NULL) {
+		pool_unref(view->block);
+	}
+	view->block = NULL;
+	view->data = NULL;
+	view->len = 0;
+}
+
+void pool_arena_init(struct poolArena *arena, struct pool *pool) {
+	arena->pool = pool;
+	arena->first = NULL;
+	arena->last = NULL;
+	arena->used = 0;
+	arena->blocks = 0;
+}
+
+void *pool_arena_alloc(struct poolArena *arena, size_t len) {
+	len = pool_align(len);
+	if (len > POOL_MAX_ALLOC) {
+		return NULL;
+	}
+	if (arena->last == NULL || arena->used + len > POOL_MAX_ALLOC) {
+		struct pool *pool = arena->pool;
+		struct poolBlock *block = pool_take(pool, POOL_LARGEST);
+		if (block == NULL) {
+			pool->stats.failures += 1;
+			return NULL;
+		}
+		if (arena->last == NULL) {
+			arena->first = block;
+			pool->stats.arenas += 1;
+		} else {
+			arena->last->next = block;
+		}
+		arena->last = block;
+		arena->used = 0;
+		arena->blocks += 1;
+		if (pool->stats.arena_high_water < arena->blocks) {
+			pool->stats.arena_high_water = arena->blocks;
+		}
+	}
+	void *ptr = arena->last->data + arena->used;
+	arena->used += len;
+	return ptr;
+}
+
+void pool_arena_release(struct poolArena *arena) {
+	if (arena->first == NULL) {
+		return;
+	}
+	// The blocks are already chained, splice them on to the free list
+	struct pool *pool = arena->pool;
+	arena->last->next = pool->free[POOL_LARGEST];
+	pool->free[POOL_LARGEST] = arena->first;
+	pool->stats.classes[POOL_LARGEST].in_use -= arena->blocks;
+	pool_arena_init(arena, pool);
+}
@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Fixed size blocks for payloads, in size classes that fit ACE frames:
+// short replies, status replies, whole requests and the largest payload the
+// decoder takes. Blocks are carved out of one allocation made up front and
+// kept on a free list per class, so allocating and freeing never touches
+// malloc. A class that runs out borrows from the next larger one.
+//
+// Payloads are handed out as views holding a reference to their block, so a
+// reply can be kept, queued or passed along without copying and its block is
+// freed when the last view is released. Arenas bump-allocate scratch space
+// from the largest class and give it all back at once.
+//
+// There's no locking and the reference counts aren't atomic, on purpose: a
+// pool and its views belong to the thread running the pipeline that owns
+// it, and every caller of the pipeline runs on that thread. A payload that
+// has to cross threads is copied out rather than shared.
+
+#define POOL_CLASS_COUNT 4
+#define POOL_MAX_ALLOC 2048
+#define POOL_ALIGN 16
+
+struct pool;
+
+struct poolBlock {
+	struct pool *pool;
+	struct poolBlock *next;
+	unsigned int refs;
+	unsigned int size_class;
+	unsigned char *data;
+};
+
+struct poolClassStats {
+	size_t size;
+	size_t blocks;
+	size_t in_use;
+	size_t high_water;
+	unsigned long allocs;
+	// Allocations handed to a larger class because this one was empty
+	unsigned long borrowed;
+};
+
+struct poolStats {
+	struct poolClassStats classes[POOL_CLASS_COUNT];
+	// Allocations that nothing could fit
+	unsigned long failures;
+	unsigned long arenas;
+	size_t arena_high_water;
+};
+
+struct pool {
+	unsigned char *storage;
+	struct poolBlock *free[POOL_CLASS_COUNT];
+	struct poolStats stats;
+};
+
+struct poolView {
+	struct poolBlock *block;
+	const char *data;
+	size_t len;
+};
+
+struct poolArena {
+	struct pool *pool;
+	struct poolBlock *first;
+	struct poolBlock *last;
+	size_t used;
+	size_t blocks;
+};
+
+bool pool_init(struct pool *pool);
+void pool_close(struct pool *pool);
+
+// Gets a block with at least len bytes and one reference, or NULL
+struct poolBlock *pool_alloc(struct pool *pool, size_t len);
+void pool_ref(struct poolBlock *block);
+void pool_unref(struct poolBlock *block);
+
+// Copies data in to a new block as a NUL terminated view
+bool pool_copy(
+	struct pool *pool, const void *buf, size_t len, struct poolView *view);
+
+// Another reference to all or part of a view, released separately. A slice
+// that doesn't fit in the view comes back empty.
+struct poolView pool_view_share(const struct poolView *view);
+struct poolView pool_view_slice(
+	const struct poolView *view, size_t offset, size_t len);
+
+// Drops a view's reference, safe to call on an empty or released view
+void pool_view_release(struct poolView *view);
+
+static inline bool pool_view_empty(const struct poolView *view) {
+	return view->block == NULL;
+}
+
+void pool_arena_init(struct poolArena *arena, struct pool *pool);
+
+// Allocates from an arena, aligned to POOL_ALIGN. Returns NULL if len is
+// over POOL_MAX_ALLOC or the pool is empty.
+void *pool_arena_alloc(struct poolArena *arena, size_t len);
+
+// Frees everything allocated from an arena in one go
+void pool_arena_release(struct poolArena *arena);
+
+#endif
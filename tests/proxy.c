@@ -0,0 +1,385 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "framestore.h"
+
+// Sits between the host software and the ACE, passing bytes straight through
+// and recording every frame with monotonic timestamps in a frame store:
+//
+//   ./proxy [-a] DEVICE LINK STORE
+//
+// DEVICE is the ACE's tty or the emulator's PTY. The host software opens
+// LINK instead, a symlink to a PTY made by the proxy. With -a frames are
+// added to an existing store.
+//
+// When the ACE drops the link the host's PTY and LINK go away too, so the
+// host sees the disconnect as it would without the proxy. Both come back
+// once the ACE can be opened again, with LINK pointing at a new PTY.
+//
+// Bytes are forwarded as soon as they're read and only then decoded and
+// stored, so capturing never holds up the link. Neither side's writes block:
+// what a side can't take yet is queued until it can, so a stalled ACE or a
+// host that isn't reading doesn't hold up the other direction. A chunk that
+// doesn't fit in the queue is dropped whole rather than cut short. The time
+// from a read returning to it being written or queued is measured and printed
+// on exit.
+
+#define PROXY_BUF_SIZE 4096
+#define PROXY_QUEUE_SIZE 65536
+#define PROXY_FLUSH_NS 1000000000LL
+#define PROXY_RECONNECT_MS 50
+
+struct proxyTiming {
+	unsigned long count;
+	int64_t total_ns;
+	int64_t max_ns;
+};
+
+// Bytes read from one side waiting for the other to take them
+struct proxyQueue {
+	unsigned char buf[PROXY_QUEUE_SIZE];
+	size_t pos;
+	size_t len;
+};
+
+struct proxy {
+	const char *device_path;
+	const char *link_path;
+	int device;
+	int master;
+	int slave;
+	struct framestoreWriter store;
+	struct framestoreStream streams[2];
+	struct proxyQueue queues[2];
+	unsigned long bytes[2];
+	unsigned long dropped[2];
+	struct proxyTiming forward[2];
+	struct proxyTiming capture;
+	unsigned long reconnects;
+	unsigned char buf[PROXY_BUF_SIZE];
+};
+
+static volatile sig_atomic_t proxy_stopping;
+
+static void proxy_stop(int sig) {
+	(void)sig;
+	proxy_stopping = 1;
+}
+
+static int64_t proxy_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void proxy_time(struct proxyTiming *timing, int64_t ns) {
+	timing->count += 1;
+	timing->total_ns += ns;
+	if (ns > timing->max_ns) {
+		timing->max_ns = ns;
+	}
+}
+
+static void proxy_raw(int fd) {
+	struct termios cfg = {0};
+	cfmakeraw(&cfg);
+	cfsetspeed(&cfg, B115200);
+	tcsetattr(fd, 0, &cfg);
+}
+
+static bool proxy_open_device(struct proxy *px) {
+	px->device = open(px->device_path,
+		O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (px->device == -1) {
+		return false;
+	}
+	proxy_raw(px->device);
+	// A frame cut off by the disconnect would never finish
+	framestore_stream_init(
+		&px->streams[FRAMESTORE_READ], FRAMESTORE_READ, px->device);
+	return true;
+}
+
+// Makes the PTY for the host. The proxy keeps the slave open too so the
+// master doesn't start failing reads while the host has it closed.
+static bool proxy_open_pty(struct proxy *px) {
+	px->master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (px->master == -1 || grantpt(px->master) != 0 ||
+		unlockpt(px->master) != 0) {
+		return false;
+	}
+	const char *name = ptsname(px->master);
+	if (name == NULL) {
+		return false;
+	}
+	px->slave = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (px->slave == -1) {
+		return false;
+	}
+	proxy_raw(px->slave);
+	framestore_stream_init(
+		&px->streams[FRAMESTORE_WRITE], FRAMESTORE_WRITE, px->master);
+	struct stat st;
+	if (lstat(px->link_path, &st) == 0 && S_ISLNK(st.st_mode)) {
+		unlink(px->link_path);
+	}
+	return symlink(name, px->link_path) == 0;
+}
+
+// Hangs up on the host. Closing both ends of the PTY gives the host a hangup
+// and read errors, and removing the link stops it opening the ACE until
+// it's back.
+static void proxy_close_pty(struct proxy *px) {
+	unlink(px->link_path);
+	if (px->slave != -1) {
+		close(px->slave);
+		px->slave = -1;
+	}
+	if (px->master != -1) {
+		close(px->master);
+		px->master = -1;
+	}
+}
+
+// Writes as much as fd takes without blocking. Returns how much, or -1 if fd
+// has gone.
+static ssize_t proxy_write(int fd, const unsigned char *buf, size_t len) {
+	size_t done = 0;
+	while (done < len) {
+		ssize_t written = write(fd, buf + done, len - done);
+		if (written == -1 && errno == EINTR) {
+			continue;
+		}
+		if (written == -1 && errno == EAGAIN) {
+			break;
+		}
+		if (written <= 0) {
+			return -1;
+		}
+		done += written;
+	}
+	return done;
+}
+
+static bool proxy_queue_pending(const struct proxyQueue *q) {
+	return q->pos < q->len;
+}
+
+// Writes what's queued, returns false if fd has gone
+static bool proxy_flush(struct proxyQueue *q, int fd) {
+	ssize_t written = proxy_write(fd, q->buf + q->pos, q->len - q->pos);
+	if (written == -1) {
+		return false;
+	}
+	q->pos += written;
+	if (q->pos == q->len) {
+		q->pos = 0;
+		q->len = 0;
+	}
+	return true;
+}
+
+// Writes a chunk straight out if nothing is queued ahead of it and queues
+// the rest. Returns false if the chunk was dropped.
+static bool proxy_send(struct proxyQueue *q, int fd, const unsigned char *buf,
+	size_t len) {
+	size_t written = 0;
+	if (q->len == 0) {
+		ssize_t got = proxy_write(fd, buf, len);
+		if (got == -1) {
+			return false;
+		}
+		written = got;
+	} else if (q->pos != 0) {
+		memmove(q->buf, q->buf + q->pos, q->len - q->pos);
+		q->len -= q->pos;
+		q->pos = 0;
+	}
+	size_t left = len - written;
+	if (left > sizeof(q->buf) - q->len) {
+		return false;
+	}
+	memcpy(q->buf + q->len, buf + written, left);
+	q->len += left;
+	return true;
+}
+
+// Throws away what's queued for a side that's gone
+static void proxy_discard(
+	struct proxy *px, enum framestoreDirection direction) {
+	struct proxyQueue *q = &px->queues[direction];
+	px->dropped[direction] += q->len - q->pos;
+	q->pos = 0;
+	q->len = 0;
+}
+
+// Moves one read's worth from one side to the other. Returns false if the
+// side read from has gone.
+static bool proxy_pass(struct proxy *px, enum framestoreDirection direction) {
+	unsigned char *buf = px->buf;
+	int from = direction == FRAMESTORE_READ ? px->device : px->master;
+	int to = direction == FRAMESTORE_READ ? px->master : px->device;
+	ssize_t got = read(from, buf, sizeof(px->buf));
+	if (got == -1 && (errno == EINTR || errno == EAGAIN)) {
+		return true;
+	}
+	if (got <= 0) {
+		return false;
+	}
+	int64_t read_ns = proxy_now_ns();
+	// What can't be passed on is dropped, but still stored as it's what
+	// the other side sent
+	if (to == -1 ||
+		!proxy_send(&px->queues[direction], to, buf, got)) {
+		px->dropped[direction] += got;
+	}
+	int64_t written_ns = proxy_now_ns();
+	proxy_time(&px->forward[direction], written_ns - read_ns);
+	px->bytes[direction] += got;
+	if (!framestore_feed(&px->store, &px->streams[direction], buf, got,
+		    read_ns)) {
+		perror("Writing frame store");
+	}
+	proxy_time(&px->capture, proxy_now_ns() - written_ns);
+	return true;
+}
+
+static void proxy_loop(struct proxy *px) {
+	int64_t flushed_ns = proxy_now_ns();
+	while (!proxy_stopping) {
+		struct proxyQueue *to_host = &px->queues[FRAMESTORE_READ];
+		struct proxyQueue *to_device = &px->queues[FRAMESTORE_WRITE];
+		struct pollfd fds[2] = {
+			{px->master, POLLIN, 0},
+			{px->device, POLLIN, 0},
+		};
+		if (proxy_queue_pending(to_host)) {
+			fds[0].events |= POLLOUT;
+		}
+		if (proxy_queue_pending(to_device)) {
+			fds[1].events |= POLLOUT;
+		}
+		int timeout = px->device == -1 ? PROXY_RECONNECT_MS : 1000;
+		int ready = poll(fds, 2, timeout);
+		if (ready == -1 && errno != EINTR) {
+			perror("poll");
+			return;
+		}
+		if (ready > 0 && (fds[0].revents & POLLOUT)) {
+			proxy_flush(to_host, px->master);
+		}
+		if (ready > 0 && (fds[0].revents & ~POLLOUT)) {
+			proxy_pass(px, FRAMESTORE_WRITE);
+		}
+		bool gone = false;
+		if (ready > 0 && (fds[1].revents & POLLOUT)) {
+			gone = !proxy_flush(to_device, px->device);
+		}
+		if (ready > 0 && (fds[1].revents & ~POLLOUT)) {
+			gone = gone || !proxy_pass(px, FRAMESTORE_READ);
+		}
+		if (gone) {
+			close(px->device);
+			px->device = -1;
+			proxy_close_pty(px);
+			proxy_discard(px, FRAMESTORE_READ);
+			proxy_discard(px, FRAMESTORE_WRITE);
+		}
+		if (px->device == -1 && proxy_open_device(px)) {
+			px->reconnects += 1;
+			framestore_new_capture(&px->store);
+			if (!proxy_open_pty(px)) {
+				perror(px->link_path);
+				return;
+			}
+		}
+		int64_t now = proxy_now_ns();
+		if (now - flushed_ns >= PROXY_FLUSH_NS) {
+			framestore_flush(&px->store);
+			flushed_ns = now;
+		}
+	}
+}
+
+static void proxy_print_timing(const char *name, const struct proxyTiming *t) {
+	if (t->count == 0) {
+		return;
+	}
+	fprintf(stdout, "%s: %lu chunks, %.0f ns average, %.0f ns worst\n",
+		name, t->count, (double)t->total_ns / t->count,
+		(double)t->max_ns);
+}
+
+int main(int argc, char *argv[]) {
+	int arg = 1;
+	bool append = false;
+	if (arg < argc && strcmp(argv[arg], "-a") == 0) {
+		append = true;
+		arg += 1;
+	}
+	if (argc - arg != 3) {
+		fprintf(stderr, "Usage: %s [-a] DEVICE LINK STORE\n", argv[0]);
+		return 1;
+	}
+	static struct proxy px;
+	px.device_path = argv[arg];
+	px.link_path = argv[arg + 1];
+	const char *name = argv[arg + 2];
+	px.device = -1;
+	px.master = -1;
+	px.slave = -1;
+	if (!framestore_open(&px.store, name, append) ||
+		!framestore_log_chunks(&px.store, name, append)) {
+		fprintf(stderr, "Couldn't open frame store %s\n", name);
+		return 1;
+	}
+	if (!proxy_open_device(&px)) {
+		perror(px.device_path);
+		return 1;
+	}
+	if (!proxy_open_pty(&px)) {
+		perror(px.link_path);
+		return 1;
+	}
+	struct sigaction sa = {0};
+	sa.sa_handler = proxy_stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	proxy_loop(&px);
+	proxy_close_pty(&px);
+	int status = 0;
+	if (!framestore_close(&px.store)) {
+		perror("Closing frame store");
+		status = 1;
+	}
+	fprintf(stdout, "-- PROXY --\n");
+	fprintf(stdout,
+		"%lu bytes read, %lu bytes written, %lu and %lu dropped, "
+		"%lu reconnects\n",
+		px.bytes[FRAMESTORE_READ], px.bytes[FRAMESTORE_WRITE],
+		px.dropped[FRAMESTORE_READ], px.dropped[FRAMESTORE_WRITE],
+		px.reconnects);
+	const struct framestoreStats *fs = &px.store.stats;
+	fprintf(stdout, "%lu frames, %lu bad CRCs, %lu replies matched\n",
+		fs->frames, fs->bad_crcs, fs->replies_matched);
+	proxy_print_timing("Forwarding reads", &px.forward[FRAMESTORE_READ]);
+	proxy_print_timing("Forwarding writes", &px.forward[FRAMESTORE_WRITE]);
+	proxy_print_timing("Capturing", &px.capture);
+	return status;
+}
@@ -0,0 +1,229 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mjson.h"
+#include "query.h"
+
+void query_init(struct query *q) {
+	q->nodes[0].step = QUERY_ROOT;
+	q->nodes[0].first_child = -1;
+	q->nodes[0].next_sibling = -1;
+	q->nodes[0].path = -1;
+	q->node_count = 1;
+	q->path_count = 0;
+}
+
+// Reads one step of a path in to node, returns where the next step starts
+static const char *query_parse_step(const char *step, struct queryNode *node) {
+	node->key_len = 0;
+	node->index = -1;
+	if (step[0] == '.' && step[1] == '*') {
+		node->step = QUERY_ANY;
+		return step + 2;
+	} else if (step[0] == '.') {
+		size_t len = strcspn(step + 1, ".[");
+		if (len == 0 || len >= QUERY_KEY_LEN) {
+			return NULL;
+		}
+		node->step = QUERY_KEY;
+		memcpy(node->key, step + 1, len);
+		node->key_len = len;
+		return step + 1 + len;
+	} else if (step[0] == '[' && step[1] == '*' && step[2] == ']') {
+		node->step = QUERY_ANY;
+		return step + 3;
+	} else if (step[0] == '[') {
+		char *end;
+		long index = strtol(step + 1, &end, 10);
+		if (end == step + 1 || *end != ']' || index < 0) {
+			return NULL;
+		}
+		node->step = QUERY_INDEX;
+		node->index = index;
+		return end + 1;
+	}
+	return NULL;
+}
+
+static bool query_same_step(
+	const struct queryNode *a, const struct queryNode *b) {
+	return a->step == b->step && a->index == b->index &&
+	       a->key_len == b->key_len &&
+	       memcmp(a->key, b->key, a->key_len) == 0;
+}
+
+int query_add(struct query *q, const char *path) {
+	if (path[0] != '$') {
+		return -1;
+	}
+	// Check the whole path first so a bad one doesn't leave nodes behind
+	struct queryNode steps[QUERY_MAX_NODES];
+	size_t step_count = 0;
+	const char *step = path + 1;
+	while (*step != '\0') {
+		if (step_count == QUERY_MAX_NODES) {
+			return -1;
+		}
+		step = query_parse_step(step, &steps[step_count++]);
+		if (step == NULL) {
+			return -1;
+		}
+	}
+	size_t node = 0;
+	for (size_t i = 0; i < step_count; ++i) {
+		int child = q->nodes[node].first_child;
+		int last = -1;
+		while (child != -1 &&
+			!query_same_step(&q->nodes[child], &steps[i])) {
+			last = child;
+			child = q->nodes[child].next_sibling;
+		}
+		if (child == -1) {
+			if (q->node_count == QUERY_MAX_NODES) {
+				return -1;
+			}
+			child = q->node_count++;
+			q->nodes[child] = steps[i];
+			q->nodes[child].first_child = -1;
+			q->nodes[child].next_sibling = -1;
+			q->nodes[child].path = -1;
+			if (last == -1) {
+				q->nodes[node].first_child = child;
+			} else {
+				q->nodes[last].next_sibling = child;
+			}
+		}
+		node = child;
+	}
+	if (q->nodes[node].path == -1) {
+		if (q->path_count == QUERY_MAX_PATHS) {
+			return -1;
+		}
+		q->nodes[node].path = q->path_count++;
+	}
+	return q->nodes[node].path;
+}
+
+static void query_store(const struct jsonIndex *idx, size_t token,
+	int index, struct queryResult *result) {
+	if (result->count < result->capacity) {
+		struct queryValue *value = &result->values[result->count];
+		value->type = jsonindex_value(
+			idx, token, &value->value, &value->value_len);
+		value->index = index;
+		if (value->type == MJSON_TOK_INVALID) {
+			return;
+		}
+	}
+	result->count += 1;
+}
+
+static bool query_key_is(const struct jsonIndex *idx, int key,
+	const struct queryNode *node) {
+	size_t start = idx->offsets[key] + 1;
+	size_t len = idx->offsets[key + 1] - start;
+	return len == node->key_len &&
+	       memcmp(idx->buf + start, node->key, len) == 0;
+}
+
+static void query_walk(const struct query *q, const struct jsonIndex *idx,
+	size_t node_num, size_t token, int index,
+	struct queryResult *results) {
+	const struct queryNode *node = &q->nodes[node_num];
+	if (node->path != -1) {
+		query_store(idx, token, index, &results[node->path]);
+	}
+	if (node->first_child == -1) {
+		return;
+	}
+	char c = idx->buf[idx->offsets[token]];
+	if (c != '{' && c != '[') {
+		return;
+	}
+	bool object = (c == '{');
+	// Children that can only match once, the walk stops early when all of
+	// them have and there's no wildcard wanting the rest
+	uint64_t pending = 0;
+	bool any = false;
+	for (int child = node->first_child; child != -1;
+		child = q->nodes[child].next_sibling) {
+		enum queryStep step = q->nodes[child].step;
+		if (step == QUERY_ANY) {
+			any = true;
+		} else if ((step == QUERY_KEY) == object) {
+			pending |= UINT64_C(1) << child;
+		}
+	}
+	if (pending == 0 && !any) {
+		return;
+	}
+	size_t pos = 0;
+	int key;
+	size_t value;
+	long element = 0;
+	while (jsonindex_next(idx, token, &pos, &key, &value)) {
+		for (int child = node->first_child; child != -1;
+			child = q->nodes[child].next_sibling) {
+			const struct queryNode *step = &q->nodes[child];
+			uint64_t bit = UINT64_C(1) << child;
+			bool match;
+			if (step->step == QUERY_ANY) {
+				query_walk(q, idx, child, value, element,
+					results);
+				continue;
+			} else if (!(pending & bit)) {
+				continue;
+			} else if (object) {
+				match = query_key_is(idx, key, step);
+			} else {
+				match = (step->index == element);
+			}
+			if (match) {
+				pending &= ~bit;
+				query_walk(q, idx, child, value, index,
+					results);
+			}
+		}
+		if (pending == 0 && !any) {
+			break;
+		}
+		element += 1;
+	}
+}
+
+void query_run(const struct query *q, const struct jsonIndex *idx,
+	struct queryResult *results) {
+	for (size_t i = 0; i < q->path_count; ++i) {
+		results[i].count = 0;
+	}
+	if (idx->count == 0) {
+		return;
+	}
+	query_walk(q, idx, 0, 0, -1, results);
+}
+
+bool query_extract(const struct query *q, struct jsonIndex *idx,
+	const char *buf, size_t len, struct queryResult *results) {
+	if (!jsonindex_build(idx, buf, len)) {
+		for (size_t i = 0; i < q->path_count; ++i) {
+			results[i].count = 0;
+		}
+		return false;
+	}
+	query_run(q, idx, results);
+	return true;
+}
+
+bool query_number(const struct queryResult *result, double *number) {
+	if (result->count == 0 || result->capacity == 0 ||
+		result->values[0].type != MJSON_TOK_NUMBER) {
+		return false;
+	}
+	// The value is followed by a delimiter so strtod stops there
+	*number = strtod(result->values[0].value, NULL);
+	return true;
+}
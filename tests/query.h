@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "jsonindex.h"
+
+// A set of paths compiled once in to a trie, then pulled out of payloads
+// together in a single walk over a jsonindex. Shared prefixes are walked once
+// and values nobody asked for are jumped over. Paths are written like mjson's
+// with [*] or .* added to match every element or member:
+//
+//   struct query q;
+//   query_init(&q);
+//   int id = query_add(&q, "$.id");
+//   int rfid = query_add(&q, "$.result.slots[*].rfid");
+//   ...
+//   struct queryValue rfids[4];
+//   struct queryResult results[] = {{&id_value, 1, 0}, {rfids, 4, 0}};
+//   query_extract(&q, &idx, payload, payload_len, results);
+//
+// Like mjson, the first of duplicate keys is used.
+
+#define QUERY_MAX_NODES 64
+#define QUERY_MAX_PATHS 32
+#define QUERY_KEY_LEN 32
+
+enum queryStep {
+	QUERY_ROOT,
+	QUERY_KEY,
+	QUERY_INDEX,
+	QUERY_ANY,
+};
+
+struct queryNode {
+	enum queryStep step;
+	char key[QUERY_KEY_LEN];
+	size_t key_len;
+	long index;
+	int first_child;
+	int next_sibling;
+	// Path ending at this node or -1
+	int path;
+};
+
+struct query {
+	struct queryNode nodes[QUERY_MAX_NODES];
+	size_t node_count;
+	size_t path_count;
+};
+
+struct queryValue {
+	// MJSON_TOK_* type and span like jsonindex_find gives
+	int type;
+	const char *value;
+	int value_len;
+	// Position of the element matched by the last wildcard, or -1
+	int index;
+};
+
+// Caller provided space for one path's values. count is how many matched,
+// which can be more than capacity if some didn't fit.
+struct queryResult {
+	struct queryValue *values;
+	size_t capacity;
+	size_t count;
+};
+
+void query_init(struct query *q);
+
+// Adds a path and returns its number for indexing results, or -1 if it
+// doesn't parse or there's no room. Adding a path twice gives the same
+// number.
+int query_add(struct query *q, const char *path);
+
+// Fills in one result per added path from an index
+void query_run(const struct query *q, const struct jsonIndex *idx,
+	struct queryResult *results);
+
+// Indexes a payload then runs the query, false if it isn't valid JSON
+bool query_extract(const struct query *q, struct jsonIndex *idx,
+	const char *buf, size_t len, struct queryResult *results);
+
+// Reads a result's first value as a number
+bool query_number(const struct queryResult *result, double *number);
+
+#endif
@@ -0,0 +1,508 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#include <string.h>
+
+#include "schema.h"
+
+#define FIELD(type, key, member, kind) \
+	{key, kind, offsetof(type, member), 0, 0, 0, NULL}
+#define STRING(type, key, member)                                    \
+	{key, SCHEMA_STRING, offsetof(type, member),                 \
+		sizeof(((type *)0)->member), 0, 0, NULL}
+#define INTS(type, key, member)                                      \
+	{key, SCHEMA_INTS, offsetof(type, member), sizeof(int),      \
+		sizeof(((type *)0)->member) / sizeof(int), 0, NULL}
+#define OBJECT(type, key, member, schema) \
+	{key, SCHEMA_OBJECT, offsetof(type, member), 0, 0, 0, &schema}
+#define OBJECTS(type, key, member, count_member, schema)             \
+	{key, SCHEMA_OBJECTS, offsetof(type, member),                \
+		sizeof(((type *)0)->member[0]),                      \
+		sizeof(((type *)0)->member) /                        \
+			sizeof(((type *)0)->member[0]),              \
+		offsetof(type, count_member), &schema}
+#define SCHEMA(type, fields) \
+	{fields, sizeof(fields) / sizeof(*fields), sizeof(type)}
+
+// Fields are listed in the order the ACE sends them, which makes lookups
+// hit first time
+
+static const struct schemaField status_dryer_fields[] = {
+	STRING(struct statusDryer, "status", status),
+	FIELD(struct statusDryer, "target_temp", target_temp, SCHEMA_INT),
+	FIELD(struct statusDryer, "duration", duration, SCHEMA_INT),
+	FIELD(struct statusDryer, "remain_time", remain_time, SCHEMA_INT),
+};
+static const struct schemaObject status_dryer =
+	SCHEMA(struct statusDryer, status_dryer_fields);
+
+static const struct schemaField status_slot_fields[] = {
+	FIELD(struct statusSlot, "index", index, SCHEMA_INT),
+	STRING(struct statusSlot, "status", status),
+	STRING(struct statusSlot, "sku", sku),
+	STRING(struct statusSlot, "brand", brand),
+	STRING(struct statusSlot, "type", type),
+	INTS(struct statusSlot, "color", color),
+	FIELD(struct statusSlot, "rfid", rfid, SCHEMA_INT),
+};
+static const struct schemaObject status_slot =
+	SCHEMA(struct statusSlot, status_slot_fields);
+
+static const struct schemaField status_fields[] = {
+	STRING(struct statusState, "status", status),
+	STRING(struct statusState, "action", action),
+	OBJECT(struct statusState, "dryer_status", dryer, status_dryer),
+	FIELD(struct statusState, "temp", temp, SCHEMA_INT),
+	FIELD(struct statusState, "enable_rfid", enable_rfid, SCHEMA_INT),
+	FIELD(struct statusState, "fan_speed", fan_speed, SCHEMA_INT),
+	FIELD(struct statusState, "feed_assist_count", feed_assist_count,
+		SCHEMA_INT),
+	FIELD(struct statusState, "cont_assist_time", cont_assist_time,
+		SCHEMA_DOUBLE),
+	OBJECTS(struct statusState, "slots", slots, slot_count, status_slot),
+};
+const struct schemaObject schema_status =
+	SCHEMA(struct statusState, status_fields);
+
+static const struct schemaField temp_fields[] = {
+	FIELD(struct schemaTemp, "min", min, SCHEMA_INT),
+	FIELD(struct schemaTemp, "max", max, SCHEMA_INT),
+};
+static const struct schemaObject temp_object =
+	SCHEMA(struct schemaTemp, temp_fields);
+
+static const struct schemaField filament_fields[] = {
+	FIELD(struct schemaFilament, "index", index, SCHEMA_INT),
+	STRING(struct schemaFilament, "sku", sku),
+	STRING(struct schemaFilament, "brand", brand),
+	STRING(struct schemaFilament, "type", type),
+	INTS(struct schemaFilament, "color", color),
+	FIELD(struct schemaFilament, "rfid", rfid, SCHEMA_INT),
+	OBJECT(struct schemaFilament, "extruder_temp", extruder_temp,
+		temp_object),
+	OBJECT(struct schemaFilament, "hotbed_temp", hotbed_temp,
+		temp_object),
+	FIELD(struct schemaFilament, "diameter", diameter, SCHEMA_DOUBLE),
+	FIELD(struct schemaFilament, "total", total, SCHEMA_INT),
+	FIELD(struct schemaFilament, "current", current, SCHEMA_INT),
+};
+const struct schemaObject schema_filament =
+	SCHEMA(struct schemaFilament, filament_fields);
+
+static const struct schemaField info_fields[] = {
+	FIELD(struct schemaInfo, "id", id, SCHEMA_INT),
+	FIELD(struct schemaInfo, "slots", slots, SCHEMA_INT),
+	STRING(struct schemaInfo, "model", model),
+	STRING(struct schemaInfo, "firmware", firmware),
+	STRING(struct schemaInfo, "boot_firmware", boot_firmware),
+};
+const struct schemaObject schema_info =
+	SCHEMA(struct schemaInfo, info_fields);
+
+// Anything in the result is skipped and counted as unknown
+const struct schemaObject schema_empty = {NULL, 0, sizeof(struct schemaEmpty)};
+
+static const struct schemaField reply_fields[] = {
+	FIELD(struct schemaReply, "id", id, SCHEMA_INT),
+	FIELD(struct schemaReply, "code", code, SCHEMA_INT),
+	STRING(struct schemaReply, "msg", msg),
+};
+static const struct schemaObject reply_object =
+	SCHEMA(struct schemaReply, reply_fields);
+
+struct schemaScan {
+	const char *pos;
+	const char *end;
+	unsigned int unknown_keys;
+};
+
+static void schema_skip_space(struct schemaScan *scan) {
+	while (scan->pos < scan->end &&
+		(*scan->pos == ' ' || *scan->pos == '\t' ||
+			*scan->pos == '\n' || *scan->pos == '\r')) {
+		scan->pos += 1;
+	}
+}
+
+// Takes c if it's next
+static bool schema_next_is(struct schemaScan *scan, char c) {
+	if (scan->pos < scan->end && *scan->pos == c) {
+		scan->pos += 1;
+		return true;
+	}
+	return false;
+}
+
+// Skips whitespace then takes c if it's next
+static bool schema_take(struct schemaScan *scan, char c) {
+	schema_skip_space(scan);
+	return schema_next_is(scan, c);
+}
+
+static char schema_unescape(char c) {
+	switch (c) {
+	case 'b':
+		return '\b';
+	case 'f':
+		return '\f';
+	case 'n':
+		return '\n';
+	case 'r':
+		return '\r';
+	case 't':
+		return '\t';
+	default:
+		return c;
+	}
+}
+
+static int schema_hex(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	return -1;
+}
+
+// Reads the XXXX of a \uXXXX escape, returning the code or -1
+static int schema_unicode(struct schemaScan *scan) {
+	if (scan->end - scan->pos < 4) {
+		return -1;
+	}
+	int code = 0;
+	for (int i = 0; i < 4; ++i) {
+		int digit = schema_hex(*scan->pos++);
+		if (digit == -1) {
+			return -1;
+		}
+		code = code * 16 + digit;
+	}
+	return code;
+}
+
+// Reads a string in to to, cutting it short if it doesn't fit. to may be
+// NULL to skip the string. Like mjson, \u00XX is taken as a byte and a string
+// with any other \u escape comes out empty.
+static bool schema_string(struct schemaScan *scan, char *to, size_t size) {
+	if (!schema_take(scan, '"')) {
+		return false;
+	}
+	size_t len = 0;
+	bool wide = false;
+	while (scan->pos < scan->end && *scan->pos != '"') {
+		char c = *scan->pos++;
+		if (c == '\\') {
+			if (scan->pos == scan->end) {
+				return false;
+			}
+			c = schema_unescape(*scan->pos++);
+			if (c == 'u') {
+				int code = schema_unicode(scan);
+				if (code == -1) {
+					return false;
+				}
+				wide |= (code > 0xFF);
+				c = (char)code;
+			}
+		}
+		if (to != NULL && len + 1 < size) {
+			to[len++] = c;
+		}
+	}
+	if (to != NULL) {
+		to[wide ? 0 : len] = '\0';
+	}
+	return schema_take(scan, '"');
+}
+
+static bool schema_digit(const struct schemaScan *scan) {
+	return scan->pos < scan->end && *scan->pos >= '0' && *scan->pos <= '9';
+}
+
+static bool schema_number(struct schemaScan *scan, double *value) {
+	schema_skip_space(scan);
+	bool negative = schema_next_is(scan, '-');
+	if (!schema_digit(scan)) {
+		return false;
+	}
+	double number = 0;
+	while (schema_digit(scan)) {
+		number = number * 10 + (*scan->pos++ - '0');
+	}
+	if (schema_next_is(scan, '.')) {
+		double scale = 0.1;
+		while (schema_digit(scan)) {
+			number += (*scan->pos++ - '0') * scale;
+			scale /= 10;
+		}
+	}
+	if (schema_next_is(scan, 'e') || schema_next_is(scan, 'E')) {
+		bool shrink = schema_next_is(scan, '-');
+		if (!shrink) {
+			schema_next_is(scan, '+');
+		}
+		int exponent = 0;
+		while (schema_digit(scan)) {
+			exponent = exponent * 10 + (*scan->pos++ - '0');
+			if (exponent > 308) {
+				return false;
+			}
+		}
+		while (exponent-- > 0) {
+			number = shrink ? number / 10 : number * 10;
+		}
+	}
+	*value = negative ? -number : number;
+	return true;
+}
+
+static bool schema_literal(struct schemaScan *scan, const char *literal) {
+	size_t len = strlen(literal);
+	if ((size_t)(scan->end - scan->pos) < len ||
+		memcmp(scan->pos, literal, len) != 0) {
+		return false;
+	}
+	scan->pos += len;
+	return true;
+}
+
+static bool schema_skip_value(struct schemaScan *scan, int depth) {
+	if (depth == SCHEMA_MAX_DEPTH) {
+		return false;
+	}
+	schema_skip_space(scan);
+	if (scan->pos == scan->end) {
+		return false;
+	}
+	double number;
+	switch (*scan->pos) {
+	case '"':
+		return schema_string(scan, NULL, 0);
+	case 't':
+		return schema_literal(scan, "true");
+	case 'f':
+		return schema_literal(scan, "false");
+	case 'n':
+		return schema_literal(scan, "null");
+	case '{':
+		scan->pos += 1;
+		if (schema_take(scan, '}')) {
+			return true;
+		}
+		do {
+			if (!schema_string(scan, NULL, 0) ||
+				!schema_take(scan, ':') ||
+				!schema_skip_value(scan, depth + 1)) {
+				return false;
+			}
+		} while (schema_take(scan, ','));
+		return schema_take(scan, '}');
+	case '[':
+		scan->pos += 1;
+		if (schema_take(scan, ']')) {
+			return true;
+		}
+		do {
+			if (!schema_skip_value(scan, depth + 1)) {
+				return false;
+			}
+		} while (schema_take(scan, ','));
+		return schema_take(scan, ']');
+	default:
+		return schema_number(scan, &number);
+	}
+}
+
+// Keys with escapes in them never match, they're skipped as unknown
+static const struct schemaField *schema_find_field(
+	const struct schemaObject *schema, size_t *hint, const char *key,
+	size_t key_len) {
+	for (size_t i = 0; i < schema->field_count; ++i) {
+		size_t index = (*hint + i) % schema->field_count;
+		const struct schemaField *field = &schema->fields[index];
+		if (strncmp(field->key, key, key_len) == 0 &&
+			field->key[key_len] == '\0') {
+			*hint = index + 1;
+			return field;
+		}
+	}
+	return NULL;
+}
+
+static bool schema_object(struct schemaScan *scan,
+	const struct schemaObject *schema, char *base, int depth);
+
+static bool schema_ints(struct schemaScan *scan, int *ints, size_t count) {
+	if (!schema_take(scan, '[')) {
+		return false;
+	}
+	if (schema_take(scan, ']')) {
+		return true;
+	}
+	size_t index = 0;
+	do {
+		double value;
+		if (!schema_number(scan, &value)) {
+			return false;
+		}
+		if (index < count) {
+			ints[index++] = (int)value;
+		}
+	} while (schema_take(scan, ','));
+	return schema_take(scan, ']');
+}
+
+static bool schema_objects(struct schemaScan *scan,
+	const struct schemaField *field, char *base, int depth) {
+	if (!schema_take(scan, '[')) {
+		return false;
+	}
+	int *count = (int *)(base + field->count_offset);
+	*count = 0;
+	if (schema_take(scan, ']')) {
+		return true;
+	}
+	do {
+		if ((size_t)*count == field->count) {
+			if (!schema_skip_value(scan, depth + 1)) {
+				return false;
+			}
+			continue;
+		}
+		char *element = base + field->offset + *count * field->size;
+		if (!schema_object(scan, field->object, element, depth + 1)) {
+			return false;
+		}
+		*count += 1;
+	} while (schema_take(scan, ','));
+	return schema_take(scan, ']');
+}
+
+static bool schema_value(struct schemaScan *scan,
+	const struct schemaField *field, char *base, int depth) {
+	char *member = base + field->offset;
+	double number;
+	switch (field->type) {
+	case SCHEMA_INT:
+		if (!schema_number(scan, &number)) {
+			return false;
+		}
+		*(int *)member = (int)number;
+		return true;
+	case SCHEMA_DOUBLE:
+		return schema_number(scan, (double *)member);
+	case SCHEMA_STRING:
+		return schema_string(scan, member, field->size);
+	case SCHEMA_INTS:
+		return schema_ints(scan, (int *)member, field->count);
+	case SCHEMA_OBJECT:
+		return schema_object(scan, field->object, member, depth + 1);
+	case SCHEMA_OBJECTS:
+		return schema_objects(scan, field, base, depth);
+	}
+	return false;
+}
+
+static bool schema_key(
+	struct schemaScan *scan, const char **key, size_t *key_len) {
+	if (!schema_take(scan, '"')) {
+		return false;
+	}
+	*key = scan->pos;
+	const char *end = memchr(scan->pos, '"', scan->end - scan->pos);
+	if (end == NULL) {
+		return false;
+	}
+	*key_len = end - scan->pos;
+	if (memchr(*key, '\\', *key_len) != NULL) {
+		// Escaped quote in the key, let the string reader deal with it
+		scan->pos -= 1;
+		*key_len = 0;
+		return schema_string(scan, NULL, 0);
+	}
+	scan->pos = end + 1;
+	return true;
+}
+
+static bool schema_object(struct schemaScan *scan,
+	const struct schemaObject *schema, char *base, int depth) {
+	if (depth == SCHEMA_MAX_DEPTH || !schema_take(scan, '{')) {
+		return false;
+	}
+	if (schema_take(scan, '}')) {
+		return true;
+	}
+	size_t hint = 0;
+	do {
+		const char *key;
+		size_t key_len;
+		if (!schema_key(scan, &key, &key_len) ||
+			!schema_take(scan, ':')) {
+			return false;
+		}
+		const struct schemaField *field =
+			schema_find_field(schema, &hint, key, key_len);
+		bool parsed;
+		if (field == NULL) {
+			scan->unknown_keys += 1;
+			parsed = schema_skip_value(scan, depth);
+		} else {
+			parsed = schema_value(scan, field, base, depth);
+		}
+		if (!parsed) {
+			return false;
+		}
+	} while (schema_take(scan, ','));
+	return schema_take(scan, '}');
+}
+
+// The envelope is an object like any other, except result goes elsewhere
+bool schema_parse(const char *payload, size_t payload_len,
+	const struct schemaObject *schema, void *result,
+	struct schemaReply *reply) {
+	memset(reply, 0, sizeof(*reply));
+	memset(result, 0, schema->size);
+	struct schemaScan scan = {payload, payload + payload_len, 0};
+	if (!schema_take(&scan, '{')) {
+		return false;
+	}
+	size_t hint = 0;
+	bool closed = schema_take(&scan, '}');
+	while (!closed) {
+		const char *key;
+		size_t key_len;
+		if (!schema_key(&scan, &key, &key_len) ||
+			!schema_take(&scan, ':')) {
+			return false;
+		}
+		bool parsed;
+		if (key_len == 6 && memcmp(key, "result", 6) == 0) {
+			parsed = schema_object(&scan, schema, result, 1);
+			reply->has_result = parsed;
+		} else {
+			const struct schemaField *field = schema_find_field(
+				&reply_object, &hint, key, key_len);
+			if (field == NULL) {
+				scan.unknown_keys += 1;
+				parsed = schema_skip_value(&scan, 1);
+			} else {
+				parsed = schema_value(
+					&scan, field, (char *)reply, 1);
+			}
+		}
+		if (!parsed) {
+			return false;
+		}
+		closed = !schema_take(&scan, ',');
+		if (closed && !schema_take(&scan, '}')) {
+			return false;
+		}
+	}
+	reply->unknown_keys = scan.unknown_keys;
+	return reply->has_result;
+}
@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "status.h"
+
+// Reply decoders that know the shape of the result they're after and fill a
+// fixed struct in one pass over the payload, where mjson would rescan it for
+// every field. Each result is described by a table of fields. Keys that
+// aren't in the table are skipped and counted, anything else unexpected such
+// as a string where a number should be makes the parse fail so the caller can
+// fall back to mjson.
+
+#define SCHEMA_STRING_LEN 32
+#define SCHEMA_LONG_STRING_LEN 64
+#define SCHEMA_MAX_DEPTH 16
+
+enum schemaType {
+	SCHEMA_INT,
+	SCHEMA_DOUBLE,
+	SCHEMA_STRING,
+	// Array of ints, count is the maximum kept
+	SCHEMA_INTS,
+	SCHEMA_OBJECT,
+	// Array of objects of size bytes each, count is the maximum kept and
+	// the number kept goes in the int at count_offset
+	SCHEMA_OBJECTS,
+};
+
+struct schemaObject;
+
+struct schemaField {
+	const char *key;
+	enum schemaType type;
+	size_t offset;
+	size_t size;
+	size_t count;
+	size_t count_offset;
+	const struct schemaObject *object;
+};
+
+struct schemaObject {
+	const struct schemaField *fields;
+	size_t field_count;
+	// Size of the struct the fields are in
+	size_t size;
+};
+
+// The parts of a reply around its result
+struct schemaReply {
+	int id;
+	int code;
+	char msg[SCHEMA_STRING_LEN];
+	bool has_result;
+	unsigned int unknown_keys;
+};
+
+struct schemaTemp {
+	int min;
+	int max;
+};
+
+struct schemaFilament {
+	int index;
+	char sku[SCHEMA_STRING_LEN];
+	char brand[SCHEMA_STRING_LEN];
+	char type[SCHEMA_STRING_LEN];
+	int color[3];
+	int rfid;
+	struct schemaTemp extruder_temp;
+	struct schemaTemp hotbed_temp;
+	double diameter;
+	int total;
+	int current;
+};
+
+struct schemaInfo {
+	int id;
+	int slots;
+	char model[SCHEMA_LONG_STRING_LEN];
+	char firmware[SCHEMA_STRING_LEN];
+	char boot_firmware[SCHEMA_STRING_LEN];
+};
+
+// Result of methods that reply with an empty object
+struct schemaEmpty {
+	bool empty;
+};
+
+extern const struct schemaObject schema_status;
+extern const struct schemaObject schema_filament;
+extern const struct schemaObject schema_info;
+extern const struct schemaObject schema_empty;
+
+// Parses a reply, filling result using its schema. Fields missing from the
+// reply are left zeroed. Returns false if the payload isn't the expected
+// shape.
+bool schema_parse(const char *payload, size_t payload_len,
+	const struct schemaObject *schema, void *result,
+	struct schemaReply *reply);
+
+static inline bool schema_parse_status(const char *payload,
+	size_t payload_len, struct statusState *state,
+	struct schemaReply *reply) {
+	return schema_parse(payload, payload_len, &schema_status, state, reply);
+}
+
+static inline bool schema_parse_filament(const char *payload,
+	size_t payload_len, struct schemaFilament *filament,
+	struct schemaReply *reply) {
+	return schema_parse(
+		payload, payload_len, &schema_filament, filament, reply);
+}
+
+static inline bool schema_parse_info(const char *payload, size_t payload_len,
+	struct schemaInfo *info, struct schemaReply *reply) {
+	return schema_parse(payload, payload_len, &schema_info, info, reply);
+}
+
+#endif
@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#include "session.h"
+
+static int session_left_ms(int64_t deadline) {
+	int64_t left_ms = (deadline - pipeline_now_us()) / 1000;
+	return (left_ms < 0) ? 0 : left_ms;
+}
+
+static bool session_wait_connected(struct session *s) {
+	int64_t deadline = pipeline_now_us() + SESSION_OPEN_TIMEOUT_MS * 1000LL;
+	while (!transport_connected(&s->p.t)) {
+		int left_ms = session_left_ms(deadline);
+		if (left_ms == 0 || pipeline_run(&s->p, left_ms) == -1) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool session_open(struct session *s, int (*open_tty)(void)) {
+	s->reply.done = true;
+	s->reply.view = (struct poolView){NULL, NULL, 0};
+	if (!pipeline_init(&s->p, open_tty)) {
+		return false;
+	}
+	return session_wait_connected(s);
+}
+
+void session_close(struct session *s) {
+	pipeline_release_future(&s->p, &s->reply);
+	pipeline_close(&s->p);
+}
+
+static const char *session_wait_reply(struct session *s, int id,
+	const char *method, const char *params) {
+	struct pipelineFuture *future = &s->reply;
+	pipeline_release_future(&s->p, future);
+	future->done = false;
+	if (!session_wait_connected(s)) {
+		return NULL;
+	}
+	if (!pipeline_call_id_future(&s->p, id, method, params, future)) {
+		return NULL;
+	}
+	// Replies time out in the pipeline, only a missing ACE can stall this
+	while (!future->done) {
+		if (!session_wait_connected(s) ||
+			pipeline_run(&s->p, -1) == -1) {
+			pipeline_cancel(&s->p);
+		}
+	}
+	return future->payload;
+}
+
+const char *session_call_id(
+	struct session *s, int id, const char *method, const char *params) {
+	return session_wait_reply(s, id, method, params);
+}
+
+bool session_call_view(struct session *s, int id, const char *method,
+	const char *params, struct poolView *view) {
+	session_wait_reply(s, id, method, params);
+	// Ownership moves to the caller, leaving the session nothing to free
+	*view = s->reply.view;
+	s->reply.view = (struct poolView){NULL, NULL, 0};
+	return !pool_view_empty(view);
+}
+
+const char *session_call(
+	struct session *s, const char *method, const char *params) {
+	return session_call_id(s, pipeline_next_id(&s->p), method, params);
+}
+
+bool session_run(struct session *s, int timeout_ms) {
+	pipeline_run(&s->p, timeout_ms);
+	return transport_connected(&s->p.t);
+}
+
+bool session_keepalive(struct session *s) {
+	return session_run(s, 0);
+}
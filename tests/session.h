@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pipeline.h"
+
+// A connection to the ACE that stays open across RPCs, made of a pipeline
+// that session_call waits on one request at a time. The keepalive is fed with
+// a get_status whenever the link goes idle, as long as something runs the
+// loop: session_call does, and session_run waits for events between calls. If
+// the ACE drops the connection anyway the transport reopens it and the
+// pipeline resends the request once.
+
+#define SESSION_OPEN_TIMEOUT_MS 10000
+
+struct session {
+	struct pipeline p;
+	// The last reply from session_call, released by the next call
+	struct pipelineFuture reply;
+};
+
+// Opens the ACE using open_tty, which returns -1 if it isn't there yet.
+// Returns false if it can't be opened in time.
+bool session_open(struct session *s, int (*open_tty)(void));
+void session_close(struct session *s);
+
+// Calls a method and waits for the reply, params is a JSON object or NULL.
+// Returns the reply payload or NULL on failure. The reply is valid until the
+// next call on the session.
+const char *session_call(
+	struct session *s, const char *method, const char *params);
+const char *session_call_id(
+	struct session *s, int id, const char *method, const char *params);
+
+// Calls a method like session_call_id but hands the reply over as a view to
+// keep for as long as needed, releasing it with pool_view_release. Returns
+// false on failure or if there's no pool space left to keep the reply in.
+bool session_call_view(struct session *s, int id, const char *method,
+	const char *params, struct poolView *view);
+
+// Handles events for up to timeout_ms, -1 waits forever. Returns false if
+// the ACE isn't connected.
+bool session_run(struct session *s, int timeout_ms);
+
+// Handles any events that are due without waiting
+bool session_keepalive(struct session *s);
+
+#endif
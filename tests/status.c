@@ -0,0 +1,215 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mjson.h"
+#include "schema.h"
+#include "status.h"
+
+// Mixes in a word at a time, this only needs to notice changes
+static uint64_t status_hash(uint64_t hash, const char *buf, size_t len) {
+	const uint64_t mul = 0x9E3779B97F4A7C15ull;
+	while (len >= sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, buf, sizeof(word));
+		hash = (hash ^ word) * mul;
+		hash ^= (hash >> 32);
+		buf += sizeof(word);
+		len -= sizeof(word);
+	}
+	uint64_t tail = len;
+	memcpy(&tail, buf, len);
+	hash = (hash ^ tail ^ ((uint64_t)len << 56)) * mul;
+	return hash ^ (hash >> 29);
+}
+
+static uint64_t status_hash_payload(const char *payload, size_t payload_len) {
+	const char *id;
+	int id_len;
+	int tok = mjson_find(payload, payload_len, "$.id", &id, &id_len);
+	if (tok != MJSON_TOK_NUMBER) {
+		return status_hash(0, payload, payload_len);
+	}
+	size_t before = id - payload;
+	size_t after = before + id_len;
+	uint64_t hash = status_hash(0, payload, before);
+	return status_hash(hash, payload + after, payload_len - after);
+}
+
+static void status_get_string(const char *buf, int len, const char *path,
+	char *to, size_t size) {
+	if (mjson_get_string(buf, len, path, to, size) < 0) {
+		to[0] = '\0';
+	}
+}
+
+static int status_get_int(const char *buf, int len, const char *path) {
+	double value = 0;
+	mjson_get_number(buf, len, path, &value);
+	return (int)value;
+}
+
+static void status_parse_slot(
+	const char *buf, int len, struct statusSlot *slot) {
+	slot->index = status_get_int(buf, len, "$.index");
+	status_get_string(
+		buf, len, "$.status", slot->status, sizeof(slot->status));
+	status_get_string(buf, len, "$.sku", slot->sku, sizeof(slot->sku));
+	status_get_string(
+		buf, len, "$.brand", slot->brand, sizeof(slot->brand));
+	status_get_string(buf, len, "$.type", slot->type, sizeof(slot->type));
+	for (int i = 0; i < 3; ++i) {
+		char path[16];
+		snprintf(path, sizeof(path), "$.color[%d]", i);
+		slot->color[i] = status_get_int(buf, len, path);
+	}
+	slot->rfid = status_get_int(buf, len, "$.rfid");
+}
+
+bool status_parse(const char *payload, size_t payload_len,
+	struct statusState *state) {
+	const char *result;
+	int result_len;
+	int tok = mjson_find(
+		payload, payload_len, "$.result", &result, &result_len);
+	if (tok != MJSON_TOK_OBJECT) {
+		return false;
+	}
+	memset(state, 0, sizeof(*state));
+	status_get_string(result, result_len, "$.status", state->status,
+		sizeof(state->status));
+	status_get_string(result, result_len, "$.action", state->action,
+		sizeof(state->action));
+	struct statusDryer *dryer = &state->dryer;
+	status_get_string(result, result_len, "$.dryer_status.status",
+		dryer->status, sizeof(dryer->status));
+	dryer->target_temp = status_get_int(
+		result, result_len, "$.dryer_status.target_temp");
+	dryer->duration =
+		status_get_int(result, result_len, "$.dryer_status.duration");
+	dryer->remain_time = status_get_int(
+		result, result_len, "$.dryer_status.remain_time");
+	state->temp = status_get_int(result, result_len, "$.temp");
+	state->enable_rfid =
+		status_get_int(result, result_len, "$.enable_rfid");
+	state->fan_speed = status_get_int(result, result_len, "$.fan_speed");
+	state->feed_assist_count =
+		status_get_int(result, result_len, "$.feed_assist_count");
+	mjson_get_number(result, result_len, "$.cont_assist_time",
+		&state->cont_assist_time);
+
+	const char *slots;
+	int slots_len;
+	tok = mjson_find(result, result_len, "$.slots", &slots, &slots_len);
+	if (tok != MJSON_TOK_ARRAY) {
+		return true;
+	}
+	int offset = 0;
+	int value_offset, value_len, value_type;
+	while (state->slot_count < STATUS_MAX_SLOTS &&
+		(offset = mjson_next(slots, slots_len, offset, NULL, NULL,
+			 &value_offset, &value_len, &value_type)) != 0) {
+		if (value_type != MJSON_TOK_OBJECT) {
+			continue;
+		}
+		struct statusSlot *slot = &state->slots[state->slot_count++];
+		status_parse_slot(slots + value_offset, value_len, slot);
+	}
+	return true;
+}
+
+static bool status_slot_equal(
+	const struct statusSlot *a, const struct statusSlot *b) {
+	return a->index == b->index && strcmp(a->status, b->status) == 0 &&
+		strcmp(a->sku, b->sku) == 0 &&
+		strcmp(a->brand, b->brand) == 0 &&
+		strcmp(a->type, b->type) == 0 &&
+		memcmp(a->color, b->color, sizeof(a->color)) == 0 &&
+		a->rfid == b->rfid;
+}
+
+static void status_diff(const struct statusState *old,
+	const struct statusState *new, struct statusDiff *diff) {
+	diff->fields = 0;
+	diff->slots = 0;
+	if (strcmp(old->status, new->status) != 0) {
+		diff->fields |= STATUS_FIELD_STATUS;
+	}
+	if (strcmp(old->action, new->action) != 0) {
+		diff->fields |= STATUS_FIELD_ACTION;
+	}
+	const struct statusDryer *a = &old->dryer;
+	const struct statusDryer *b = &new->dryer;
+	if (strcmp(a->status, b->status) != 0 ||
+		a->target_temp != b->target_temp ||
+		a->duration != b->duration ||
+		a->remain_time != b->remain_time) {
+		diff->fields |= STATUS_FIELD_DRYER;
+	}
+	if (old->temp != new->temp) {
+		diff->fields |= STATUS_FIELD_TEMP;
+	}
+	if (old->fan_speed != new->fan_speed) {
+		diff->fields |= STATUS_FIELD_FAN_SPEED;
+	}
+	for (int i = 0; i < STATUS_MAX_SLOTS; ++i) {
+		bool in_old = (i < old->slot_count);
+		bool in_new = (i < new->slot_count);
+		if (in_old != in_new || (in_old && !status_slot_equal(
+			&old->slots[i], &new->slots[i]))) {
+			diff->slots |= (1u << i);
+		}
+	}
+	if (diff->slots != 0) {
+		diff->fields |= STATUS_FIELD_SLOTS;
+	}
+}
+
+void status_cache_init(struct statusCache *cache) {
+	cache->valid = false;
+	cache->hash = 0;
+	memset(&cache->state, 0, sizeof(cache->state));
+	memset(&cache->stats, 0, sizeof(cache->stats));
+}
+
+enum statusResult status_cache_update(struct statusCache *cache,
+	const char *payload, size_t payload_len, struct statusDiff *diff) {
+	cache->stats.updates += 1;
+	uint64_t hash = status_hash_payload(payload, payload_len);
+	if (cache->valid && hash == cache->hash) {
+		cache->stats.unchanged += 1;
+		return STATUS_UNCHANGED;
+	}
+	struct statusState state;
+	struct schemaReply reply;
+	cache->stats.parses += 1;
+	if (!schema_parse_status(payload, payload_len, &state, &reply) ||
+		reply.unknown_keys != 0) {
+		// Not what the schema expects, mjson can still pick fields out
+		cache->stats.fallbacks += 1;
+		if (!status_parse(payload, payload_len, &state)) {
+			cache->stats.invalid += 1;
+			return STATUS_INVALID;
+		}
+	}
+	if (cache->valid) {
+		status_diff(&cache->state, &state, diff);
+	} else {
+		diff->fields = STATUS_FIELD_STATUS | STATUS_FIELD_ACTION |
+			STATUS_FIELD_DRYER | STATUS_FIELD_TEMP |
+			STATUS_FIELD_FAN_SPEED | STATUS_FIELD_SLOTS;
+		diff->slots = (1u << STATUS_MAX_SLOTS) - 1;
+	}
+	cache->valid = true;
+	cache->hash = hash;
+	cache->state = state;
+	if (diff->fields == 0) {
+		// Something changed that isn't kept, like feed_assist_count
+		cache->stats.unchanged += 1;
+		return STATUS_UNCHANGED;
+	}
+	cache->stats.changed += 1;
+	return STATUS_CHANGED;
+}
@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Keeps the last get_status reply and works out what changed in a new one.
+// Replies almost never change between polls apart from the id, so each reply
+// is hashed with the id's value left out and only parsed if the hash differs
+// from the last one.
+
+#define STATUS_MAX_SLOTS 4
+#define STATUS_STRING_LEN 32
+
+struct statusDryer {
+	char status[STATUS_STRING_LEN];
+	int target_temp;
+	int duration;
+	int remain_time;
+};
+
+struct statusSlot {
+	int index;
+	char status[STATUS_STRING_LEN];
+	char sku[STATUS_STRING_LEN];
+	char brand[STATUS_STRING_LEN];
+	char type[STATUS_STRING_LEN];
+	int color[3];
+	int rfid;
+};
+
+struct statusState {
+	char status[STATUS_STRING_LEN];
+	char action[STATUS_STRING_LEN];
+	struct statusDryer dryer;
+	int temp;
+	int enable_rfid;
+	int fan_speed;
+	int feed_assist_count;
+	double cont_assist_time;
+	int slot_count;
+	struct statusSlot slots[STATUS_MAX_SLOTS];
+};
+
+enum statusField {
+	STATUS_FIELD_STATUS = (1 << 0),
+	STATUS_FIELD_ACTION = (1 << 1),
+	STATUS_FIELD_DRYER = (1 << 2),
+	STATUS_FIELD_TEMP = (1 << 3),
+	STATUS_FIELD_FAN_SPEED = (1 << 4),
+	STATUS_FIELD_SLOTS = (1 << 5),
+};
+
+struct statusDiff {
+	// Mask of enum statusField
+	unsigned int fields;
+	// Mask of slots by position, set if a slot was added or removed too
+	unsigned int slots;
+};
+
+enum statusResult {
+	STATUS_UNCHANGED,
+	STATUS_CHANGED,
+	STATUS_INVALID,
+};
+
+struct statusCacheStats {
+	unsigned long updates;
+	unsigned long parses;
+	// Parses the schema decoder couldn't handle
+	unsigned long fallbacks;
+	unsigned long unchanged;
+	unsigned long changed;
+	unsigned long invalid;
+};
+
+struct statusCache {
+	bool valid;
+	uint64_t hash;
+	struct statusState state;
+	struct statusCacheStats stats;
+};
+
+void status_cache_init(struct statusCache *cache);
+
+// Updates the cache from a get_status reply payload. On STATUS_CHANGED diff
+// says what changed, everything is changed for the first reply. Changes to
+// fields that aren't kept count as STATUS_UNCHANGED. Invalid replies leave the
+// cache as it was.
+enum statusResult status_cache_update(struct statusCache *cache,
+	const char *payload, size_t payload_len, struct statusDiff *diff);
+
+// Parses a get_status reply payload field by field with mjson, without any
+// caching. This is the slow path for replies the schema decoder can't handle.
+bool status_parse(const char *payload, size_t payload_len,
+	struct statusState *state);
+
+#endif
@@ -0,0 +1,363 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "strace.h"
+
+struct straceScan {
+	const char *pos;
+	const char *end;
+};
+
+static bool strace_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+static void strace_skip_spaces(struct straceScan *scan) {
+	while (scan->pos < scan->end && *scan->pos == ' ') {
+		scan->pos += 1;
+	}
+}
+
+static bool strace_take(struct straceScan *scan, const char *text) {
+	size_t len = strlen(text);
+	if ((size_t)(scan->end - scan->pos) < len ||
+		memcmp(scan->pos, text, len) != 0) {
+		return false;
+	}
+	scan->pos += len;
+	return true;
+}
+
+static bool strace_long(struct straceScan *scan, long *value) {
+	bool negative = strace_take(scan, "-");
+	if (scan->pos == scan->end || !strace_digit(*scan->pos)) {
+		return false;
+	}
+	long number = 0;
+	while (scan->pos < scan->end && strace_digit(*scan->pos)) {
+		number = number * 10 + (*scan->pos++ - '0');
+	}
+	*value = negative ? -number : number;
+	return true;
+}
+
+// Timestamps look like 12:34:56, 12:34:56.123456 or 1712345678.123456
+static bool strace_timestamp(struct straceScan *scan, double *timestamp) {
+	const char *start = scan->pos;
+	double seconds = 0;
+	long part;
+	while (strace_long(scan, &part)) {
+		seconds = seconds * 60 + part;
+		if (!strace_take(scan, ":")) {
+			break;
+		}
+	}
+	if (scan->pos == start) {
+		return false;
+	}
+	if (strace_take(scan, ".")) {
+		double scale = 0.1;
+		while (scan->pos < scan->end && strace_digit(*scan->pos)) {
+			seconds += (*scan->pos++ - '0') * scale;
+			scale /= 10;
+		}
+	}
+	*timestamp = seconds;
+	return true;
+}
+
+static int strace_octal(struct straceScan *scan) {
+	int value = 0;
+	for (int i = 0; i < 3 && scan->pos < scan->end; ++i) {
+		char c = *scan->pos;
+		if (c < '0' || c > '7') {
+			break;
+		}
+		value = value * 8 + (c - '0');
+		scan->pos += 1;
+	}
+	return value & 0xFF;
+}
+
+static int strace_hex(struct straceScan *scan) {
+	int value = 0;
+	for (int i = 0; i < 2 && scan->pos < scan->end; ++i) {
+		char c = *scan->pos;
+		int digit;
+		if (strace_digit(c)) {
+			digit = c - '0';
+		} else if (c >= 'a' && c <= 'f') {
+			digit = c - 'a' + 10;
+		} else if (c >= 'A' && c <= 'F') {
+			digit = c - 'A' + 10;
+		} else {
+			break;
+		}
+		value = value * 16 + digit;
+		scan->pos += 1;
+	}
+	return value;
+}
+
+static int strace_escape(struct straceScan *scan) {
+	char c = *scan->pos;
+	if (c >= '0' && c <= '7') {
+		return strace_octal(scan);
+	}
+	scan->pos += 1;
+	switch (c) {
+	case 'x':
+		return strace_hex(scan);
+	case 'n':
+		return '\n';
+	case 't':
+		return '\t';
+	case 'r':
+		return '\r';
+	case 'v':
+		return '\v';
+	case 'f':
+		return '\f';
+	case 'a':
+		return '\a';
+	case 'b':
+		return '\b';
+	default:
+		return c;
+	}
+}
+
+static bool strace_string(
+	struct straceScan *scan, unsigned char *buf, size_t *len) {
+	if (!strace_take(scan, "\"")) {
+		return false;
+	}
+	size_t out = 0;
+	while (scan->pos < scan->end && *scan->pos != '"') {
+		char c = *scan->pos++;
+		if (c == '\\' && scan->pos < scan->end) {
+			buf[out++] = strace_escape(scan);
+		} else {
+			buf[out++] = c;
+		}
+	}
+	*len = out;
+	return strace_take(scan, "\"");
+}
+
+// The rest of a line after a call's arguments
+static bool strace_finish(struct straceScan *scan, struct straceCall *call) {
+	long number;
+	static const char unfinished[] = "<unfinished ...>";
+	const char *rest = scan->pos;
+	const char *end = scan->end;
+	while (end > rest && (end[-1] == '\n' || end[-1] == ' ')) {
+		end -= 1;
+	}
+	size_t rest_len = end - rest;
+	size_t unfinished_len = sizeof(unfinished) - 1;
+	if (rest_len >= unfinished_len &&
+		memcmp(end - unfinished_len, unfinished, unfinished_len) == 0) {
+		call->kind = STRACE_UNFINISHED;
+		return true;
+	}
+	// Skip the count argument, the result says what was transferred
+	const char *close = memchr(rest, ')', rest_len);
+	if (close == NULL) {
+		return false;
+	}
+	scan->pos = close + 1;
+	strace_skip_spaces(scan);
+	if (!strace_take(scan, "=")) {
+		return false;
+	}
+	strace_skip_spaces(scan);
+	call->result = -1;
+	if (strace_long(scan, &number)) {
+		call->result = number;
+	}
+	return true;
+}
+
+static bool strace_data(struct straceScan *scan, struct straceCall *call,
+	unsigned char *buf) {
+	if (scan->pos == scan->end || *scan->pos != '"') {
+		return true;
+	}
+	if (!strace_string(scan, buf, &call->data_len)) {
+		return false;
+	}
+	call->has_data = true;
+	call->truncated = strace_take(scan, "...");
+	return true;
+}
+
+bool strace_parse_line(const char *line, size_t line_len,
+	struct straceCall *call, unsigned char *buf) {
+	struct straceScan scan = {line, line + line_len};
+	long number;
+	call->kind = STRACE_COMPLETE;
+	call->pid = -1;
+	call->fd = -1;
+	call->timestamp = -1;
+	call->result = -1;
+	call->data = buf;
+	call->data_len = 0;
+	call->has_data = false;
+	call->truncated = false;
+	strace_skip_spaces(&scan);
+	// The pid column is only a number, a timestamp has : or . in it
+	const char *start = scan.pos;
+	if (strace_long(&scan, &number) && scan.pos < scan.end &&
+		*scan.pos == ' ') {
+		call->pid = number;
+		strace_skip_spaces(&scan);
+	} else {
+		scan.pos = start;
+	}
+	if (strace_timestamp(&scan, &call->timestamp)) {
+		strace_skip_spaces(&scan);
+	}
+	if (strace_take(&scan, "<... ")) {
+		call->kind = STRACE_RESUMED;
+	}
+	if (strace_take(&scan, "read")) {
+		call->direction = STRACE_READ;
+	} else if (strace_take(&scan, "write")) {
+		call->direction = STRACE_WRITE;
+	} else {
+		return false;
+	}
+	if (call->kind == STRACE_RESUMED) {
+		if (!strace_take(&scan, " resumed>")) {
+			return false;
+		}
+		strace_skip_spaces(&scan);
+		if (!strace_data(&scan, call, buf)) {
+			return false;
+		}
+		return strace_finish(&scan, call) &&
+		       call->kind == STRACE_RESUMED;
+	}
+	if (!strace_take(&scan, "(") || !strace_long(&scan, &number) ||
+		!strace_take(&scan, ",")) {
+		return false;
+	}
+	call->fd = number;
+	strace_skip_spaces(&scan);
+	if (!strace_data(&scan, call, buf)) {
+		return false;
+	}
+	return strace_finish(&scan, call);
+}
+
+void strace_reader_init(struct straceReader *r) {
+	memset(r, 0, sizeof(*r));
+}
+
+void strace_reader_free(struct straceReader *r) {
+	free(r->buf);
+	memset(r, 0, sizeof(*r));
+}
+
+void strace_reader_reset(struct straceReader *r) {
+	for (int i = 0; i < STRACE_MAX_PENDING; ++i) {
+		if (r->pending[i].used) {
+			r->pending[i].used = false;
+			r->stats.unmatched += 1;
+		}
+	}
+}
+
+static bool strace_grow(unsigned char **buf, size_t *cap, size_t len) {
+	if (*cap >= len) {
+		return true;
+	}
+	unsigned char *grown = realloc(*buf, len);
+	if (grown == NULL) {
+		return false;
+	}
+	*buf = grown;
+	*cap = len;
+	return true;
+}
+
+static struct stracePending *strace_find_pending(
+	struct straceReader *r, const struct straceCall *call) {
+	for (int i = 0; i < STRACE_MAX_PENDING; ++i) {
+		struct stracePending *pending = &r->pending[i];
+		if (pending->used && pending->call.pid == call->pid) {
+			return pending;
+		}
+	}
+	return NULL;
+}
+
+// A thread makes one call at a time, so a call still held for a pid making
+// another lost its end
+static void strace_drop_pending(
+	struct straceReader *r, const struct straceCall *call) {
+	struct stracePending *pending = strace_find_pending(r, call);
+	if (pending != NULL) {
+		pending->used = false;
+		r->stats.unmatched += 1;
+	}
+}
+
+// Keeps the start of a call without its data
+static void strace_hold(struct straceReader *r, const struct straceCall *call) {
+	struct stracePending *pending = NULL;
+	strace_drop_pending(r, call);
+	for (int i = 0; pending == NULL && i < STRACE_MAX_PENDING; ++i) {
+		if (!r->pending[i].used) {
+			pending = &r->pending[i];
+		}
+	}
+	if (pending == NULL) {
+		r->stats.unmatched += 1;
+		return;
+	}
+	pending->call = *call;
+	pending->call.data = NULL;
+	pending->used = true;
+}
+
+bool strace_reader_line(struct straceReader *r, const char *line,
+	size_t line_len, struct straceCall *call) {
+	r->stats.lines += 1;
+	if (!strace_grow(&r->buf, &r->buf_cap, line_len) ||
+		!strace_parse_line(line, line_len, call, r->buf)) {
+		return false;
+	}
+	if (call->kind == STRACE_COMPLETE) {
+		strace_drop_pending(r, call);
+	} else if (call->kind == STRACE_UNFINISHED) {
+		strace_hold(r, call);
+		// Writes show their data up front, pass them on now in case the
+		// end got filtered out of the log
+		if (!call->has_data) {
+			return false;
+		}
+		call->result = call->data_len;
+	} else if (call->kind == STRACE_RESUMED) {
+		struct stracePending *pending = strace_find_pending(r, call);
+		if (pending == NULL ||
+			pending->call.direction != call->direction) {
+			r->stats.unmatched += 1;
+			return false;
+		}
+		pending->used = false;
+		r->stats.resumed += 1;
+		if (pending->call.has_data) {
+			return false;
+		}
+		call->fd = pending->call.fd;
+		call->timestamp = pending->call.timestamp;
+	}
+	r->stats.calls += 1;
+	r->stats.truncated += call->truncated;
+	return true;
+}
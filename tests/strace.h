@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#ifndef STRACE_H
+#define STRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Reads the read and write calls out of strace logs like those in raw_data,
+// with or without -f's pid column and -t, -tt or -ttt timestamps. Other
+// calls and anything else are skipped.
+//
+// With -f a call can be split over two lines when another process gets in
+// the way: "read(17,  <unfinished ...>" then later "<... read resumed>" with
+// the data and result. A reader pairs these back up by pid.
+
+enum straceDirection {
+	STRACE_READ,
+	STRACE_WRITE,
+};
+
+enum straceKind {
+	STRACE_COMPLETE,
+	// The start of a call, with the data for writes
+	STRACE_UNFINISHED,
+	// The end of a call, with the data for reads and no fd
+	STRACE_RESUMED,
+};
+
+struct straceCall {
+	enum straceKind kind;
+	enum straceDirection direction;
+	int pid;
+	int fd;
+	// Seconds since midnight or the epoch depending on the -t option, or
+	// -1 without timestamps
+	double timestamp;
+	// Bytes read or written according to the return value, or -1
+	long result;
+	// The data shown, which strace may have cut short
+	unsigned char *data;
+	size_t data_len;
+	bool has_data;
+	bool truncated;
+};
+
+// Parses a line, unescaping its data in to buf which needs to be at least
+// line_len bytes. Returns false if the line isn't a read or write.
+bool strace_parse_line(const char *line, size_t line_len,
+	struct straceCall *call, unsigned char *buf);
+
+#define STRACE_MAX_PENDING 16
+
+struct stracePending {
+	bool used;
+	struct straceCall call;
+};
+
+struct straceStats {
+	unsigned long lines;
+	unsigned long calls;
+	unsigned long resumed;
+	// Resumed calls with no start, starts that never resumed, and starts
+	// dropped for lack of room
+	unsigned long unmatched;
+	unsigned long truncated;
+};
+
+struct straceReader {
+	struct stracePending pending[STRACE_MAX_PENDING];
+	unsigned char *buf;
+	size_t buf_cap;
+	struct straceStats stats;
+};
+
+void strace_reader_init(struct straceReader *r);
+void strace_reader_free(struct straceReader *r);
+// Forgets calls waiting to resume, counting them as unmatched, before
+// reading another log. Stats carry on.
+void strace_reader_reset(struct straceReader *r);
+
+// Feeds a line, returning true with a complete call if it finishes one. The
+// call's data is valid until the next line. Writes are returned as soon as
+// they start, taking all their data as written, as the end may never show
+// up. Returns false on running out of memory too, which stats don't count.
+bool strace_reader_line(struct straceReader *r, const char *line,
+	size_t line_len, struct straceCall *call);
+
+#endif
@@ -0,0 +1,208 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "framescan.h"
+
+// Adds up frame stores made by ingest:
+//
+//   ./survey [-j THREADS] [-m METHOD]... [-d read|write] [-c] STORE...
+//
+// -m and -d only count matching frames, -c lists the commands sent other
+// than get_status along with how many polls came between them.
+
+static const char *survey_directions[2] = {"read", "write"};
+
+static int64_t survey_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static const char *survey_method(unsigned int slot) {
+	const char *name = NULL;
+	if (slot != FRAMESCAN_UNKNOWN_SLOT) {
+		name = framestore_method_name(slot);
+	}
+	return name ? name : "(unknown)";
+}
+
+static void survey_methods(const struct framescanTable *table) {
+	for (int i = 0; i < FRAMESCAN_METHODS; ++i) {
+		for (int j = 0; j < 2; ++j) {
+			const struct framescanCell *cell = &table->cells[i][j];
+			if (cell->frames == 0) {
+				continue;
+			}
+			fprintf(stdout,
+				"%s %s: %lu frames, %lu bytes, %u to %u "
+				"bytes each, %lu bad CRCs\n",
+				survey_method(i), survey_directions[j],
+				cell->frames, cell->bytes, cell->min_size,
+				cell->max_size, cell->bad_crcs);
+		}
+	}
+}
+
+static void survey_sizes(const struct framescanTable *table) {
+	for (int j = 0; j < 2; ++j) {
+		unsigned long sizes[FRAMESCAN_SIZE_BUCKETS] = {0};
+		unsigned long frames = 0;
+		unsigned long bad_crcs = 0;
+		for (int i = 0; i < FRAMESCAN_METHODS; ++i) {
+			const struct framescanCell *cell = &table->cells[i][j];
+			for (int k = 0; k < FRAMESCAN_SIZE_BUCKETS; ++k) {
+				sizes[k] += cell->sizes[k];
+			}
+			frames += cell->frames;
+			bad_crcs += cell->bad_crcs;
+		}
+		if (frames == 0) {
+			continue;
+		}
+		fprintf(stdout, "%s sizes:", survey_directions[j]);
+		for (int k = 0; k < FRAMESCAN_SIZE_BUCKETS - 1; ++k) {
+			if (sizes[k] != 0) {
+				fprintf(stdout, " <%u: %lu", 32u << k,
+					sizes[k]);
+			}
+		}
+		if (sizes[FRAMESCAN_SIZE_BUCKETS - 1] != 0) {
+			fprintf(stdout, " more: %lu",
+				sizes[FRAMESCAN_SIZE_BUCKETS - 1]);
+		}
+		fprintf(stdout, "\n");
+		const struct framescanIDs *ids = &table->ids[j];
+		fprintf(stdout,
+			"%s CRC failures: %lu of %lu (%.3f%%), id gaps: %lu "
+			"missing %lu, went back %lu times\n",
+			survey_directions[j], bad_crcs, frames,
+			100.0 * bad_crcs / frames, ids->gaps, ids->missing,
+			ids->backwards);
+	}
+}
+
+// Lists commands in order, which a parallel scan can't do
+static void survey_commands(const struct framescan *scan,
+	const struct framescanFilter *filter, char *names[]) {
+	uint16_t get_status = framestore_method_code("get_status", 10);
+	for (size_t i = 0; i < scan->store_count; ++i) {
+		const struct framestoreReader *store = &scan->stores[i];
+		fprintf(stdout, "-- COMMANDS: %s --\n", names[i]);
+		unsigned long polls = 0;
+		for (size_t n = 0; n < store->count; ++n) {
+			const struct framestoreRecord *rec = &store->records[n];
+			if (rec->direction != FRAMESTORE_WRITE ||
+				!framescan_match(filter, rec)) {
+				continue;
+			}
+			if (rec->method == get_status) {
+				polls += 1;
+				continue;
+			}
+			fprintf(stdout,
+				"frame %zu: %s id %d after %lu polls\n", n,
+				survey_method(framescan_slot(rec->method)),
+				rec->id, polls);
+			polls = 0;
+		}
+	}
+}
+
+static bool survey_filter_method(
+	struct framescanFilter *filter, const char *name) {
+	uint16_t code = framestore_method_code(name, strlen(name));
+	if (code == FRAMESTORE_METHOD_UNKNOWN) {
+		return false;
+	}
+	filter->methods |= 1u << framescan_slot(code);
+	return true;
+}
+
+static bool survey_filter_direction(
+	struct framescanFilter *filter, const char *name) {
+	for (int i = 0; i < 2; ++i) {
+		if (strcmp(name, survey_directions[i]) == 0) {
+			filter->directions |=
+				1u << (i ? FRAMESTORE_WRITE : FRAMESTORE_READ);
+			return true;
+		}
+	}
+	return false;
+}
+
+int main(int argc, char *argv[]) {
+	struct framescanFilter filter = {0};
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	bool commands = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "j:m:d:c")) != -1) {
+		bool ok = true;
+		if (opt == 'j') {
+			threads = atoi(optarg);
+			ok = threads > 0;
+		} else if (opt == 'm') {
+			ok = survey_filter_method(&filter, optarg);
+		} else if (opt == 'd') {
+			ok = survey_filter_direction(&filter, optarg);
+		} else if (opt == 'c') {
+			commands = true;
+		} else {
+			ok = false;
+		}
+		if (!ok) {
+			optind = argc;
+			break;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr,
+			"Usage: %s [-j THREADS] [-m METHOD]... "
+			"[-d read|write] [-c] STORE...\n",
+			argv[0]);
+		return 1;
+	}
+	if (threads < 1) {
+		threads = 1;
+	}
+	static struct framescan scan;
+	framescan_init(&scan);
+	for (int i = optind; i < argc; ++i) {
+		if (!framescan_add(&scan, argv[i])) {
+			fprintf(stderr, "Couldn't map frame store %s\n",
+				argv[i]);
+			framescan_free(&scan);
+			return 1;
+		}
+	}
+	struct framescanTable table;
+	int64_t start = survey_now_ns();
+	if (!framescan_run(&scan, &filter, threads, &table)) {
+		fprintf(stderr, "Couldn't start all threads\n");
+	}
+	int64_t elapsed = survey_now_ns() - start;
+	fprintf(stdout, "-- FRAME SURVEY --\n");
+	fprintf(stdout,
+		"Scanned %lu frames in %zu stores using up to %d threads in "
+		"%.3f ms, %lu matched\n",
+		table.scanned, scan.store_count, threads, elapsed / 1e6,
+		table.matched);
+	if (table.first_ns >= 0) {
+		fprintf(stdout, "Captured over %.3f s\n",
+			(table.last_ns - table.first_ns) / 1e9);
+	}
+	survey_methods(&table);
+	survey_sizes(&table);
+	if (commands) {
+		survey_commands(&scan, &filter, &argv[optind]);
+	}
+	framescan_free(&scan);
+	return 0;
+}
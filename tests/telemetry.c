@@ -0,0 +1,324 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#define _DEFAULT_SOURCE
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "telemetry.h"
+
+#define TELEMETRY_BYTE_ORDER 0x01020304
+
+// Words the ACE uses for statuses and actions. New words must go on the end
+// so old logs keep their meaning.
+static const char *const telemetry_words[] = {
+	"",
+	"ready",
+	"busy",
+	"stop",
+	"drying",
+	"feeding",
+	"unwinding",
+	"shifting",
+	"empty",
+};
+
+#define TELEMETRY_WORD_COUNT \
+	(sizeof(telemetry_words) / sizeof(*telemetry_words))
+
+uint8_t telemetry_word_code(const char *word) {
+	for (size_t i = 0; i < TELEMETRY_WORD_COUNT; ++i) {
+		if (strcmp(telemetry_words[i], word) == 0) {
+			return i;
+		}
+	}
+	return TELEMETRY_WORD_OTHER;
+}
+
+const char *telemetry_word(uint8_t code) {
+	if (code >= TELEMETRY_WORD_COUNT) {
+		return "?";
+	}
+	return telemetry_words[code];
+}
+
+static int16_t telemetry_clamp16(int value) {
+	if (value < INT16_MIN) {
+		return INT16_MIN;
+	} else if (value > INT16_MAX) {
+		return INT16_MAX;
+	}
+	return value;
+}
+
+static void telemetry_make_row(struct telemetryRow *row, int64_t time_us,
+	const struct statusState *state) {
+	memset(row, 0, sizeof(*row));
+	row->time_us = time_us;
+	row->dryer_remain = state->dryer.remain_time;
+	row->temp = telemetry_clamp16(state->temp);
+	row->dryer_target = telemetry_clamp16(state->dryer.target_temp);
+	row->fan_speed = (state->fan_speed < 0 || state->fan_speed > UINT16_MAX)
+				 ? UINT16_MAX
+				 : state->fan_speed;
+	row->status = telemetry_word_code(state->status);
+	row->action = telemetry_word_code(state->action);
+	row->dryer_status = telemetry_word_code(state->dryer.status);
+	row->slot_count = state->slot_count;
+	for (int i = 0; i < state->slot_count && i < STATUS_MAX_SLOTS; ++i) {
+		const struct statusSlot *slot = &state->slots[i];
+		row->slot_status[i] = telemetry_word_code(slot->status);
+		row->slot_rfid[i] = slot->rfid;
+	}
+}
+
+// True if everything but the time matches, the fields after it are packed
+static bool telemetry_same_row(
+	const struct telemetryRow *a, const struct telemetryRow *b) {
+	size_t start = offsetof(struct telemetryRow, dryer_remain);
+	size_t end = offsetof(struct telemetryRow, slot_rfid) +
+		     sizeof(a->slot_rfid);
+	return memcmp((const char *)a + start, (const char *)b + start,
+		       end - start) == 0;
+}
+
+static void telemetry_block_row(const struct telemetryBlock *block, size_t n,
+	struct telemetryRow *row) {
+	memset(row, 0, sizeof(*row));
+	row->time_us = block->time_us[n];
+	row->dryer_remain = block->dryer_remain[n];
+	row->temp = block->temp[n];
+	row->dryer_target = block->dryer_target[n];
+	row->fan_speed = block->fan_speed[n];
+	row->status = block->status[n];
+	row->action = block->action[n];
+	row->dryer_status = block->dryer_status[n];
+	row->slot_count = block->slot_count[n];
+	for (int i = 0; i < STATUS_MAX_SLOTS; ++i) {
+		row->slot_status[i] = block->slot_status[i][n];
+		row->slot_rfid[i] = block->slot_rfid[i][n];
+	}
+}
+
+static void telemetry_block_store(struct telemetryBlock *block, size_t n,
+	const struct telemetryRow *row) {
+	block->time_us[n] = row->time_us;
+	block->dryer_remain[n] = row->dryer_remain;
+	block->temp[n] = row->temp;
+	block->dryer_target[n] = row->dryer_target;
+	block->fan_speed[n] = row->fan_speed;
+	block->status[n] = row->status;
+	block->action[n] = row->action;
+	block->dryer_status[n] = row->dryer_status;
+	block->slot_count[n] = row->slot_count;
+	for (int i = 0; i < STATUS_MAX_SLOTS; ++i) {
+		block->slot_status[i][n] = row->slot_status[i];
+		block->slot_rfid[i][n] = row->slot_rfid[i];
+	}
+}
+
+static void telemetry_make_header(struct telemetryHeader *header) {
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, TELEMETRY_MAGIC, sizeof(TELEMETRY_MAGIC));
+	header->version = TELEMETRY_VERSION;
+	header->byte_order = TELEMETRY_BYTE_ORDER;
+	header->block_size = sizeof(struct telemetryBlock);
+	header->block_rows = TELEMETRY_BLOCK_ROWS;
+}
+
+static bool telemetry_header_ok(const struct telemetryHeader *header) {
+	struct telemetryHeader want;
+	telemetry_make_header(&want);
+	return memcmp(header, &want, sizeof(want)) == 0;
+}
+
+static off_t telemetry_block_offset(size_t block_num) {
+	return sizeof(struct telemetryHeader) +
+	       (off_t)block_num * sizeof(struct telemetryBlock);
+}
+
+bool telemetry_open(struct telemetryWriter *w, const char *path) {
+	memset(w, 0, sizeof(*w));
+	w->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (w->fd == -1) {
+		return false;
+	}
+	struct telemetryHeader header;
+	ssize_t got = pread(w->fd, &header, sizeof(header), 0);
+	if (got == 0) {
+		telemetry_make_header(&header);
+		got = pwrite(w->fd, &header, sizeof(header), 0);
+	}
+	struct stat st;
+	if (got != sizeof(header) || !telemetry_header_ok(&header) ||
+		fstat(w->fd, &st) == -1) {
+		close(w->fd);
+		w->fd = -1;
+		return false;
+	}
+	// Carry on filling the last block, a torn one gets written again
+	size_t block_count = (st.st_size - sizeof(header)) /
+			     sizeof(struct telemetryBlock);
+	if (block_count == 0) {
+		return true;
+	}
+	w->block_num = block_count - 1;
+	got = pread(w->fd, &w->block, sizeof(w->block),
+		telemetry_block_offset(w->block_num));
+	if (got != sizeof(w->block) || w->block.count > TELEMETRY_BLOCK_ROWS) {
+		close(w->fd);
+		w->fd = -1;
+		return false;
+	}
+	if (w->block.count > 0) {
+		telemetry_block_row(&w->block, w->block.count - 1, &w->last);
+		w->has_last = true;
+	}
+	if (w->block.count == TELEMETRY_BLOCK_ROWS) {
+		memset(&w->block, 0, sizeof(w->block));
+		w->block_num += 1;
+	}
+	return true;
+}
+
+void telemetry_close(struct telemetryWriter *w) {
+	if (w->fd == -1) {
+		return;
+	}
+	telemetry_flush(w);
+	close(w->fd);
+	w->fd = -1;
+}
+
+bool telemetry_flush(struct telemetryWriter *w) {
+	if (w->block.count == 0) {
+		return true;
+	}
+	ssize_t written = pwrite(w->fd, &w->block, sizeof(w->block),
+		telemetry_block_offset(w->block_num));
+	if (written != sizeof(w->block)) {
+		return false;
+	}
+	w->stats.blocks_written += 1;
+	return true;
+}
+
+bool telemetry_append(struct telemetryWriter *w, int64_t time_us,
+	const struct statusState *state) {
+	struct telemetryRow row;
+	telemetry_make_row(&row, time_us, state);
+	if (w->has_last && telemetry_same_row(&row, &w->last)) {
+		w->stats.unchanged += 1;
+		return true;
+	}
+	struct telemetryBlock *block = &w->block;
+	if (block->count == 0) {
+		block->first_us = time_us;
+	}
+	telemetry_block_store(block, block->count, &row);
+	block->count += 1;
+	block->last_us = time_us;
+	w->last = row;
+	w->has_last = true;
+	w->stats.appended += 1;
+	if (block->count < TELEMETRY_BLOCK_ROWS) {
+		return true;
+	}
+	bool flushed = telemetry_flush(w);
+	memset(block, 0, sizeof(*block));
+	w->block_num += 1;
+	return flushed;
+}
+
+bool telemetry_map(struct telemetryReader *r, const char *path) {
+	memset(r, 0, sizeof(*r));
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == -1 ||
+		(size_t)st.st_size < sizeof(struct telemetryHeader)) {
+		close(fd);
+		return false;
+	}
+	r->map_len = st.st_size;
+	r->map = mmap(NULL, r->map_len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (r->map == MAP_FAILED) {
+		r->map = NULL;
+		return false;
+	}
+	const struct telemetryHeader *header = r->map;
+	if (!telemetry_header_ok(header)) {
+		telemetry_unmap(r);
+		return false;
+	}
+	r->blocks = (const struct telemetryBlock *)(header + 1);
+	r->block_count = (r->map_len - sizeof(*header)) /
+			 sizeof(struct telemetryBlock);
+	// Only the last block can be part filled
+	if (r->block_count > 0) {
+		const struct telemetryBlock *last =
+			&r->blocks[r->block_count - 1];
+		if (last->count > TELEMETRY_BLOCK_ROWS) {
+			telemetry_unmap(r);
+			return false;
+		}
+		r->row_count = (r->block_count - 1) * TELEMETRY_BLOCK_ROWS +
+			       last->count;
+	}
+	return true;
+}
+
+void telemetry_unmap(struct telemetryReader *r) {
+	if (r->map != NULL) {
+		munmap(r->map, r->map_len);
+	}
+	memset(r, 0, sizeof(*r));
+}
+
+size_t telemetry_find(const struct telemetryReader *r, int64_t time_us) {
+	// First block that ends at or after the time
+	size_t low = 0;
+	size_t high = r->block_count;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		const struct telemetryBlock *block = &r->blocks[mid];
+		if (block->count == 0 || block->last_us < time_us) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	if (low == r->block_count) {
+		return r->row_count;
+	}
+	const struct telemetryBlock *block = &r->blocks[low];
+	size_t row_low = 0;
+	size_t row_high = block->count;
+	// Full blocks aren't checked when mapping
+	if (row_high > TELEMETRY_BLOCK_ROWS) {
+		row_high = TELEMETRY_BLOCK_ROWS;
+	}
+	while (row_low < row_high) {
+		size_t mid = row_low + (row_high - row_low) / 2;
+		if (block->time_us[mid] < time_us) {
+			row_low = mid + 1;
+		} else {
+			row_high = mid;
+		}
+	}
+	return low * TELEMETRY_BLOCK_ROWS + row_low;
+}
+
+void telemetry_row(
+	const struct telemetryReader *r, size_t n, struct telemetryRow *row) {
+	telemetry_block_row(&r->blocks[n / TELEMETRY_BLOCK_ROWS],
+		n % TELEMETRY_BLOCK_ROWS, row);
+}
@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "status.h"
+
+// Append-only log of decoded get_status replies, small enough to keep weeks
+// of history on the printer's flash. Each row is a timestamp and the fields
+// worth graphing, with strings stored as codes from a fixed word list. Rows
+// are only written when a field changes, so hours of identical polls cost
+// nothing and a field's value at any time is the one in the last row before
+// it.
+//
+// The file is a header then fixed size blocks of TELEMETRY_BLOCK_ROWS rows,
+// stored column by column. Blocks are written whole, so a writer only ever
+// rewrites the block it's filling. The reader maps the file and finds rows by
+// binary search on the time column without decoding anything else. Numbers
+// are in host byte order, the header says which.
+
+#define TELEMETRY_MAGIC "ACETLM1"
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_BLOCK_ROWS 256
+// A word that isn't in the list
+#define TELEMETRY_WORD_OTHER 0xFF
+
+struct telemetryHeader {
+	char magic[8];
+	uint32_t version;
+	// 0x01020304 as written by the host
+	uint32_t byte_order;
+	uint32_t block_size;
+	uint32_t block_rows;
+};
+
+struct telemetryBlock {
+	uint32_t count;
+	uint32_t reserved;
+	int64_t first_us;
+	int64_t last_us;
+	int64_t time_us[TELEMETRY_BLOCK_ROWS];
+	int32_t dryer_remain[TELEMETRY_BLOCK_ROWS];
+	int16_t temp[TELEMETRY_BLOCK_ROWS];
+	int16_t dryer_target[TELEMETRY_BLOCK_ROWS];
+	uint16_t fan_speed[TELEMETRY_BLOCK_ROWS];
+	uint8_t status[TELEMETRY_BLOCK_ROWS];
+	uint8_t action[TELEMETRY_BLOCK_ROWS];
+	uint8_t dryer_status[TELEMETRY_BLOCK_ROWS];
+	uint8_t slot_count[TELEMETRY_BLOCK_ROWS];
+	uint8_t slot_status[STATUS_MAX_SLOTS][TELEMETRY_BLOCK_ROWS];
+	uint8_t slot_rfid[STATUS_MAX_SLOTS][TELEMETRY_BLOCK_ROWS];
+};
+
+// One row pulled out of the columns
+struct telemetryRow {
+	int64_t time_us;
+	int32_t dryer_remain;
+	int16_t temp;
+	int16_t dryer_target;
+	uint16_t fan_speed;
+	uint8_t status;
+	uint8_t action;
+	uint8_t dryer_status;
+	uint8_t slot_count;
+	uint8_t slot_status[STATUS_MAX_SLOTS];
+	uint8_t slot_rfid[STATUS_MAX_SLOTS];
+};
+
+struct telemetryStats {
+	unsigned long appended;
+	// Rows the same as the last one, not written
+	unsigned long unchanged;
+	unsigned long blocks_written;
+};
+
+struct telemetryWriter {
+	int fd;
+	size_t block_num;
+	struct telemetryBlock block;
+	bool has_last;
+	struct telemetryRow last;
+	struct telemetryStats stats;
+};
+
+struct telemetryReader {
+	void *map;
+	size_t map_len;
+	const struct telemetryBlock *blocks;
+	size_t block_count;
+	size_t row_count;
+};
+
+// Opens a log to append to, creating it if needed. Returns false if it
+// can't be opened or isn't a log this code can read.
+bool telemetry_open(struct telemetryWriter *w, const char *path);
+void telemetry_close(struct telemetryWriter *w);
+
+// Adds a row for a status at a time, which must not go backwards. Returns
+// false on a write error.
+bool telemetry_append(struct telemetryWriter *w, int64_t time_us,
+	const struct statusState *state);
+
+// Writes the block being filled so readers see it
+bool telemetry_flush(struct telemetryWriter *w);
+
+// Maps a log for reading. Fails if the header doesn't match or the last block
+// claims more rows than a block holds.
+bool telemetry_map(struct telemetryReader *r, const char *path);
+void telemetry_unmap(struct telemetryReader *r);
+
+// Number of the first row at or after a time, or row_count if none
+size_t telemetry_find(const struct telemetryReader *r, int64_t time_us);
+
+// Copies out row n, which must be under row_count
+void telemetry_row(
+	const struct telemetryReader *r, size_t n, struct telemetryRow *row);
+
+// The code for a status or action word and back, "" is code 0
+uint8_t telemetry_word_code(const char *word);
+const char *telemetry_word(uint8_t code);
+
+#endif
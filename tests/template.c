@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#include <string.h>
+
+#include "crc.h"
+#include "encoder.h"
+#include "mjson.h"
+#include "template.h"
+
+bool template_init(struct requestTemplate *t, const char *method,
+	const char *params) {
+	int len = mjson_snprintf(
+		t->prefix, sizeof(t->prefix), "{%Q:", "id");
+	if (len <= 0 || (size_t)len >= sizeof(t->prefix)) {
+		return false;
+	}
+	t->prefix_len = len;
+	if (params == NULL) {
+		len = mjson_snprintf(t->suffix, sizeof(t->suffix),
+			",%Q:%Q}", "method", method);
+	} else {
+		len = mjson_snprintf(t->suffix, sizeof(t->suffix),
+			",%Q:%Q,%Q:%s}", "method", method, "params", params);
+	}
+	if (len <= 0 || (size_t)len >= sizeof(t->suffix)) {
+		return false;
+	}
+	t->suffix_len = len;
+	t->prefix_crc = crc_update(
+		crc_init(), (unsigned char *)t->prefix, t->prefix_len);
+	t->suffix_crc = crc_update(
+		0, (unsigned char *)t->suffix, t->suffix_len);
+	crc_shift_init(&t->suffix_shift, t->suffix_len);
+	return true;
+}
+
+size_t template_render(
+	const struct requestTemplate *t, int id, unsigned char *buf) {
+	unsigned char *payload = buf + ENCODER_HEADER_LEN;
+	unsigned char *digits = payload + t->prefix_len;
+	memcpy(payload, t->prefix, t->prefix_len);
+	size_t digits_len = encoder_int(digits, id);
+	size_t payload_len = t->prefix_len + digits_len + t->suffix_len;
+	memcpy(digits + digits_len, t->suffix, t->suffix_len);
+	uint16_t crc = crc_update(t->prefix_crc, digits, digits_len);
+	crc = crc_shift(&t->suffix_shift, crc) ^ t->suffix_crc;
+	encoder_header(buf, payload_len);
+	encoder_trailer(payload + payload_len, crc_finish(crc));
+	size_t frame_len = payload_len + ENCODER_OVERHEAD;
+	if (encoder_collides(buf, frame_len)) {
+		return 0;
+	}
+	return frame_len;
+}
@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "crc.h"
+
+// Prebuilt request frames that only differ by id. The payload is split
+// around the id in to a prefix and suffix:
+//
+//   {"id":  663  ,"method":"get_status"}
+//
+// The CRC of the prefix is worked out once and the suffix is skipped over
+// with a crcShift. Rendering a frame is then copying the pieces, a CRC over
+// the id's digits and four lookups.
+
+#define TEMPLATE_PREFIX_LEN 16
+#define TEMPLATE_SUFFIX_LEN 256
+
+struct requestTemplate {
+	char prefix[TEMPLATE_PREFIX_LEN];
+	size_t prefix_len;
+	uint16_t prefix_crc;
+	char suffix[TEMPLATE_SUFFIX_LEN];
+	size_t suffix_len;
+	// CRC of the suffix starting from zero
+	uint16_t suffix_crc;
+	struct crcShift suffix_shift;
+};
+
+// Builds a template for a method with params as raw JSON, or NULL for none.
+// Returns false if the request is too big for a template.
+bool template_init(struct requestTemplate *t, const char *method,
+	const char *params);
+
+// Renders the frame for an id in to buf, which needs ENCODER_MAX_FRAME bytes.
+// Returns the frame length, or 0 if the frame has FF AA past its header and
+// needs building with an encoder so it can be padded.
+size_t template_render(
+	const struct requestTemplate *t, int id, unsigned char *buf);
+
+#endif
@@ -0,0 +1,400 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#define _POSIX_C_SOURCE 199309L
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "transport.h"
+
+static void transport_arm(int timer_fd, long first_us, long interval_us) {
+	struct itimerspec spec = {0};
+	spec.it_value.tv_sec = first_us / 1000000;
+	spec.it_value.tv_nsec = (first_us % 1000000) * 1000;
+	spec.it_interval.tv_sec = interval_us / 1000000;
+	spec.it_interval.tv_nsec = (interval_us % 1000000) * 1000;
+	timerfd_settime(timer_fd, 0, &spec, NULL);
+}
+
+static void transport_disarm(int timer_fd) {
+	transport_arm(timer_fd, 0, 0);
+}
+
+static void transport_arm_keepalive(struct transport *t) {
+	transport_arm(t->keepalive_fd, t->keepalive_ms * 1000L, 0);
+}
+
+static void transport_ack_timer(int timer_fd) {
+	uint64_t expirations;
+	ssize_t ret = read(timer_fd, &expirations, sizeof(expirations));
+	(void)ret;
+}
+
+static int transport_add_timer(struct transport *t) {
+	int flags = TFD_NONBLOCK | TFD_CLOEXEC;
+	int timer_fd = timerfd_create(CLOCK_MONOTONIC, flags);
+	if (timer_fd == -1) {
+		return -1;
+	}
+	struct epoll_event event = {.events = EPOLLIN, .data.fd = timer_fd};
+	if (epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, timer_fd, &event) == -1) {
+		close(timer_fd);
+		return -1;
+	}
+	return timer_fd;
+}
+
+static void transport_update_events(struct transport *t) {
+	if (t->tty == -1) {
+		return;
+	}
+	bool pending = (t->out_pos < t->out_len);
+	bool want_write = (pending && !t->pace_waiting);
+	if (want_write == t->want_write) {
+		return;
+	}
+	struct epoll_event event = {.events = EPOLLIN, .data.fd = t->tty};
+	if (want_write) {
+		event.events |= EPOLLOUT;
+	}
+	epoll_ctl(t->epoll_fd, EPOLL_CTL_MOD, t->tty, &event);
+	t->want_write = want_write;
+}
+
+static void transport_disconnect(struct transport *t) {
+	epoll_ctl(t->epoll_fd, EPOLL_CTL_DEL, t->tty, NULL);
+	close(t->tty);
+	t->tty = -1;
+	t->out_pos = 0;
+	t->out_len = 0;
+	t->pace_waiting = false;
+	t->want_write = false;
+	t->stats.disconnects += 1;
+	decoder_reset(&t->dec);
+	transport_disarm(t->keepalive_fd);
+	transport_disarm(t->pace_fd);
+	long reconnect_us = t->reconnect_ms * 1000L;
+	transport_arm(t->reconnect_fd, reconnect_us, reconnect_us);
+	if (t->cb.disconnected) {
+		t->cb.disconnected(t->cb_data);
+	}
+}
+
+static bool transport_try_open(struct transport *t) {
+	t->stats.reconnect_attempts += 1;
+	int tty = t->open_tty();
+	if (tty == -1) {
+		return false;
+	}
+	int flags = fcntl(tty, F_GETFL);
+	fcntl(tty, F_SETFL, flags | O_NONBLOCK);
+	struct epoll_event event = {.events = EPOLLIN, .data.fd = tty};
+	if (epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, tty, &event) == -1) {
+		close(tty);
+		return false;
+	}
+	t->tty = tty;
+	t->want_write = false;
+	decoder_reset(&t->dec);
+	transport_disarm(t->reconnect_fd);
+	transport_arm_keepalive(t);
+	if (t->cb.connected) {
+		t->cb.connected(t->cb_data);
+	}
+	return true;
+}
+
+// Writes as much of data as the tty and pacing allow. Returns how much was
+// written, or -1 if the connection dropped.
+static ssize_t transport_write(
+	struct transport *t, const unsigned char *data, size_t len) {
+	size_t done = 0;
+	while (done < len && !t->pace_waiting) {
+		size_t chunk = len - done;
+		if (t->pace_chunk != 0 && chunk > t->pace_chunk) {
+			chunk = t->pace_chunk;
+		}
+		ssize_t written = write(t->tty, data + done, chunk);
+		if (written == -1 && errno == EINTR) {
+			continue;
+		} else if (written == -1 && errno == EAGAIN) {
+			break;
+		} else if (written == -1) {
+			transport_disconnect(t);
+			return -1;
+		}
+		t->stats.writes += 1;
+		done += written;
+		if (t->pace_us != 0) {
+			t->pace_waiting = true;
+			transport_arm(t->pace_fd, t->pace_us, 0);
+		}
+	}
+	return done;
+}
+
+// Everything queued has gone, so the ACE's keepalive restarts
+static void transport_sent(struct transport *t) {
+	t->out_pos = 0;
+	t->out_len = 0;
+	t->drained = true;
+	transport_arm_keepalive(t);
+}
+
+static void transport_flush(struct transport *t) {
+	ssize_t written = transport_write(
+		t, t->out_buf + t->out_pos, t->out_len - t->out_pos);
+	if (written == -1) {
+		return;
+	}
+	t->out_pos += written;
+	if (t->out_pos == t->out_len && t->out_len != 0) {
+		transport_sent(t);
+	}
+	transport_update_events(t);
+}
+
+bool transport_init(struct transport *t, int (*open_tty)(void),
+	const struct transportCallbacks *cb, void *cb_data) {
+	memset(&t->stats, 0, sizeof(t->stats));
+	t->tty = -1;
+	t->open_tty = open_tty;
+	t->keepalive_ms = TRANSPORT_KEEPALIVE_MS;
+	t->reconnect_ms = TRANSPORT_RECONNECT_MS;
+	t->cb = *cb;
+	t->cb_data = cb_data;
+	t->out_pos = 0;
+	t->out_len = 0;
+	t->pace_chunk = 0;
+	t->pace_us = 0;
+	t->pace_waiting = false;
+	t->want_write = false;
+	t->drained = false;
+	t->watch_count = 0;
+	t->keepalive_fd = -1;
+	t->pace_fd = -1;
+	t->reconnect_fd = -1;
+	decoder_init(&t->dec);
+	t->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (t->epoll_fd == -1) {
+		return false;
+	}
+	t->keepalive_fd = transport_add_timer(t);
+	t->pace_fd = transport_add_timer(t);
+	t->reconnect_fd = transport_add_timer(t);
+	if (t->keepalive_fd == -1 || t->pace_fd == -1 ||
+		t->reconnect_fd == -1) {
+		transport_close(t);
+		return false;
+	}
+	if (!transport_try_open(t)) {
+		long reconnect_us = t->reconnect_ms * 1000L;
+		transport_arm(t->reconnect_fd, reconnect_us, reconnect_us);
+	}
+	return true;
+}
+
+void transport_close(struct transport *t) {
+	int fds[] = {t->tty, t->keepalive_fd, t->pace_fd, t->reconnect_fd,
+		t->epoll_fd};
+	for (size_t i = 0; i < sizeof(fds) / sizeof(*fds); ++i) {
+		if (fds[i] != -1) {
+			close(fds[i]);
+		}
+	}
+	t->tty = -1;
+	t->keepalive_fd = -1;
+	t->pace_fd = -1;
+	t->reconnect_fd = -1;
+	t->epoll_fd = -1;
+}
+
+bool transport_connected(const struct transport *t) {
+	return t->tty != -1;
+}
+
+size_t transport_pending(const struct transport *t) {
+	return t->out_len - t->out_pos;
+}
+
+bool transport_send(struct transport *t, const void *buf, size_t len) {
+	if (t->tty == -1) {
+		return false;
+	}
+	if (t->out_pos == t->out_len) {
+		t->out_pos = 0;
+		t->out_len = 0;
+	} else if (t->out_pos != 0) {
+		memmove(t->out_buf, t->out_buf + t->out_pos,
+			t->out_len - t->out_pos);
+		t->out_len -= t->out_pos;
+		t->out_pos = 0;
+	}
+	if (len > sizeof(t->out_buf) - t->out_len) {
+		return false;
+	}
+	if (t->out_len == 0) {
+		// Nothing queued, so write straight from buf and only queue
+		// what's left
+		ssize_t written = transport_write(t, buf, len);
+		if (written == -1) {
+			return false;
+		}
+		size_t left = len - written;
+		if (left == 0) {
+			if (len != 0) {
+				transport_sent(t);
+			}
+			return true;
+		}
+		memcpy(t->out_buf, (const unsigned char *)buf + written, left);
+		t->out_len = left;
+		transport_update_events(t);
+		return true;
+	}
+	memcpy(t->out_buf + t->out_len, buf, len);
+	t->out_len += len;
+	transport_flush(t);
+	// The write may have found the ACE gone, which throws the data away
+	return t->tty != -1;
+}
+
+void transport_set_pacing(struct transport *t, size_t chunk, int pace_us) {
+	t->pace_chunk = chunk;
+	t->pace_us = pace_us;
+}
+
+void transport_set_keepalive(struct transport *t, int keepalive_ms) {
+	t->keepalive_ms = keepalive_ms;
+	if (t->tty != -1) {
+		transport_arm_keepalive(t);
+	}
+}
+
+void transport_set_reconnect(struct transport *t, int reconnect_ms) {
+	t->reconnect_ms = reconnect_ms;
+	if (t->tty == -1) {
+		long reconnect_us = reconnect_ms * 1000L;
+		transport_arm(t->reconnect_fd, reconnect_us, reconnect_us);
+	}
+}
+
+bool transport_watch(
+	struct transport *t, int fd, void (*fn)(void *data), void *data) {
+	if (t->watch_count == TRANSPORT_MAX_WATCHES) {
+		return false;
+	}
+	struct epoll_event event = {.events = EPOLLIN, .data.fd = fd};
+	if (epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+		return false;
+	}
+	struct transportWatch *watch = &t->watches[t->watch_count++];
+	watch->fd = fd;
+	watch->fn = fn;
+	watch->data = data;
+	return true;
+}
+
+void transport_unwatch(struct transport *t, int fd) {
+	for (size_t i = 0; i < t->watch_count; ++i) {
+		if (t->watches[i].fd == fd) {
+			epoll_ctl(t->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+			t->watches[i] = t->watches[--t->watch_count];
+			return;
+		}
+	}
+}
+
+static void transport_handle_watch(struct transport *t, int fd) {
+	for (size_t i = 0; i < t->watch_count; ++i) {
+		struct transportWatch *watch = &t->watches[i];
+		if (watch->fd == fd) {
+			watch->fn(watch->data);
+			return;
+		}
+	}
+}
+
+static void transport_handle_tty(struct transport *t, uint32_t events) {
+	if (events & EPOLLIN) {
+		ssize_t read_count = decoder_read(&t->dec, t->tty);
+		t->stats.reads += 1;
+		bool failed = (read_count == -1 && errno != EAGAIN &&
+			errno != EINTR);
+		if (read_count == 0 || failed) {
+			transport_disconnect(t);
+			return;
+		}
+		struct decoderFrame frame;
+		enum decoderResult result;
+		while ((result = decoder_next(&t->dec, &frame)) !=
+			DECODER_MORE) {
+			if (result == DECODER_FRAME && t->cb.frame) {
+				t->cb.frame(t->cb_data, &frame);
+			}
+			if (t->tty == -1) {
+				return;
+			}
+		}
+	}
+	if (events & EPOLLOUT) {
+		transport_flush(t);
+	}
+	if (t->tty != -1 && (events & (EPOLLHUP | EPOLLERR))) {
+		transport_disconnect(t);
+	}
+}
+
+int transport_run(struct transport *t, int timeout_ms) {
+	if (t->drained) {
+		timeout_ms = 0;
+	}
+	struct epoll_event events[TRANSPORT_MAX_EVENTS];
+	int count = epoll_wait(
+		t->epoll_fd, events, TRANSPORT_MAX_EVENTS, timeout_ms);
+	if (count == -1 && errno == EINTR) {
+		return 0;
+	} else if (count == -1) {
+		return -1;
+	}
+	t->stats.wakeups += 1;
+	for (int i = 0; i < count; ++i) {
+		int fd = events[i].data.fd;
+		if (fd == t->tty && t->tty != -1) {
+			transport_handle_tty(t, events[i].events);
+		} else if (fd == t->keepalive_fd) {
+			transport_ack_timer(fd);
+			if (t->tty != -1 && t->cb.keepalive) {
+				t->stats.keepalives += 1;
+				t->cb.keepalive(t->cb_data);
+			}
+		} else if (fd == t->pace_fd) {
+			transport_ack_timer(fd);
+			t->pace_waiting = false;
+			if (t->tty != -1) {
+				transport_flush(t);
+			}
+		} else if (fd == t->reconnect_fd) {
+			transport_ack_timer(fd);
+			if (t->tty == -1) {
+				transport_try_open(t);
+			}
+		} else {
+			transport_handle_watch(t, fd);
+		}
+	}
+	if (t->drained) {
+		t->drained = false;
+		if (t->cb.drained) {
+			t->cb.drained(t->cb_data);
+		}
+	}
+	return count;
+}
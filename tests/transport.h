@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: CC0
+// SPDX-FileCopyrightText: Copyright 2024 Jookia
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "decoder.h"
+
+// Non-blocking connection to the ACE run from an epoll loop. Reads, writes,
+// write pacing, keepalive deadlines and reconnects are all events, so a
+// thread waiting in transport_run uses no CPU until something happens.
+//
+// The ACE drops the connection if it gets no frame for 3 seconds. The
+// keepalive callback is called once no frame has been written for
+// TRANSPORT_KEEPALIVE_MS by default, it should send something. When the ACE
+// does drop the connection any unsent output is discarded and the transport
+// retries opening the device every TRANSPORT_RECONNECT_MS by default.
+
+#define TRANSPORT_OUT_SIZE 4096
+#define TRANSPORT_KEEPALIVE_MS 1000
+#define TRANSPORT_RECONNECT_MS 50
+#define TRANSPORT_MAX_EVENTS 8
+#define TRANSPORT_MAX_WATCHES 4
+
+struct transportCallbacks {
+	// A valid frame arrived. The payload is valid until the next
+	// transport_run.
+	void (*frame)(void *data, const struct decoderFrame *frame);
+	void (*connected)(void *data);
+	void (*disconnected)(void *data);
+	void (*keepalive)(void *data);
+	// Everything queued has been written
+	void (*drained)(void *data);
+};
+
+// Extra file descriptor handled by the loop, such as a layer's own timer
+struct transportWatch {
+	int fd;
+	void (*fn)(void *data);
+	void *data;
+};
+
+struct transportStats {
+	unsigned long wakeups;
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long keepalives;
+	unsigned long disconnects;
+	unsigned long reconnect_attempts;
+};
+
+struct transport {
+	int epoll_fd;
+	int tty;
+	int keepalive_fd;
+	int pace_fd;
+	int reconnect_fd;
+	int (*open_tty)(void);
+	int keepalive_ms;
+	int reconnect_ms;
+	struct transportCallbacks cb;
+	void *cb_data;
+	struct decoder dec;
+	unsigned char out_buf[TRANSPORT_OUT_SIZE];
+	size_t out_pos;
+	size_t out_len;
+	size_t pace_chunk;
+	int pace_us;
+	bool pace_waiting;
+	bool want_write;
+	bool drained;
+	struct transportWatch watches[TRANSPORT_MAX_WATCHES];
+	size_t watch_count;
+	struct transportStats stats;
+};
+
+// Sets up the loop and tries to open the device with open_tty, which
+// returns -1 if it isn't there yet. Returns false if the loop can't be set
+// up, not opening the device is fine.
+bool transport_init(struct transport *t, int (*open_tty)(void),
+	const struct transportCallbacks *cb, void *cb_data);
+void transport_close(struct transport *t);
+
+bool transport_connected(const struct transport *t);
+
+// Writes data, straight from buf if nothing is queued, and queues whatever
+// can't be written yet. Returns false if not connected, there isn't room, or
+// the connection dropped while writing.
+bool transport_send(struct transport *t, const void *buf, size_t len);
+
+// Bytes queued but not written yet
+size_t transport_pending(const struct transport *t);
+
+// Writes at most chunk bytes every pace_us microseconds, 0 turns it off
+void transport_set_pacing(struct transport *t, size_t chunk, int pace_us);
+
+// Sets how long the link can be idle before the keepalive callback, this must
+// leave time to send something before the ACE gives up after 3 seconds
+void transport_set_keepalive(struct transport *t, int keepalive_ms);
+
+// Sets how often to retry opening the device once it's gone
+void transport_set_reconnect(struct transport *t, int reconnect_ms);
+
+// Calls fn from the loop whenever fd is readable
+bool transport_watch(
+	struct transport *t, int fd, void (*fn)(void *data), void *data);
+// Stops watching fd, this must be done before closing it
+void transport_unwatch(struct transport *t, int fd);
+
+// Waits up to timeout_ms for events and handles them, -1 waits forever.
+// Returns the number of events handled or -1 on error.
+int transport_run(struct transport *t, int timeout_ms);
+
+#endif